@@ -55,6 +55,13 @@ VERSION HISTORY:
 
 #include "base64.h"
 
+#include <cassert>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NP1SEC_BASE64_X86
+#include <immintrin.h>
+#endif
+
 namespace np1sec
 {
 
@@ -64,9 +71,26 @@ namespace np1sec
 static const char cb64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 /*
-** Translation Table to decode (created by author)
+** Translation Table to decode; 0xff marks characters outside the alphabet
 */
-static const char cd64[] = "|$$$}rstuvwxyz{$$$$$$$>?@ABCDEFGHIJKLMNOPQRSTUVW$$$$$$XYZ[\\]^_`abcdefghijklmnopq";
+static const unsigned char cd64[256] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
 
 /*
 ** encodeblock
@@ -87,13 +111,7 @@ static void encodeblock(char* out, const unsigned char* in, size_t len)
 	out[3] = len > 2 ? cb64[in2 & 0x3f] : '=';
 }
 
-/*
- * base64 encode data.  Insert no linebreaks or whitespace.
- *
- * The buffer base64data must contain at least ((datalen+2)/3)*4 bytes of
- * space.  This function will return the number of bytes actually used.
- */
-size_t base64_encode(char* base64data, const unsigned char* data, size_t datalen)
+static size_t encode_scalar(char* base64data, const unsigned char* data, size_t datalen)
 {
 	size_t base64len = 0;
 	
@@ -112,74 +130,361 @@ size_t base64_encode(char* base64data, const unsigned char* data, size_t datalen
 	return base64len;
 }
 
-static size_t decode(unsigned char* out, const char* in, size_t b64len)
+/*
+ * Decodes a sequence of four-character blocks, the last of which may be
+ * padded. Padded blocks must not have any bits set past the data.
+ */
+static bool decode_scalar(unsigned char* data, const char* base64data, size_t base64len, size_t* datalen)
 {
+	assert(base64len % 4 == 0);
+	
+	const unsigned char* in = reinterpret_cast<const unsigned char*>(base64data);
 	size_t written = 0;
-	unsigned char c = 0;
 	
-	if (b64len > 0) {
-		c = in[0] << 2;
-	}
-	if (b64len > 1) {
-		out[0] = c | in[1] >> 4;
-		written = 1;
-		c = in[1] << 4;
+	while (base64len > 0) {
+		unsigned char a = cd64[in[0]];
+		unsigned char b = cd64[in[1]];
+		if (base64len == 4 && in[3] == '=') {
+			if (in[2] == '=') {
+				if ((a | b) > 0x3f || (b & 0x0f)) {
+					return false;
+				}
+				data[written++] = (a << 2) | (b >> 4);
+			} else {
+				unsigned char c = cd64[in[2]];
+				if ((a | b | c) > 0x3f || (c & 0x03)) {
+					return false;
+				}
+				data[written++] = (a << 2) | (b >> 4);
+				data[written++] = (b << 4) | (c >> 2);
+			}
+			break;
+		}
+		
+		unsigned char c = cd64[in[2]];
+		unsigned char d = cd64[in[3]];
+		if ((a | b | c | d) > 0x3f) {
+			return false;
+		}
+		data[written++] = (a << 2) | (b >> 4);
+		data[written++] = (b << 4) | (c >> 2);
+		data[written++] = (c << 6) | d;
+		
+		in += 4;
+		base64len -= 4;
 	}
-	if (b64len > 2) {
-		out[1] = c | in[2] >> 2;
-		written = 2;
-		c = in[2] << 6;
+	
+	*datalen = written;
+	return true;
+}
+
+#ifdef NP1SEC_BASE64_X86
+
+/*
+ * The vectorized codecs follow the pshufb based approach of Wojciech Muła
+ * and Daniel Lemire, "Faster Base64 Encoding and Decoding using AVX2
+ * Instructions". Each 128-bit lane turns 12 bytes into 16 characters, or
+ * back. They only handle whole blocks well inside the buffers and leave the
+ * tail, including any padding, to the scalar code.
+ */
+
+__attribute__((target("sse4.1")))
+static inline __m128i encode_lookup_sse41(__m128i indices)
+{
+	/*
+	 * Map each index to the offset between it and its character:
+	 * 0..25 to slot 13, 26..51 to slot 0, 52..61 to slots 1..10, and
+	 * 62 and 63 to slots 11 and 12.
+	 */
+	const __m128i offsets = _mm_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	__m128i slots = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+	__m128i uppercase = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+	slots = _mm_or_si128(slots, _mm_and_si128(uppercase, _mm_set1_epi8(13)));
+	return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, slots));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i encode_split_sse41(__m128i input)
+{
+	/*
+	 * Spread bytes b0 b1 b2 of each block over a 32-bit lane as b1 b0 b2 b1,
+	 * then shift the four 6-bit fields into place with two multiplications.
+	 */
+	const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	input = _mm_shuffle_epi8(input, shuffle);
+	__m128i high = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+	__m128i low = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(high, low);
+}
+
+/*
+ * Returns the number of input bytes encoded; the output holds 4/3 as many.
+ */
+__attribute__((target("sse4.1")))
+static size_t encode_sse41(char* base64data, const unsigned char* data, size_t datalen)
+{
+	size_t consumed = 0;
+	while (datalen - consumed >= 16) {
+		__m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + consumed));
+		__m128i output = encode_lookup_sse41(encode_split_sse41(input));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(base64data), output);
+		base64data += 16;
+		consumed += 12;
 	}
-	if (b64len > 3) {
-		out[2] = c | in[3];
-		written = 3;
+	return consumed;
+}
+
+__attribute__((target("avx2")))
+static size_t encode_avx2(char* base64data, const unsigned char* data, size_t datalen)
+{
+	const __m256i shuffle = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i offsets = _mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	
+	size_t consumed = 0;
+	while (datalen - consumed >= 28) {
+		const unsigned char* in = data + consumed;
+		__m256i input = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12)),
+			1);
+		input = _mm256_shuffle_epi8(input, shuffle);
+		__m256i high = _mm256_mulhi_epu16(_mm256_and_si256(input, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		__m256i low = _mm256_mullo_epi16(_mm256_and_si256(input, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		__m256i indices = _mm256_or_si256(high, low);
+		
+		__m256i slots = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		__m256i uppercase = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+		slots = _mm256_or_si256(slots, _mm256_and_si256(uppercase, _mm256_set1_epi8(13)));
+		__m256i output = _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, slots));
+		
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(base64data), output);
+		base64data += 32;
+		consumed += 24;
 	}
-	return written;
+	return consumed;
 }
 
 /*
- * base64 decode data.  Skip non-base64 chars, and terminate at the
- * first '=', or the end of the buffer.
- *
- * The buffer data must contain at least ((base64len+3) / 4) * 3 bytes
- * of space.  This function will return the number of bytes actually
- * used.
+ * Decodes whole 16-character blocks while at least one padded block and
+ * enough room for the 16-byte stores remain. Returns false if any of the
+ * decoded characters is outside the alphabet; consumed is set to the
+ * number of characters decoded otherwise.
  */
-size_t base64_decode(unsigned char* data, const char* base64data, size_t base64len)
+__attribute__((target("sse4.1")))
+static bool decode_sse41(unsigned char* data, const char* base64data, size_t base64len, size_t* consumed)
 {
-	size_t datalen = 0;
-	char b64[4];
-	size_t b64accum = 0;
+	/*
+	 * A character is valid iff the bit sets looked up by its low and high
+	 * nibble are disjoint. The high nibble, adjusted for '/', then selects
+	 * the offset that maps the character onto its 6-bit value.
+	 */
+	const __m128i lookup_low = _mm_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lookup_high = _mm_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lookup_offset = _mm_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71,
+		0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask = _mm_set1_epi8(0x2f);
+	const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
 	
-	while (base64len > 0) {
-		char b = *base64data;
-		unsigned char bdecode;
-		++base64data;
-		--base64len;
-		if (b < '+' || b > 'z')
-			continue; /* Skip non-base64 chars */
-		if (b == '=') {
-			/* Force termination */
-			datalen += decode(data, b64, b64accum);
-			base64len = 0;
-		} else {
-			bdecode = cd64[b - '+'];
-			if (bdecode == '$')
-				continue; /* Skip non-base64 chars */
-			b64[b64accum++] = bdecode - '>';
-			if (b64accum == 4) {
-				/* We have a complete block; decode it. */
-				size_t written = decode(data, b64, b64accum);
-				data += written;
-				datalen += written;
-				b64accum = 0;
-			}
+	size_t decoded = 0;
+	while (base64len - decoded >= 24) {
+		__m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base64data + decoded));
+		__m128i high_nibbles = _mm_and_si128(_mm_srli_epi32(input, 4), mask);
+		__m128i low_nibbles = _mm_and_si128(input, mask);
+		__m128i low = _mm_shuffle_epi8(lookup_low, low_nibbles);
+		__m128i high = _mm_shuffle_epi8(lookup_high, high_nibbles);
+		if (!_mm_testz_si128(low, high)) {
+			return false;
 		}
+		__m128i slash = _mm_cmpeq_epi8(input, mask);
+		__m128i values = _mm_add_epi8(input, _mm_shuffle_epi8(lookup_offset, _mm_add_epi8(slash, high_nibbles)));
+		
+		__m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+		__m128i blocks = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(data), _mm_shuffle_epi8(blocks, pack));
+		data += 12;
+		decoded += 16;
 	}
+	*consumed = decoded;
+	return true;
+}
+
+__attribute__((target("avx2")))
+static bool decode_avx2(unsigned char* data, const char* base64data, size_t base64len, size_t* consumed)
+{
+	const __m256i lookup_low = _mm256_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lookup_high = _mm256_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lookup_offset = _mm256_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71,
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71,
+		0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i mask = _mm256_set1_epi8(0x2f);
+	const __m256i pack = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
 	
-	/* Just discard any short block at the end. */
+	size_t decoded = 0;
+	while (base64len - decoded >= 40) {
+		__m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base64data + decoded));
+		__m256i high_nibbles = _mm256_and_si256(_mm256_srli_epi32(input, 4), mask);
+		__m256i low_nibbles = _mm256_and_si256(input, mask);
+		__m256i low = _mm256_shuffle_epi8(lookup_low, low_nibbles);
+		__m256i high = _mm256_shuffle_epi8(lookup_high, high_nibbles);
+		if (!_mm256_testz_si256(low, high)) {
+			return false;
+		}
+		__m256i slash = _mm256_cmpeq_epi8(input, mask);
+		__m256i values = _mm256_add_epi8(input, _mm256_shuffle_epi8(lookup_offset, _mm256_add_epi8(slash, high_nibbles)));
+		
+		__m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+		__m256i blocks = _mm256_shuffle_epi8(_mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000)), pack);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(data), _mm256_castsi256_si128(blocks));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(data + 12), _mm256_extracti128_si256(blocks, 1));
+		data += 24;
+		decoded += 32;
+	}
+	*consumed = decoded;
+	return true;
+}
+
+#endif
+
+static Base64Codec detect_codec()
+{
+	if (base64_codec_supported(Base64Codec::Avx2)) {
+		return Base64Codec::Avx2;
+	} else if (base64_codec_supported(Base64Codec::Sse41)) {
+		return Base64Codec::Sse41;
+	} else {
+		return Base64Codec::Scalar;
+	}
+}
+
+Base64Codec base64_default_codec()
+{
+	static const Base64Codec codec = detect_codec();
+	return codec;
+}
+
+bool base64_codec_supported(Base64Codec codec)
+{
+	switch (codec) {
+	case Base64Codec::Scalar:
+		return true;
+#ifdef NP1SEC_BASE64_X86
+	case Base64Codec::Sse41:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse4.1");
+	case Base64Codec::Avx2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+const char* base64_codec_name(Base64Codec codec)
+{
+	switch (codec) {
+	case Base64Codec::Scalar:
+		return "scalar";
+	case Base64Codec::Sse41:
+		return "sse4.1";
+	case Base64Codec::Avx2:
+		return "avx2";
+	}
+	return "unknown";
+}
+
+size_t base64_encode(char* base64data, const unsigned char* data, size_t datalen)
+{
+	return base64_encode(base64data, data, datalen, base64_default_codec());
+}
+
+size_t base64_encode(char* base64data, const unsigned char* data, size_t datalen, Base64Codec codec)
+{
+	assert(base64_codec_supported(codec));
+	
+	size_t base64len = 0;
+#ifdef NP1SEC_BASE64_X86
+	size_t consumed = 0;
+	if (codec == Base64Codec::Avx2) {
+		consumed = encode_avx2(base64data, data, datalen);
+	}
+	if (codec == Base64Codec::Avx2 || codec == Base64Codec::Sse41) {
+		consumed += encode_sse41(base64data + consumed / 3 * 4, data + consumed, datalen - consumed);
+	}
+	base64data += consumed / 3 * 4;
+	base64len += consumed / 3 * 4;
+	data += consumed;
+	datalen -= consumed;
+#endif
 	
-	return datalen;
+	return base64len + encode_scalar(base64data, data, datalen);
+}
+
+bool base64_decode(unsigned char* data, const char* base64data, size_t base64len, size_t* datalen)
+{
+	return base64_decode(data, base64data, base64len, datalen, base64_default_codec());
+}
+
+bool base64_decode(unsigned char* data, const char* base64data, size_t base64len, size_t* datalen, Base64Codec codec)
+{
+	assert(base64_codec_supported(codec));
+	
+	if (base64len % 4 != 0) {
+		return false;
+	}
+	
+	size_t written = 0;
+#ifdef NP1SEC_BASE64_X86
+	size_t consumed = 0;
+	if (codec == Base64Codec::Avx2) {
+		if (!decode_avx2(data, base64data, base64len, &consumed)) {
+			return false;
+		}
+	}
+	if (codec == Base64Codec::Avx2 || codec == Base64Codec::Sse41) {
+		size_t decoded;
+		if (!decode_sse41(data + consumed / 4 * 3, base64data + consumed, base64len - consumed, &decoded)) {
+			return false;
+		}
+		consumed += decoded;
+	}
+	data += consumed / 4 * 3;
+	written += consumed / 4 * 3;
+	base64data += consumed;
+	base64len -= consumed;
+#endif
+	
+	size_t tail;
+	if (!decode_scalar(data, base64data, base64len, &tail)) {
+		return false;
+	}
+	*datalen = written + tail;
+	return true;
 }
 
 } // namespace np1sec
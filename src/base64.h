@@ -24,6 +24,23 @@
 namespace np1sec
 {
 
+/*
+ * The base64 implementations available to this build. The vectorized ones
+ * are only usable when the running CPU supports the instruction set.
+ */
+enum class Base64Codec {
+	Scalar,
+	Sse41,
+	Avx2,
+};
+
+/*
+ * The fastest codec supported by the running CPU, detected on first use.
+ */
+Base64Codec base64_default_codec();
+bool base64_codec_supported(Base64Codec codec);
+const char* base64_codec_name(Base64Codec codec);
+
 /*
  * base64 encode data.  Insert no linebreaks or whitespace.
  *
@@ -31,16 +48,20 @@ namespace np1sec
  * space.  This function will return the number of bytes actually used.
  */
 size_t base64_encode(char* base64data, const unsigned char* data, size_t datalen);
+size_t base64_encode(char* base64data, const unsigned char* data, size_t datalen, Base64Codec codec);
 
 /*
- * base64 decode data.  Skip non-base64 chars, and terminate at the
- * first '=', or the end of the buffer.
+ * base64 decode data.  The input must be padded to a multiple of four
+ * characters, contain nothing but the base64 alphabet and trailing
+ * padding, and have no bits set beyond the end of the data; anything else
+ * is rejected by returning false.
  *
  * The buffer data must contain at least ((base64len+3) / 4) * 3 bytes
- * of space.  This function will return the number of bytes actually
+ * of space. On success, datalen is set to the number of bytes actually
  * used.
  */
-size_t base64_decode(unsigned char* data, const char* base64data, size_t base64len);
+bool base64_decode(unsigned char* data, const char* base64data, size_t base64len, size_t* datalen);
+bool base64_decode(unsigned char* data, const char* base64data, size_t base64len, size_t* datalen, Base64Codec codec);
 
 } // namespace np1sec
 
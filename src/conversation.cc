@@ -35,12 +35,16 @@ Conversation::Conversation(Room* room):
 	m_room(room),
 	m_conversation_private_key(PrivateKey::generate(true)),
 	m_interface(nullptr),
+	m_deadlines(room->interface(), DeadlineQueue::c_default_granularity, &room->mutable_statistics().timers),
 	m_conversation_status_hash(crypto::nonce_hash()),
+	m_membership_version(1),
+	m_events_version(1),
 	m_encrypted_chat(this)
 {
 	Participant self;
 	self.is_participant = true;
 	self.username = m_room->username();
+	self.handle = m_room->intern_username(self.username);
 	self.long_term_public_key = m_room->public_key();
 	self.conversation_public_key = m_conversation_private_key.public_key();
 	self.authentication_status = AuthenticationStatus::Authenticated;
@@ -57,12 +61,16 @@ Conversation::Conversation(Room* room, const ConversationStatusMessage& conversa
 	m_room(room),
 	m_conversation_private_key(PrivateKey::generate(true)),
 	m_interface(nullptr),
+	m_deadlines(room->interface(), DeadlineQueue::c_default_granularity, &room->mutable_statistics().timers),
+	m_membership_version(1),
+	m_events_version(1),
 	m_encrypted_chat(this)
 {
 	for (const ConversationStatusMessage::Participant& p : conversation_status.participants) {
 		Participant participant;
 		participant.is_participant = true;
 		participant.username = p.username;
+		participant.handle = m_room->intern_username(p.username);
 		participant.long_term_public_key = p.long_term_public_key;
 		participant.conversation_public_key = p.conversation_public_key;
 		participant.authentication_status = AuthenticationStatus::Unauthenticated;
@@ -82,6 +90,7 @@ Conversation::Conversation(Room* room, const ConversationStatusMessage& conversa
 		Participant participant;
 		participant.is_participant = false;
 		participant.username = i.username;
+		participant.handle = m_room->intern_username(i.username);
 		participant.long_term_public_key = i.long_term_public_key;
 		participant.conversation_public_key = i.conversation_public_key;
 		participant.inviter = i.inviter;
@@ -105,6 +114,9 @@ Conversation::Conversation(Room* room, const ConversationStatusMessage& conversa
 	if (m_participants.count(m_room->username())) {
 		throw MessageFormatException();
 	}
+	if (!m_participants.count(sender)) {
+		throw MessageFormatException();
+	}
 	
 	for (const ConversationStatusMessage::UnconfirmedInvite& i : conversation_status.unconfirmed_invites) {
 		UnconfirmedInvite invite;
@@ -161,15 +173,15 @@ Conversation::Conversation(Room* room, const ConversationStatusMessage& conversa
 		if (conversation_event.type == Message::Type::ConversationStatus) {
 			ConversationStatusEvent e = ConversationStatusEvent::decode(conversation_event, conversation_status);
 			event.conversation_status = e;
-			event.remaining_users = e.remaining_users;
+			event.remaining_users = intern_usernames(e.remaining_users);
 		} else if (conversation_event.type == Message::Type::ConversationConfirmation) {
 			ConversationConfirmationEvent e = ConversationConfirmationEvent::decode(conversation_event, conversation_status);
 			event.conversation_status = e;
-			event.remaining_users = e.remaining_users;
+			event.remaining_users = intern_usernames(e.remaining_users);
 		} else if (conversation_event.type == Message::Type::ConsistencyCheck) {
 			ConsistencyCheckEvent e = ConsistencyCheckEvent::decode(conversation_event, conversation_status);
 			event.consistency_check = e;
-			event.remaining_users = e.remaining_users;
+			event.remaining_users = intern_usernames(e.remaining_users);
 		} else if (
 			   conversation_event.type == Message::Type::KeyExchangePublicKey
 			|| conversation_event.type == Message::Type::KeyExchangeSecretShare
@@ -182,7 +194,7 @@ Conversation::Conversation(Room* room, const ConversationStatusMessage& conversa
 				if (key_exchange_ids.count(event.key_event.key_id)) {
 					throw MessageFormatException();
 				}
-				event.remaining_users = e.remaining_users;
+				event.remaining_users = intern_usernames(e.remaining_users);
 			} else {
 				if (!key_exchange_ids.count(event.key_event.key_id)) {
 					throw MessageFormatException();
@@ -191,12 +203,12 @@ Conversation::Conversation(Room* room, const ConversationStatusMessage& conversa
 					throw MessageFormatException();
 				}
 				key_exchange_event_ids.insert(event.key_event.key_id);
-				event.remaining_users = m_encrypted_chat.remaining_users(e.key_id);
+				event.remaining_users = intern_usernames(m_encrypted_chat.remaining_users(e.key_id));
 			}
 		} else if (conversation_event.type == Message::Type::KeyActivation) {
 			KeyActivationEvent e = KeyActivationEvent::decode(conversation_event, conversation_status);
 			event.key_event = e;
-			event.remaining_users = e.remaining_users;
+			event.remaining_users = intern_usernames(e.remaining_users);
 			if (key_exchange_ids.count(event.key_event.key_id)) {
 				throw MessageFormatException();
 			}
@@ -234,7 +246,7 @@ Conversation::Conversation(Room* room, const ConversationStatusMessage& conversa
 	conversation_status_event.conversation_status.invitee_username = m_room->username();
 	conversation_status_event.conversation_status.invitee_long_term_public_key = m_room->public_key();
 	conversation_status_event.conversation_status.status_message_hash = m_status_message_hash;
-	conversation_status_event.remaining_users.insert(sender);
+	conversation_status_event.remaining_users.insert(m_participants.at(sender).handle);
 	declare_event(std::move(conversation_status_event));
 }
 
@@ -413,15 +425,19 @@ void Conversation::votekick(const std::string& username, bool kick)
 		return;
 	}
 	
-	Participant& participant = m_participants[username];
-	if (participant.votekick_in_flight != kick) {
-		participant.votekick_in_flight = kick;
-		if (m_participants.at(m_room->username()).is_participant) {
-			VotekickMessage message;
-			message.victim = username;
-			message.kick = kick;
-			send_message(message.encode());
+	{
+		// No reference into m_participants may be held across sending.
+		Participant& participant = m_participants.at(username);
+		if (participant.votekick_in_flight == kick) {
+			return;
 		}
+		participant.votekick_in_flight = kick;
+	}
+	if (m_participants.at(m_room->username()).is_participant) {
+		VotekickMessage message;
+		message.victim = username;
+		message.kick = kick;
+		send_message(message.encode());
 	}
 }
 
@@ -494,12 +510,13 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		
 		m_unconfirmed_invites[message.username][message.long_term_public_key] = std::move(invite);
 		m_participants[sender].invitees[message.username] = message.long_term_public_key;
+		m_membership_version++;
 		
 		Event consistency_check_event;
 		consistency_check_event.type = Message::Type::ConsistencyCheck;
 		consistency_check_event.consistency_check.conversation_status_hash = m_conversation_status_hash;
 		for (const auto& i : m_participants) {
-			consistency_check_event.remaining_users.insert(i.second.username);
+			consistency_check_event.remaining_users.insert(i.second.handle);
 			set_user_conversation_status_timer(i.second.username);
 		}
 		declare_event(std::move(consistency_check_event));
@@ -518,7 +535,7 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		reply_event.conversation_status.invitee_username = message.username;
 		reply_event.conversation_status.invitee_long_term_public_key = message.long_term_public_key;
 		reply_event.conversation_status.status_message_hash = crypto::hash(reply.payload);
-		reply_event.remaining_users.insert(sender);
+		reply_event.remaining_users.insert(m_participants.at(sender).handle);
 		declare_event(std::move(reply_event));
 		
 		if (sender == m_room->username()) {
@@ -552,7 +569,7 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		event.conversation_status.invitee_long_term_public_key = message.invitee_long_term_public_key;
 		event.conversation_status.status_message_hash = status_message_hash;
 		for (const auto& i : m_participants) {
-			event.remaining_users.insert(i.second.username);
+			event.remaining_users.insert(i.second.handle);
 		}
 		declare_event(std::move(event));
 		
@@ -586,8 +603,7 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		if (m_unconfirmed_users.count(sender)) {
 			assert(m_unconfirmed_invites.count(m_room->username()));
 			assert(m_unconfirmed_invites.at(m_room->username()).count(m_room->public_key()));
-			std::string inviter = m_unconfirmed_invites.at(m_room->username()).at(m_room->public_key()).inviter;
-			assert(m_participants.count(inviter));
+			assert(m_participants.count(m_unconfirmed_invites.at(m_room->username()).at(m_room->public_key()).inviter));
 			
 			if (
 				   message.invitee_username == m_room->username()
@@ -596,12 +612,7 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 			) {
 				m_unconfirmed_users.erase(sender);
 				if (m_unconfirmed_users.empty()) {
-					InviteAcceptanceMessage accept_message;
-					accept_message.my_long_term_public_key = m_room->public_key();
-					accept_message.inviter_username = inviter;
-					accept_message.inviter_long_term_public_key = m_participants.at(inviter).long_term_public_key;
-					accept_message.inviter_conversation_public_key = m_participants.at(inviter).conversation_public_key;
-					send_message(accept_message.encode());
+					send_invite_acceptance();
 				}
 			}
 		}
@@ -634,6 +645,7 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		Participant participant;
 		participant.is_participant = false;
 		participant.username = sender;
+		participant.handle = m_room->intern_username(sender);
 		participant.long_term_public_key = message.my_long_term_public_key;
 		participant.conversation_public_key = conversation_message.conversation_public_key;
 		participant.inviter = message.inviter_username;
@@ -641,6 +653,7 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		participant.timeout_in_flight = false;
 		participant.votekick_in_flight = false;
 		m_participants[sender] = std::move(participant);
+		m_membership_version++;
 		if (sender == m_room->username()) {
 			set_conversation_status_timer();
 		}
@@ -773,6 +786,7 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		m_participants[m_participants[message.username].inviter].invitees.erase(message.username);
 		m_participants[message.username].inviter = sender;
 		m_participants[sender].invitees[message.username] = message.long_term_public_key;
+		m_membership_version++;
 		
 		m_own_invites.erase(message.username);
 		
@@ -825,6 +839,7 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		
 		m_participants[sender].is_participant = true;
 		m_participants[sender].inviter.clear();
+		m_membership_version++;
 		
 		m_encrypted_chat.add_user(sender, m_participants.at(sender).long_term_public_key);
 		
@@ -856,7 +871,7 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		Event event;
 		event.type = Message::Type::ConsistencyCheck;
 		event.consistency_check.conversation_status_hash = m_conversation_status_hash;
-		event.remaining_users.insert(sender);
+		event.remaining_users.insert(m_participants.at(sender).handle);
 		declare_event(std::move(event));
 		set_user_conversation_status_timer(sender);
 		
@@ -901,10 +916,13 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		
 		if (message.timeout) {
 			if (m_participants[sender].timeout_peers.insert(message.victim).second) {
+				m_membership_version++;
 				try_split(false);
 			}
 		} else {
-			m_participants[sender].timeout_peers.erase(message.victim);
+			if (m_participants[sender].timeout_peers.erase(message.victim) > 0) {
+				m_membership_version++;
+			}
 		}
 	} else if (conversation_message.type == Message::Type::Votekick) {
 		VotekickMessage message;
@@ -925,12 +943,14 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		
 		if (message.kick) {
 			if (m_participants[sender].votekick_peers.insert(message.victim).second) {
+				m_membership_version++;
 				if (interface()) interface()->votekick_registered(sender, message.victim, message.kick);
 				
 				try_split(true);
 			}
 		} else {
 			if (m_participants[sender].votekick_peers.erase(message.victim) > 0) {
+				m_membership_version++;
 				if (interface()) interface()->votekick_registered(sender, message.victim, message.kick);
 			}
 		}
@@ -1058,7 +1078,10 @@ void Conversation::message_received(const std::string& sender, const Conversatio
 		if (m_participants.at(sender).is_participant) {
 			m_encrypted_chat.replace_session(message.key_id);
 		}
-	} else if (conversation_message.type == Message::Type::Chat) {
+	} else if (
+		   conversation_message.type == Message::Type::Chat
+		|| conversation_message.type == Message::Type::ChatChunk
+	) {
 		ChatMessage message;
 		try {
 			message = ChatMessage::decode(conversation_message);
@@ -1093,6 +1116,7 @@ void Conversation::user_left(const std::string& username)
 			remove_invite(i->second.inviter, i->second.username);
 		}
 		m_unconfirmed_invites.erase(username);
+		m_membership_version++;
 	}
 	
 	assert(fsck());
@@ -1151,7 +1175,7 @@ void Conversation::add_key_exchange_event(Message::Type type, const Hash& key_id
 {
 	Event event;
 	event.type = type;
-	event.remaining_users = usernames;
+	event.remaining_users = intern_usernames(usernames);
 	event.key_event.key_id = key_id;
 	declare_event(std::move(event));
 }
@@ -1207,15 +1231,17 @@ void Conversation::hash_payload(const std::string& sender, uint8_t type, const s
 void Conversation::declare_event(Event&& event)
 {
 	std::list<Event>::iterator it = m_events.insert(m_events.end(), std::move(event));
+	m_events_version++;
 	for (const std::string& username : it->remaining_users) {
 		assert(m_participants.count(username));
 		m_participants[username].events.push_back(it);
 	}
 	it->timeout = false;
 	
-	it->timeout_timer = Timer(m_room->interface(), c_event_timeout, [this, it] {
+	it->timeout_timer = Deadline(&m_deadlines, c_event_timeout, [this, it] {
 		it->timeout = true;
-		for (const std::string& username : it->remaining_users) {
+		// in name order, so that the timeout messages we send do not depend on handle addresses
+		for (const std::string& username : usernames(it->remaining_users)) {
 			check_timeout(username);
 		}
 	});
@@ -1275,6 +1301,7 @@ void Conversation::remove_invite(std::string inviter, std::string username)
 		if (m_unconfirmed_invites.at(username).empty()) {
 			m_unconfirmed_invites.erase(username);
 		}
+		m_membership_version++;
 	}
 	
 	if (inviter != m_room->username() && m_own_invites.count(username)) {
@@ -1298,12 +1325,13 @@ void Conversation::do_remove_user(const std::string& username)
 		m_interface = nullptr;
 	}
 	
+	Username name = m_participants.at(username).handle;
 	while (!m_participants[username].events.empty()) {
 		auto it = m_participants[username].events.front();
 		m_participants[username].events.pop_front();
 		
-		assert(it->remaining_users.count(username));
-		it->remaining_users.erase(username);
+		assert(it->remaining_users.count(name));
+		it->remaining_users.erase(name);
 		if (it->remaining_users.empty()) {
 			m_events.erase(it);
 		}
@@ -1324,9 +1352,24 @@ void Conversation::do_remove_user(const std::string& username)
 	bool participant = m_participants.at(username).is_participant;
 	
 	m_participants.erase(username);
+	m_membership_version++;
+	m_events_version++;
 	
 	m_room->conversation_remove_user(this, username, conversation_public_key);
 	
+	/*
+	 * A user that leaves before confirming our invitation no longer needs to.
+	 */
+	if (m_unconfirmed_users.erase(username) && m_unconfirmed_users.empty()) {
+		if (
+			   m_unconfirmed_invites.count(m_room->username())
+			&& m_unconfirmed_invites.at(m_room->username()).count(m_room->public_key())
+			&& m_participants.count(m_unconfirmed_invites.at(m_room->username()).at(m_room->public_key()).inviter)
+		) {
+			send_invite_acceptance();
+		}
+	}
+	
 	if (participant) {
 		if (interface()) interface()->user_left(username);
 	}
@@ -1334,30 +1377,49 @@ void Conversation::do_remove_user(const std::string& username)
 	assert(fsck());
 }
 
+void Conversation::send_invite_acceptance()
+{
+	assert(m_unconfirmed_invites.count(m_room->username()));
+	assert(m_unconfirmed_invites.at(m_room->username()).count(m_room->public_key()));
+	std::string inviter = m_unconfirmed_invites.at(m_room->username()).at(m_room->public_key()).inviter;
+	assert(m_participants.count(inviter));
+	
+	InviteAcceptanceMessage accept_message;
+	accept_message.my_long_term_public_key = m_room->public_key();
+	accept_message.inviter_username = inviter;
+	accept_message.inviter_long_term_public_key = m_participants.at(inviter).long_term_public_key;
+	accept_message.inviter_conversation_public_key = m_participants.at(inviter).conversation_public_key;
+	send_message(accept_message.encode());
+}
+
 void Conversation::check_timeout(const std::string& username)
 {
 	assert(m_participants.count(username));
 	
-	Participant& participant = m_participants[username];
-	
-	bool event_timeout = (!participant.events.empty() && participant.events.front()->timeout);
-	bool conversation_status_timeout = !participant.conversation_status_timer.active();
-	
-	bool want_timeout = event_timeout || conversation_status_timeout;
-	if (participant.timeout_in_flight != want_timeout) {
-		participant.timeout_in_flight = want_timeout;
-		if (am_participant()) {
-			TimeoutMessage message;
-			message.victim = username;
-			message.timeout = want_timeout;
-			send_message(message.encode());
+	bool want_timeout;
+	{
+		Participant& participant = m_participants.at(username);
+		
+		bool event_timeout = (!participant.events.empty() && participant.events.front()->timeout);
+		bool conversation_status_timeout = !participant.conversation_status_timer.active();
+		
+		want_timeout = event_timeout || conversation_status_timeout;
+		if (participant.timeout_in_flight == want_timeout) {
+			return;
 		}
+		participant.timeout_in_flight = want_timeout;
+	}
+	if (am_participant()) {
+		TimeoutMessage message;
+		message.victim = username;
+		message.timeout = want_timeout;
+		send_message(message.encode());
 	}
 }
 
 void Conversation::set_conversation_status_timer()
 {
-	m_conversation_status_timer = Timer(m_room->interface(), c_conversation_status_frequency, [this] {
+	m_conversation_status_timer = Deadline(&m_deadlines, c_conversation_status_frequency, [this] {
 		ConsistencyStatusMessage message;
 		send_message(message.encode());
 		set_conversation_status_timer();
@@ -1367,7 +1429,7 @@ void Conversation::set_conversation_status_timer()
 void Conversation::set_user_conversation_status_timer(const std::string& username)
 {
 	assert(m_participants.count(username));
-	m_participants[username].conversation_status_timer = Timer(m_room->interface(), c_conversation_status_frequency + c_event_timeout, [username, this] {
+	m_participants[username].conversation_status_timer = Deadline(&m_deadlines, c_conversation_status_frequency + c_event_timeout, [username, this] {
 		check_timeout(username);
 	});
 	check_timeout(username);
@@ -1467,6 +1529,25 @@ void Conversation::try_split(bool because_votekick)
 
 
 UnsignedConversationMessage Conversation::conversation_status(const std::string& invitee_username, const PublicKey& invitee_long_term_public_key) const
+{
+	update_status_encoding();
+	
+	return ConversationStatusMessage::encode_sections(
+		invitee_username,
+		invitee_long_term_public_key,
+		m_status_encoding.membership,
+		m_conversation_status_hash,
+		m_encrypted_chat.latest_session_id(),
+		m_status_encoding.key_exchanges,
+		m_status_encoding.events
+	);
+}
+
+/*
+ * Encodes the conversation status from scratch, without using the cached sections.
+ * The output is identical to that of conversation_status().
+ */
+UnsignedConversationMessage Conversation::encode_conversation_status(const std::string& invitee_username, const PublicKey& invitee_long_term_public_key) const
 {
 	ConversationStatusMessage result;
 	result.invitee_username = invitee_username;
@@ -1475,6 +1556,15 @@ UnsignedConversationMessage Conversation::conversation_status(const std::string&
 	result.conversation_status_hash = m_conversation_status_hash;
 	result.latest_session_id = m_encrypted_chat.latest_session_id();
 	
+	encode_status_membership(&result);
+	result.key_exchanges = m_encrypted_chat.encode_key_exchanges();
+	encode_status_events(&result);
+	
+	return result.encode();
+}
+
+void Conversation::encode_status_membership(ConversationStatusMessage* status) const
+{
 	for (const auto& i : m_participants) {
 		if (i.second.is_participant) {
 			ConversationStatusMessage::Participant participant;
@@ -1483,7 +1573,7 @@ UnsignedConversationMessage Conversation::conversation_status(const std::string&
 			participant.conversation_public_key = i.second.conversation_public_key;
 			participant.timeout_peers = i.second.timeout_peers;
 			participant.votekick_peers = i.second.votekick_peers;
-			result.participants.push_back(participant);
+			status->participants.push_back(participant);
 		} else {
 			ConversationStatusMessage::ConfirmedInvite invite;
 			invite.inviter = i.second.inviter;
@@ -1491,7 +1581,7 @@ UnsignedConversationMessage Conversation::conversation_status(const std::string&
 			invite.long_term_public_key = i.second.long_term_public_key;
 			invite.conversation_public_key = i.second.conversation_public_key;
 			invite.authenticated = i.second.authenticated;
-			result.confirmed_invites.push_back(invite);
+			status->confirmed_invites.push_back(invite);
 		}
 	}
 	
@@ -1501,32 +1591,33 @@ UnsignedConversationMessage Conversation::conversation_status(const std::string&
 			invite.inviter = j.second.inviter;
 			invite.username = j.second.username;
 			invite.long_term_public_key = j.second.long_term_public_key;
-			result.unconfirmed_invites.push_back(invite);
+			status->unconfirmed_invites.push_back(invite);
 		}
 	}
-	
-	result.key_exchanges = m_encrypted_chat.encode_key_exchanges();
-	
+}
+
+void Conversation::encode_status_events(ConversationStatusMessage* status) const
+{
 	for (const Event& event : m_events) {
 		if (event.type == Message::Type::ConversationStatus) {
 			ConversationStatusEvent conversation_status_event;
 			conversation_status_event.invitee_username = event.conversation_status.invitee_username;
 			conversation_status_event.invitee_long_term_public_key = event.conversation_status.invitee_long_term_public_key;
 			conversation_status_event.status_message_hash = event.conversation_status.status_message_hash;
-			conversation_status_event.remaining_users = event.remaining_users;
-			result.events.push_back(conversation_status_event.encode(result));
+			conversation_status_event.remaining_users = usernames(event.remaining_users);
+			status->events.push_back(conversation_status_event.encode(*status));
 		} else if (event.type == Message::Type::ConversationConfirmation) {
 			ConversationConfirmationEvent conversation_confirmation_event;
 			conversation_confirmation_event.invitee_username = event.conversation_status.invitee_username;
 			conversation_confirmation_event.invitee_long_term_public_key = event.conversation_status.invitee_long_term_public_key;
 			conversation_confirmation_event.status_message_hash = event.conversation_status.status_message_hash;
-			conversation_confirmation_event.remaining_users = event.remaining_users;
-			result.events.push_back(conversation_confirmation_event.encode(result));
+			conversation_confirmation_event.remaining_users = usernames(event.remaining_users);
+			status->events.push_back(conversation_confirmation_event.encode(*status));
 		} else if (event.type == Message::Type::ConsistencyCheck) {
 			ConsistencyCheckEvent consistency_check_event;
 			consistency_check_event.conversation_status_hash = event.consistency_check.conversation_status_hash;
-			consistency_check_event.remaining_users = event.remaining_users;
-			result.events.push_back(consistency_check_event.encode(result));
+			consistency_check_event.remaining_users = usernames(event.remaining_users);
+			status->events.push_back(consistency_check_event.encode(*status));
 		} else if (
 			   event.type == Message::Type::KeyExchangePublicKey
 			|| event.type == Message::Type::KeyExchangeSecretShare
@@ -1537,19 +1628,51 @@ UnsignedConversationMessage Conversation::conversation_status(const std::string&
 			key_exchange_event.type = event.type;
 			key_exchange_event.key_id = event.key_event.key_id;
 			key_exchange_event.cancelled = !m_encrypted_chat.have_key_exchange(event.key_event.key_id);
-			key_exchange_event.remaining_users = event.remaining_users;
-			result.events.push_back(key_exchange_event.encode(result));
+			key_exchange_event.remaining_users = usernames(event.remaining_users);
+			status->events.push_back(key_exchange_event.encode(*status));
 		} else if (event.type == Message::Type::KeyActivation) {
 			KeyActivationEvent key_activation_event;
 			key_activation_event.key_id = event.key_event.key_id;
-			key_activation_event.remaining_users = event.remaining_users;
-			result.events.push_back(key_activation_event.encode(result));
+			key_activation_event.remaining_users = usernames(event.remaining_users);
+			status->events.push_back(key_activation_event.encode(*status));
 		} else {
 			assert(false);
 		}
 	}
+}
+
+/*
+ * Brings the cached sections of the conversation status up to date with the
+ * current state, re-encoding only those sections that changed since the
+ * last call. Events are encoded relative to the membership and refer to key
+ * exchanges, so they get re-encoded when any of those change.
+ */
+void Conversation::update_status_encoding() const
+{
+	StatusEncoding& cache = m_status_encoding;
 	
-	return result.encode();
+	bool membership_changed = cache.membership_version != m_membership_version;
+	if (membership_changed) {
+		cache.status = ConversationStatusMessage();
+		encode_status_membership(&cache.status);
+		cache.membership = cache.status.encode_membership();
+		cache.membership_version = m_membership_version;
+	}
+	
+	bool key_exchanges_changed = cache.key_exchanges_version != m_encrypted_chat.key_exchanges_version();
+	if (key_exchanges_changed) {
+		cache.status.key_exchanges = m_encrypted_chat.encode_key_exchanges();
+		cache.key_exchanges = cache.status.encode_key_exchanges();
+		cache.status.key_exchanges.clear();
+		cache.key_exchanges_version = m_encrypted_chat.key_exchanges_version();
+	}
+	
+	if (membership_changed || key_exchanges_changed || cache.events_version != m_events_version) {
+		encode_status_events(&cache.status);
+		cache.events = cache.status.encode_events();
+		cache.status.events.clear();
+		cache.events_version = m_events_version;
+	}
 }
 
 Conversation::EventReference Conversation::first_user_event(const std::string& username)
@@ -1557,19 +1680,41 @@ Conversation::EventReference Conversation::first_user_event(const std::string& u
 	if (!m_participants.count(username)) {
 		return EventReference();
 	}
-	Participant& participant = m_participants[username];
-	if (participant.events.empty()) {
-		return EventReference();
+	std::list<Event>::iterator it;
+	{
+		Participant& participant = m_participants.at(username);
+		if (participant.events.empty()) {
+			return EventReference();
+		}
+		it = participant.events.front();
+		participant.events.pop_front();
+		
+		assert(it->remaining_users.count(participant.handle));
+		it->remaining_users.erase(participant.handle);
 	}
-	auto it = participant.events.front();
-	participant.events.pop_front();
-	
-	assert(it->remaining_users.count(username));
-	it->remaining_users.erase(username);
+	m_events_version++;
 	
 	check_timeout(username);
 	
-	return EventReference(&m_events, it);
+	return EventReference(&m_events, it, &m_events_version);
+}
+
+std::set<Username> Conversation::intern_usernames(const std::set<std::string>& usernames) const
+{
+	std::set<Username> result;
+	for (const std::string& username : usernames) {
+		result.insert(m_room->intern_username(username));
+	}
+	return result;
+}
+
+std::set<std::string> Conversation::usernames(const std::set<Username>& usernames)
+{
+	std::set<std::string> result;
+	for (const Username& username : usernames) {
+		result.insert(username.str());
+	}
+	return result;
 }
 
 bool Conversation::fsck()
@@ -1644,13 +1789,15 @@ bool Conversation::fsck()
 	
 	for (auto& i : m_participants) {
 		std::deque<std::list<Event>::iterator>::iterator user_it = i.second.events.begin();
+		const Username& name = i.second.handle;
+		assert(name.str() == i.first);
 		
 		for (std::list<Event>::iterator event_it = m_events.begin(); event_it != m_events.end(); event_it++) {
-			if (event_it->remaining_users.count(i.first)) {
+			if (event_it->remaining_users.count(name)) {
 				assert(*user_it == event_it);
 				user_it++;
 			} else {
-				assert(*user_it != event_it);
+				assert(user_it == i.second.events.end() || *user_it != event_it);
 			}
 		}
 		assert(user_it == i.second.events.end());
@@ -22,7 +22,9 @@
 #include "crypto.h"
 #include "encryptedchat.h"
 #include "message.h"
+#include "participanttable.h"
 #include "timer.h"
+#include "username.h"
 
 #include <deque>
 #include <list>
@@ -169,7 +171,11 @@ class Conversation
 	 * Send an encrypted message to this conversation.
 	 *
 	 * \param message is a clear text string that shall be encrypted
-	 *        before it is sent.
+	 *        before it is sent. Large messages are encrypted and sent
+	 *        in chunks, and reassembled by the receivers, up to a limit
+	 *        of 16 MiB. Rooms that do not enable chunking still chunk
+	 *        messages too large to sign whole, above 64000 bytes; peers
+	 *        that cannot reassemble chunks drop those.
 	 */
 	void send_chat(const std::string& message);
 	
@@ -186,6 +192,7 @@ class Conversation
 	/* Accessors */
 	Room* room() const { return m_room; }
 	ConversationInterface* interface() const { return m_interface; }
+	DeadlineQueue* deadlines() { return &m_deadlines; }
 	void set_interface(ConversationInterface* interface) { m_interface = interface;	}
 	const Hash& conversation_status_hash() const { return m_conversation_status_hash; }
 	std::map<std::string, PublicKey> conversation_users() const;
@@ -212,7 +219,7 @@ class Conversation
 		 * This struct is really a union, but I am too lazy to implement a C++11 union.
 		 */
 		Message::Type type;
-		std::set<std::string> remaining_users;
+		std::set<Username> remaining_users;
 		
 		// used for conversation status and confirmation
 		ConversationStatusEventPayload conversation_status;
@@ -220,7 +227,7 @@ class Conversation
 		// used for key exchanges and key activations
 		KeyActivationEventPayload key_event;
 		
-		Timer timeout_timer;
+		Deadline timeout_timer;
 		bool timeout;
 	};
 	
@@ -231,9 +238,10 @@ class Conversation
 			m_list(nullptr)
 		{}
 		
-		explicit EventReference(std::list<Event>* list, std::list<Event>::iterator iterator):
+		explicit EventReference(std::list<Event>* list, std::list<Event>::iterator iterator, uint64_t* events_version):
 			m_list(list),
-			m_iterator(iterator)
+			m_iterator(iterator),
+			m_events_version(events_version)
 		{}
 		
 		EventReference(EventReference&& other):
@@ -247,6 +255,7 @@ class Conversation
 			if (m_list) {
 				if (m_iterator->remaining_users.empty()) {
 					m_list->erase(m_iterator);
+					(*m_events_version)++;
 				}
 			}
 		}
@@ -256,6 +265,7 @@ class Conversation
 			m_list = other.m_list;
 			if (m_list) {
 				m_iterator = other.m_iterator;
+				m_events_version = other.m_events_version;
 			}
 			other.m_list = nullptr;
 			return *this;
@@ -274,6 +284,7 @@ class Conversation
 		protected:
 		std::list<Event>* m_list;
 		std::list<Event>::iterator m_iterator;
+		uint64_t* m_events_version;
 	};
 	
 	enum class AuthenticationStatus { Unauthenticated, Authenticating, Authenticated, AuthenticationFailed };
@@ -285,6 +296,8 @@ class Conversation
 		bool is_participant;
 		
 		std::string username;
+		// username, interned once for event bookkeeping
+		Username handle;
 		PublicKey long_term_public_key;
 		PublicKey conversation_public_key;
 		
@@ -307,7 +320,7 @@ class Conversation
 		
 		std::deque<std::list<Event>::iterator> events;
 		
-		Timer conversation_status_timer;
+		Deadline conversation_status_timer;
 		
 		// only for participants
 		std::map<std::string, PublicKey> invitees;
@@ -324,6 +337,32 @@ class Conversation
 		PublicKey long_term_public_key;
 	};
 	
+	/*
+	 * Encoded sections of the conversation status, as produced by
+	 * ConversationStatusMessage::encode_membership() and friends.
+	 * Each section is valid for as long as the version counters it was
+	 * computed from have not changed.
+	 */
+	struct StatusEncoding
+	{
+		StatusEncoding():
+			membership_version(0),
+			key_exchanges_version(0),
+			events_version(0)
+		{}
+		
+		uint64_t membership_version;
+		uint64_t key_exchanges_version;
+		uint64_t events_version;
+		
+		// membership part of the status, used to encode events
+		ConversationStatusMessage status;
+		
+		std::string membership;
+		std::string key_exchanges;
+		std::string events;
+	};
+	
 	
 	
 	protected:
@@ -334,6 +373,7 @@ class Conversation
 	void do_invite(const std::string& username);
 	void remove_invite(std::string inviter, std::string username);
 	void do_remove_user(const std::string& username);
+	void send_invite_acceptance();
 	void check_timeout(const std::string& username);
 	void set_conversation_status_timer();
 	void set_user_conversation_status_timer(const std::string& username);
@@ -341,7 +381,13 @@ class Conversation
 	
 	/* Other */
 	UnsignedConversationMessage conversation_status(const std::string& invitee_username, const PublicKey& invitee_long_term_public_key) const;
+	UnsignedConversationMessage encode_conversation_status(const std::string& invitee_username, const PublicKey& invitee_long_term_public_key) const;
+	void encode_status_membership(ConversationStatusMessage* status) const;
+	void encode_status_events(ConversationStatusMessage* status) const;
+	void update_status_encoding() const;
 	EventReference first_user_event(const std::string& username);
+	std::set<Username> intern_usernames(const std::set<std::string>& usernames) const;
+	static std::set<std::string> usernames(const std::set<Username>& usernames);
 	
 	bool fsck();
 	
@@ -352,16 +398,26 @@ class Conversation
 	Room* m_room;
 	PrivateKey m_conversation_private_key;
 	ConversationInterface* m_interface;
+	/* Shared by all timeouts of this conversation; declared first, as it must outlive them. */
+	DeadlineQueue m_deadlines;
 	
-	std::map<std::string, Participant> m_participants;
+	ParticipantTable<Participant> m_participants;
 	std::map<std::string, std::map<PublicKey, UnconfirmedInvite>> m_unconfirmed_invites;
 	Hash m_conversation_status_hash;
 	
 	std::list<Event> m_events;
 	
+	/*
+	 * Incremented whenever the participants and invites, or the events,
+	 * change in a way that is visible in the conversation status.
+	 */
+	uint64_t m_membership_version;
+	uint64_t m_events_version;
+	mutable StatusEncoding m_status_encoding;
+	
 	EncryptedChat m_encrypted_chat;
 	
-	Timer m_conversation_status_timer;
+	Deadline m_conversation_status_timer;
 	
 	std::map<std::string, PublicKey> m_own_invites;
 	
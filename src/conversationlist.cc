@@ -19,11 +19,14 @@
 #include "conversationlist.h"
 #include "room.h"
 
+#include <algorithm>
+
 namespace np1sec
 {
 
 ConversationList::ConversationList(Room* room):
-	m_room(room)
+	m_room(room),
+	m_next_event_id(0)
 {}
 
 void ConversationList::disconnect()
@@ -34,6 +37,8 @@ void ConversationList::disconnect()
 	m_conversations.clear();
 	m_invitation_start_points.clear();
 	m_event_queue.clear();
+	m_event_index.clear();
+	m_leave_events.clear();
 }
 
 void ConversationList::create_conversation()
@@ -60,7 +65,7 @@ void ConversationList::message_received(const std::string& sender, const Convers
 	RoomEvent event;
 	event.sender = sender;
 	event.type = RoomEvent::Type::Message;
-	event.message = conversation_message;
+	event.message = std::make_shared<ConversationMessage>(conversation_message);
 	
 	for (Conversation* conversation : interested_conversations(sender, conversation_message)) {
 		handle_event(conversation, event);
@@ -77,12 +82,15 @@ void ConversationList::message_received(const std::string& sender, const Convers
 				clear_invite(sender, conversation_message.conversation_public_key);
 				
 				event.waiting = true;
-				std::list<RoomEvent>::iterator it = m_event_queue.insert(m_event_queue.end(), std::move(event));
-				m_invitation_start_points[it->sender][it->message.conversation_public_key] = it;
+				uint64_t id = queue_event(std::move(event));
+				m_invitation_start_points[sender][conversation_message.conversation_public_key] = id;
 				
 				///// TODO 60000
-				it->timeout = Timer(m_room->interface(), 60000, [it, this] {
-					clear_invite(it->sender, it->message.conversation_public_key);
+				PublicKey conversation_public_key = conversation_message.conversation_public_key;
+				m_room->mutable_statistics().timers.host_timers_armed++;
+				m_event_queue.at(id).timeout = Timer(m_room->interface(), 60000, [sender, conversation_public_key, this] {
+					m_room->mutable_statistics().timers.host_timers_fired++;
+					clear_invite(sender, conversation_public_key);
 				});
 				
 				recorded = true;
@@ -92,7 +100,7 @@ void ConversationList::message_received(const std::string& sender, const Convers
 	
 	if (!m_event_queue.empty() && !recorded) {
 		event.waiting = false;
-		m_event_queue.push_back(std::move(event));
+		queue_event(std::move(event));
 	}
 	
 	if (conversation_message.type == Message::Type::ConversationStatus) {
@@ -116,17 +124,7 @@ void ConversationList::message_received(const std::string& sender, const Convers
 					}
 					m_conversations[c] = std::move(conversation);
 					
-					std::list<RoomEvent>::iterator it = m_invitation_start_points.at(sender).at(conversation_message.conversation_public_key);
-					it++;
-					
-					while (m_conversations.count(c) && it != m_event_queue.end()) {
-						if (it->type == RoomEvent::Type::Message && !interested_conversations(it->sender, it->message).count(c)) {
-							it++;
-							continue;
-						}
-						handle_event(c, *it);
-						it++;
-					}
+					replay_events(c, m_invitation_start_points.at(sender).at(conversation_message.conversation_public_key));
 				}
 
 				if (message.invitee_username == m_room->username()) {
@@ -156,7 +154,7 @@ void ConversationList::user_left(const std::string& username)
 	}
 	
 	if (!m_event_queue.empty()) {
-		m_event_queue.push_back(std::move(event));
+		queue_event(std::move(event));
 	}
 }
 
@@ -201,7 +199,7 @@ void ConversationList::handle_event(Conversation* conversation, const RoomEvent&
 	assert(conversation->am_involved());
 	
 	if (event.type == RoomEvent::Type::Message) {
-		conversation->message_received(event.sender, event.message);
+		conversation->message_received(event.sender, *event.message);
 	} else if (event.type == RoomEvent::Type::Leave) {
 		conversation->user_left(event.sender);
 	} else {
@@ -228,10 +226,92 @@ void ConversationList::handle_event(Conversation* conversation, const RoomEvent&
 	}
 }
 
+uint64_t ConversationList::queue_event(RoomEvent&& event)
+{
+	uint64_t id = m_next_event_id++;
+	
+	if (event.type == RoomEvent::Type::Message) {
+		event.index_keys.push_back(event.message->conversation_public_key);
+		if (event.message->type == Message::Type::InviteAcceptance) {
+			try {
+				InviteAcceptanceMessage message = InviteAcceptanceMessage::decode(*event.message);
+				if (message.inviter_conversation_public_key != event.message->conversation_public_key) {
+					event.index_keys.push_back(message.inviter_conversation_public_key);
+				}
+			} catch(MessageFormatException) {}
+		}
+		for (const PublicKey& key : event.index_keys) {
+			m_event_index[key].push_back(id);
+		}
+	} else {
+		m_leave_events.push_back(id);
+	}
+	
+	m_event_queue.emplace(id, std::move(event));
+	return id;
+}
+
+/*
+ * Feeds a newly created conversation the queued events that came after
+ * its invitation, in order. An event is relevant if it concerns one of the
+ * conversation's participants at the time it is replayed, so the next
+ * event is the earliest one, after the last event replayed, in the index
+ * of any current participant or among the leave events.
+ */
+void ConversationList::replay_events(Conversation* conversation, uint64_t start_id)
+{
+	uint64_t last_id = start_id;
+	while (m_conversations.count(conversation)) {
+		bool found = false;
+		uint64_t next_id = 0;
+		auto consider = [&] (const std::deque<uint64_t>& ids) {
+			auto it = std::upper_bound(ids.begin(), ids.end(), last_id);
+			if (it != ids.end() && (!found || *it < next_id)) {
+				found = true;
+				next_id = *it;
+			}
+		};
+		
+		consider(m_leave_events);
+		for (const auto& i : conversation->conversation_users()) {
+			auto index = m_event_index.find(i.second);
+			if (index != m_event_index.end()) {
+				consider(index->second);
+			}
+		}
+		if (!found) {
+			break;
+		}
+		last_id = next_id;
+		
+		const RoomEvent& event = m_event_queue.at(next_id);
+		if (event.type == RoomEvent::Type::Message && !interested_conversations(event.sender, *event.message).count(conversation)) {
+			continue;
+		}
+		handle_event(conversation, event);
+	}
+}
+
 void ConversationList::clean_event_queue()
 {
-	while (!m_event_queue.empty() && !m_event_queue.front().waiting) {
-		m_event_queue.pop_front();
+	while (!m_event_queue.empty() && !m_event_queue.begin()->second.waiting) {
+		uint64_t id = m_event_queue.begin()->first;
+		const RoomEvent& event = m_event_queue.begin()->second;
+		if (event.type == RoomEvent::Type::Message) {
+			for (const PublicKey& key : event.index_keys) {
+				auto index = m_event_index.find(key);
+				assert(index != m_event_index.end());
+				assert(index->second.front() == id);
+				index->second.pop_front();
+				if (index->second.empty()) {
+					m_event_index.erase(index);
+				}
+			}
+		} else {
+			assert(m_leave_events.front() == id);
+			m_leave_events.pop_front();
+		}
+		m_event_queue.erase(m_event_queue.begin());
 	}
 }
 
@@ -243,13 +323,13 @@ void ConversationList::clear_invite(const std::string& username, const PublicKey
 	if (!m_invitation_start_points.at(username).count(conversation_public_key)) {
 		return;
 	}
-	std::list<RoomEvent>::iterator it = m_invitation_start_points.at(username).at(conversation_public_key);
+	RoomEvent& event = m_event_queue.at(m_invitation_start_points.at(username).at(conversation_public_key));
 	m_invitation_start_points[username].erase(conversation_public_key);
 	if (m_invitation_start_points.at(username).empty()) {
 		m_invitation_start_points.erase(username);
 	}
-	it->timeout.stop();
-	it->waiting = false;
+	event.timeout.stop();
+	event.waiting = false;
 	clean_event_queue();
 }
 
@@ -23,10 +23,11 @@
 #include "message.h"
 #include "timer.h"
 
-#include <list>
+#include <deque>
 #include <map>
 #include <memory>
 #include <set>
+#include <vector>
 
 namespace np1sec
 {
@@ -65,13 +66,17 @@ class ConversationList
 		enum class Type { Message, Leave };
 		std::string sender;
 		Type type;
-		ConversationMessage message;
+		std::shared_ptr<const ConversationMessage> message;
+		/* The conversation public keys under which m_event_index lists this event */
+		std::vector<PublicKey> index_keys;
 		
 		bool waiting;
 		Timer timeout;
 	};
 	
 	void handle_event(Conversation* conversation, const RoomEvent& event);
+	uint64_t queue_event(RoomEvent&& event);
+	void replay_events(Conversation* conversation, uint64_t start_id);
 	void clean_event_queue();
 	void clear_invite(const std::string& username, const PublicKey& conversation_public_key);
 	std::set<Conversation*> interested_conversations(const std::string& sender, const ConversationMessage& conversation_message);
@@ -83,8 +88,18 @@ class ConversationList
 	std::map<Conversation*, std::unique_ptr<Conversation>> m_conversations;
 	std::map<std::string, std::map<PublicKey, std::set<Conversation*>>> m_user_conversations;
 	
-	std::list<RoomEvent> m_event_queue;
-	std::map<std::string, std::map<PublicKey, std::list<RoomEvent>::iterator>> m_invitation_start_points;
+	/*
+	 * While invitations are pending, every event is queued so that a
+	 * conversation created from an invitation can replay what it missed.
+	 * Events are numbered in arrival order. Message events are indexed by
+	 * the conversation public keys they concern, so that a replay only
+	 * visits events of the conversation's participants.
+	 */
+	uint64_t m_next_event_id;
+	std::map<uint64_t, RoomEvent> m_event_queue;
+	std::map<PublicKey, std::deque<uint64_t>> m_event_index;
+	std::deque<uint64_t> m_leave_events;
+	std::map<std::string, std::map<PublicKey, uint64_t>> m_invitation_start_points;
 	
 	std::set<Conversation*> m_authenticated_invites;
 	std::set<Conversation*> m_participant_conversations;
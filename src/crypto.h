@@ -19,12 +19,15 @@
 #ifndef SRC_CRYPTO_H_
 #define SRC_CRYPTO_H_
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "bytearray.h"
 
-struct gcry_sexp;
-typedef gcry_sexp* gcry_sexp_t;
+struct gcry_cipher_handle;
+typedef gcry_cipher_handle* gcry_cipher_hd_t;
 
 namespace np1sec
 {
@@ -44,40 +47,52 @@ namespace np1sec
 		~SymmetricKey();
 	};
 	
+	//! Symmetric cipher context, keyed once and reused for every message
+	class SymmetricCipher
+	{
+		public:
+		explicit SymmetricCipher(const SymmetricKey& key);
+		~SymmetricCipher();
+		
+		SymmetricCipher(const SymmetricCipher& other) = delete;
+		SymmetricCipher& operator=(const SymmetricCipher& other) = delete;
+		
+		std::string encrypt(const std::string& plaintext);
+		std::string decrypt(const std::string& ciphertext);
+		
+		protected:
+		gcry_cipher_hd_t m_cipher;
+	};
+	
 	typedef ByteArray<c_public_key_length> PublicKey;
 	
 	typedef ByteArray<c_private_key_length> SerializedPrivateKey;
 	
+	struct PrivateKeyData;
+	struct PrivateScalarData;
+	
 	//! Structure representing cryptographic key pair
 	class PrivateKey
 	{
 		protected:
-		gcry_sexp_t m_private_key;
+		// Shared between copies; the key material is never modified.
+		std::shared_ptr<const PrivateKeyData> m_private_key;
 		PublicKey m_public_key;
 		
-		explicit PrivateKey(gcry_sexp_t sexp);
+		explicit PrivateKey(std::shared_ptr<const PrivateKeyData> data);
 		
 		public:
 		/** Constructor */
-		PrivateKey();
-
-		/** Copy constructor */
-		PrivateKey(const PrivateKey& other);
-
-		/** Assignment operator */
-		PrivateKey& operator=(const PrivateKey& other);
-
-		/** Destructor */
-		~PrivateKey();
+		PrivateKey() {}
 		
 		bool is_null() const
 		{
-			return m_private_key == nullptr;
+			return !m_private_key;
 		}
 		
-		gcry_sexp_t sexp() const
+		const PrivateKeyData& data() const
 		{
-			return m_private_key;
+			return *m_private_key;
 		}
 		
 		/** Return the public key */
@@ -93,10 +108,34 @@ namespace np1sec
 		static PrivateKey unserialize(const SerializedPrivateKey& serialized_key);
 	};
 	
+	//! The Diffie-Hellman scalar of a PrivateKey, derived once for repeated use
+	class PrivateScalar
+	{
+		public:
+		PrivateScalar() {}
+		explicit PrivateScalar(const PrivateKey& key);
+		
+		bool is_null() const
+		{
+			return !m_scalar;
+		}
+		
+		const PrivateScalarData& data() const
+		{
+			return *m_scalar;
+		}
+		
+		protected:
+		std::shared_ptr<const PrivateScalarData> m_scalar;
+	};
+	
 	typedef ByteArray<c_signature_length> Signature;
 	
 	namespace crypto
 	{
+		/* The name of the public key crypto backend this build uses. */
+		const char* backend_name();
+		
 		Hash hash(const std::string& buffer, bool secure = false);
 		
 		void create_nonce(unsigned char* buffer, size_t size);
@@ -115,16 +154,61 @@ namespace np1sec
 		
 		std::string decrypt(const std::string& ciphertext, const SymmetricKey& key);
 		
+		/*
+		 * The largest payload sign() signs, and verify() and verify_batch()
+		 * accept a signature over, with every backend. gcrypt s-expressions
+		 * hold data lengths in 16 bits and abort on payloads near 64 KiB.
+		 */
+		const size_t c_max_signed_payload_size = 65024;
+		
+		/* Throws CryptoException for payloads above c_max_signed_payload_size. */
 		Signature sign(const std::string& payload, const PrivateKey& key);
 		
+		/*
+		 * Checks the cofactored ed25519 equation, refusing small-order
+		 * and non-canonical points, so that a signature verifies alone
+		 * exactly when it verifies in verify_batch().
+		 */
 		bool verify(const std::string& payload, const Signature& signature, const PublicKey& key);
 		
+		struct SignedPayload
+		{
+			std::string payload;
+			Signature signature;
+			PublicKey key;
+		};
+		/*
+		 * Verifies a batch of signatures, returning for each one whether it is valid.
+		 *
+		 * Signatures are checked in groups with a randomized batch equation,
+		 * and one by one with verify() when that fails.
+		 */
+		std::vector<bool> verify_batch(const std::vector<SignedPayload>& signatures);
+		
+		/*
+		 * Public keys used for signature verification and Diffie-Hellman are
+		 * parsed once and kept in a bounded cache shared by all rooms.
+		 */
+		struct PublicKeyCacheStatistics
+		{
+			uint64_t hits;
+			uint64_t misses;
+			size_t size;
+		};
+		PublicKeyCacheStatistics public_key_cache_statistics();
+		
 		Hash triple_diffie_hellman(
 			const PrivateKey& my_long_term_key,
 			const PrivateKey& my_ephemeral_key,
 			const PublicKey& peer_long_term_key,
 			const PublicKey& peer_ephemeral_key
 		);
+		Hash triple_diffie_hellman(
+			const PrivateScalar& my_long_term_scalar,
+			const PrivateScalar& my_ephemeral_scalar,
+			const PublicKey& peer_long_term_key,
+			const PublicKey& peer_ephemeral_key
+		);
 		Hash reconstruct_triple_diffie_hellman(
 			const PublicKey& long_term_public_key_1,
 			const PrivateKey& ephemeral_private_key_1,
@@ -140,6 +224,16 @@ namespace np1sec
 			const Hash& nonce,
 			const std::string& username
 		);
+		/*
+		 * Equivalent to the above, given the triple_diffie_hellman() token
+		 * of the same keys. Lets callers authenticating a peer in both
+		 * directions compute the Diffie-Hellman part only once.
+		 */
+		Hash authentication_token(
+			const Hash& triple_diffie_hellman_token,
+			const Hash& nonce,
+			const std::string& username
+		);
 	}
 }
 
@@ -0,0 +1,457 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * The reference crypto backend, doing all public key operations through
+ * the gcrypt s-expression API.
+ */
+
+#include "cryptobackend.h"
+#include "publickeycache.h"
+
+#include <cassert>
+
+extern "C" {
+#include "gcrypt.h"
+}
+
+namespace np1sec
+{
+
+struct PrivateKeyData
+{
+	gcry_sexp_t sexp;
+	PublicKey public_key;
+
+	PrivateKeyData():
+		sexp(nullptr)
+	{}
+
+	~PrivateKeyData()
+	{
+		gcry_sexp_release(sexp);
+	}
+
+	PrivateKeyData(const PrivateKeyData& other) = delete;
+	PrivateKeyData& operator=(const PrivateKeyData& other) = delete;
+};
+
+struct PrivateScalarData
+{
+	gcry_sexp_t sexp;
+
+	explicit PrivateScalarData(gcry_sexp_t sexp_):
+		sexp(sexp_)
+	{}
+
+	~PrivateScalarData()
+	{
+		gcry_sexp_release(sexp);
+	}
+
+	PrivateScalarData(const PrivateScalarData& other) = delete;
+	PrivateScalarData& operator=(const PrivateScalarData& other) = delete;
+};
+
+/*
+ * Until gcrypt is initialized, gcry_mpi_ec_new() refuses to derive the
+ * public key of a private key that was not generated by gcrypt itself.
+ */
+static void initialize_gcrypt()
+{
+	static bool initialized = gcry_check_version(NULL) != NULL;
+	(void)initialized;
+}
+
+static std::shared_ptr<const PrivateKeyData> make_key(gcry_sexp_t sexp)
+{
+	initialize_gcrypt();
+
+	std::shared_ptr<PrivateKeyData> key = std::make_shared<PrivateKeyData>();
+
+	gcry_ctx_t public_key_parameters;
+	if (gcry_mpi_ec_new(&public_key_parameters, sexp, NULL)) {
+		throw CryptoException();
+	}
+	gcry_sexp_t public_key_sexp;
+	if (gcry_pubkey_get_sexp(&public_key_sexp, GCRY_PK_GET_PUBKEY, public_key_parameters)) {
+		gcry_ctx_release(public_key_parameters);
+		throw CryptoException();
+	}
+	gcry_ctx_release(public_key_parameters);
+
+	gcry_sexp_t q = gcry_sexp_find_token(public_key_sexp, "q", 0);
+	if (!q) {
+		gcry_sexp_release(public_key_sexp);
+		throw CryptoException();
+	}
+	gcry_sexp_release(public_key_sexp);
+	size_t q_size;
+	const char *q_buffer = gcry_sexp_nth_data(q, 1, &q_size);
+	if (!q_buffer) {
+		gcry_sexp_release(q);
+		throw CryptoException();
+	}
+	assert(q_size == sizeof(key->public_key.buffer));
+	memcpy(key->public_key.buffer, q_buffer, sizeof(key->public_key.buffer));
+	gcry_sexp_release(q);
+
+	if (gcry_sexp_build(&key->sexp, NULL, "%S", sexp)) {
+		throw CryptoException();
+	}
+	return key;
+}
+
+static gcry_sexp_t public_key_sexp(const PublicKey& key)
+{
+	gcry_sexp_t key_sexp;
+	if (gcry_sexp_build(&key_sexp, NULL, "(public-key (ecc (curve Ed25519) (flags eddsa) (q %b)))", sizeof(key.buffer), key.buffer)) {
+		return nullptr;
+	}
+	return key_sexp;
+}
+
+/*
+ * gcrypt stores ed25519 public keys in a form that gcry_pk_encrypt()
+ * doesn't understand. This function translates it into a form that
+ * can be used with gcry_pk_encrypt(). The resulting key form probably
+ * will NOT work with any other gcrypt functions.
+ *
+ * This hack will probably break as soon as gcrypt adds proper ed25519
+ * support. We'll need to ifdef it out when this support arrives.
+ *
+ * returns a public key sexp. returns NULL on error.
+ */
+static gcry_sexp_t convert_ed25519_encryption_key(gcry_sexp_t public_key)
+{
+	gcry_ctx_t public_key_parameters;
+	if (gcry_mpi_ec_new(&public_key_parameters, public_key, NULL)) {
+		return nullptr;
+	}
+
+	gcry_mpi_t scalar = gcry_mpi_ec_get_mpi("q", public_key_parameters, 0);
+	gcry_ctx_release(public_key_parameters);
+	if (!scalar) {
+		return nullptr;
+	}
+
+	gcry_sexp_t key_sexp;
+	gcry_error_t err = gcry_sexp_build(&key_sexp, NULL, "(public-key (ecc (curve Ed25519) (flags eddsa) (q %m)))", scalar);
+	gcry_mpi_release(scalar);
+	if (err) {
+		return nullptr;
+	}
+
+	return key_sexp;
+}
+
+static std::shared_ptr<gcry_sexp> signature_key(const PublicKey& key)
+{
+	gcry_sexp_t key_sexp = public_key_sexp(key);
+	if (!key_sexp) {
+		return nullptr;
+	}
+	return std::shared_ptr<gcry_sexp>(key_sexp, gcry_sexp_release);
+}
+
+static std::shared_ptr<gcry_sexp> encryption_key(const PublicKey& key)
+{
+	gcry_sexp_t key_sexp = public_key_sexp(key);
+	if (!key_sexp) {
+		return nullptr;
+	}
+	gcry_sexp_t encryption_key_sexp = convert_ed25519_encryption_key(key_sexp);
+	gcry_sexp_release(key_sexp);
+	if (!encryption_key_sexp) {
+		return nullptr;
+	}
+	return std::shared_ptr<gcry_sexp>(encryption_key_sexp, gcry_sexp_release);
+}
+
+static PublicKeyCache<gcry_sexp>& signature_key_cache()
+{
+	static PublicKeyCache<gcry_sexp> cache(signature_key);
+	return cache;
+}
+
+static PublicKeyCache<gcry_sexp>& encryption_key_cache()
+{
+	static PublicKeyCache<gcry_sexp> cache(encryption_key);
+	return cache;
+}
+
+/*
+ * gcrypt ed25519 private keys only contain the information necessary for
+ * signing, not the actual scalar. This function re-implements the computation
+ * of the private key scalar, stolen from gcrypt, which we need for 3DH.
+ *
+ * returns a sexp containing the scalar, which the caller needs to release.
+ * returns NULL on error.
+ */
+static gcry_sexp_t compute_private_key_scalar(gcry_sexp_t private_key)
+{
+	gcry_sexp_t d = gcry_sexp_find_token(private_key, "d", 0);
+	if (!d) {
+		return nullptr;
+	}
+	size_t d_size;
+	const char *d_buffer = gcry_sexp_nth_data(d, 1, &d_size);
+	if (!d_buffer) {
+		gcry_sexp_release(d);
+		return nullptr;
+	}
+
+	gcry_md_hd_t digest;
+	if (gcry_md_open(&digest, GCRY_MD_SHA512, GCRY_MD_FLAG_SECURE)) {
+		gcry_sexp_release(d);
+		return nullptr;
+	}
+	gcry_md_write(digest, d_buffer, d_size);
+	gcry_sexp_release(d);
+
+	unsigned char *hash = gcry_md_read(digest, GCRY_MD_SHA512);
+	unsigned char hash_buffer[32];
+	for (size_t i = 0; i < (sizeof hash_buffer); i++) {
+		hash_buffer[i] = hash[(sizeof hash_buffer) - i - 1];
+	}
+	hash_buffer[0] = (hash_buffer[0] & 0x7f) | 0x40;
+	hash_buffer[(sizeof hash_buffer) - 1] &= 0xf8;
+	gcry_md_close(digest);
+
+	gcry_mpi_t a;
+	gcry_error_t err = gcry_mpi_scan(&a, GCRYMPI_FMT_STD, hash_buffer, sizeof hash_buffer, NULL);
+	secure_wipe(hash_buffer, sizeof hash_buffer);
+	if (err) {
+		return nullptr;
+	}
+	gcry_sexp_t result;
+	if (gcry_sexp_build(&result, NULL, "%m", a)) {
+		gcry_mpi_release(a);
+		return nullptr;
+	}
+	gcry_mpi_release(a);
+
+	return result;
+}
+
+const char* CryptoBackend::name()
+{
+	return "gcrypt";
+}
+
+std::shared_ptr<const PrivateKeyData> CryptoBackend::generate_key(bool transient)
+{
+	const char* parameter_string;
+	if (transient) {
+		parameter_string = "(genkey (ecc (curve Ed25519) (flags eddsa transient-key)))";
+	} else {
+		parameter_string = "(genkey (ecc (curve Ed25519) (flags eddsa)))";
+	}
+
+	gcry_sexp_t generation_parameters;
+	if (gcry_sexp_build(&generation_parameters, NULL, parameter_string)) {
+		throw CryptoException();
+	}
+
+	gcry_sexp_t key_sexp;
+	if (gcry_pk_genkey(&key_sexp, generation_parameters)) {
+		gcry_sexp_release(generation_parameters);
+		throw CryptoException();
+	}
+	gcry_sexp_release(generation_parameters);
+
+	try {
+		std::shared_ptr<const PrivateKeyData> key = make_key(key_sexp);
+		gcry_sexp_release(key_sexp);
+		return key;
+	} catch(...) {
+		gcry_sexp_release(key_sexp);
+		throw;
+	}
+}
+
+std::shared_ptr<const PrivateKeyData> CryptoBackend::import_key(const SerializedPrivateKey& serialized_key)
+{
+	gcry_sexp_t key_sexp;
+	if (gcry_sexp_build(&key_sexp, NULL, "(private-key (ecc (curve Ed25519) (flags eddsa) (d %b)))", sizeof(serialized_key.buffer), serialized_key.buffer)) {
+		throw CryptoException();
+	}
+
+	try {
+		std::shared_ptr<const PrivateKeyData> key = make_key(key_sexp);
+		gcry_sexp_release(key_sexp);
+		return key;
+	} catch(...) {
+		gcry_sexp_release(key_sexp);
+		throw;
+	}
+}
+
+SerializedPrivateKey CryptoBackend::export_key(const PrivateKeyData& key)
+{
+	gcry_sexp_t d = gcry_sexp_find_token(key.sexp, "d", 0);
+	if (!d) {
+		throw CryptoException();
+	}
+	size_t d_size;
+	const char *d_buffer = gcry_sexp_nth_data(d, 1, &d_size);
+	if (!d_buffer) {
+		gcry_sexp_release(d);
+		throw CryptoException();
+	}
+	assert(d_size == c_private_key_length);
+	SerializedPrivateKey output;
+	memcpy(output.buffer, d_buffer, c_private_key_length);
+	gcry_sexp_release(d);
+	return output;
+}
+
+PublicKey CryptoBackend::public_key(const PrivateKeyData& key)
+{
+	return key.public_key;
+}
+
+std::shared_ptr<const PrivateScalarData> CryptoBackend::private_scalar(const PrivateKeyData& key)
+{
+	gcry_sexp_t scalar = compute_private_key_scalar(key.sexp);
+	if (!scalar) {
+		throw CryptoException();
+	}
+	return std::make_shared<PrivateScalarData>(scalar);
+}
+
+Signature CryptoBackend::sign(const std::string& payload, const PrivateKeyData& key)
+{
+	gcry_sexp_t payload_sexp;
+	if (gcry_sexp_build(&payload_sexp, NULL, "(data (flags eddsa) (hash-algo sha512) (value %b))", payload.size(), payload.data())) {
+		throw CryptoException();
+	}
+
+	gcry_sexp_t signature_sexp;
+	if (gcry_pk_sign(&signature_sexp, payload_sexp, key.sexp)) {
+		gcry_sexp_release(payload_sexp);
+		throw CryptoException();
+	}
+	gcry_sexp_release(payload_sexp);
+
+	gcry_sexp_t r_sexp = gcry_sexp_find_token(signature_sexp, "r", 0);
+	if (!r_sexp) {
+		gcry_sexp_release(signature_sexp);
+		throw CryptoException();
+	}
+	size_t r_size;
+	const char *r_buffer = gcry_sexp_nth_data(r_sexp, 1, &r_size);
+	if (!r_buffer) {
+		gcry_sexp_release(r_sexp);
+		gcry_sexp_release(signature_sexp);
+		throw CryptoException();
+	}
+
+	gcry_sexp_t s_sexp = gcry_sexp_find_token(signature_sexp, "s", 0);
+	if (!s_sexp) {
+		gcry_sexp_release(r_sexp);
+		gcry_sexp_release(signature_sexp);
+		throw CryptoException();
+	}
+	size_t s_size;
+	const char *s_buffer = gcry_sexp_nth_data(s_sexp, 1, &s_size);
+	if (!s_buffer) {
+		gcry_sexp_release(s_sexp);
+		gcry_sexp_release(r_sexp);
+		gcry_sexp_release(signature_sexp);
+		throw CryptoException();
+	}
+
+	Signature result;
+	assert(r_size == sizeof(result.buffer) / 2);
+	assert(r_size + s_size == sizeof(result.buffer));
+	memcpy(result.buffer, r_buffer, r_size);
+	memcpy(result.buffer + r_size, s_buffer, s_size);
+
+	gcry_sexp_release(s_sexp);
+	gcry_sexp_release(r_sexp);
+	gcry_sexp_release(signature_sexp);
+
+	return result;
+}
+
+bool CryptoBackend::verify(const std::string& payload, const Signature& signature, const PublicKey& key)
+{
+	std::shared_ptr<gcry_sexp> key_sexp = signature_key_cache().get(key);
+
+	gcry_sexp_t signature_sexp;
+	if (gcry_sexp_build(&signature_sexp, NULL, "(sig-val (eddsa (r %b)(s %b)))", 32, signature.buffer, 32, signature.buffer + 32)) {
+		throw CryptoException();
+	}
+
+	gcry_sexp_t payload_sexp;
+	if (gcry_sexp_build(&payload_sexp, NULL, "(data (flags eddsa) (hash-algo sha512) (value %b))", payload.size(), payload.data())) {
+		gcry_sexp_release(signature_sexp);
+		throw CryptoException();
+	}
+
+	gcry_error_t error = gcry_pk_verify(signature_sexp, payload_sexp, key_sexp.get());
+
+	gcry_sexp_release(payload_sexp);
+	gcry_sexp_release(signature_sexp);
+
+	return error == 0;
+}
+
+DiffieHellmanPoint CryptoBackend::diffie_hellman(const PrivateScalarData& scalar, const PublicKey& key)
+{
+	std::shared_ptr<gcry_sexp> public_encryption_key_sexp = encryption_key_cache().get(key);
+
+	gcry_sexp_t point_sexp;
+	if (gcry_pk_encrypt(&point_sexp, scalar.sexp, public_encryption_key_sexp.get())) {
+		throw CryptoException();
+	}
+
+	gcry_sexp_t s_sexp = gcry_sexp_find_token(point_sexp, "s", 0);
+	if (!s_sexp) {
+		gcry_sexp_release(point_sexp);
+		throw CryptoException();
+	}
+	gcry_sexp_release(point_sexp);
+	size_t s_size;
+	const char *s_buffer = gcry_sexp_nth_data(s_sexp, 1, &s_size);
+	if (!s_buffer) {
+		gcry_sexp_release(s_sexp);
+		throw CryptoException();
+	}
+
+	DiffieHellmanPoint result;
+	assert(s_size == sizeof(result.buffer));
+	memcpy(result.buffer, s_buffer, sizeof(result.buffer));
+	gcry_sexp_release(s_sexp);
+
+	return result;
+}
+
+crypto::PublicKeyCacheStatistics CryptoBackend::public_key_cache_statistics()
+{
+	crypto::PublicKeyCacheStatistics statistics;
+	statistics.hits = 0;
+	statistics.misses = 0;
+	statistics.size = 0;
+	signature_key_cache().add_statistics(&statistics);
+	encryption_key_cache().add_statistics(&statistics);
+	return statistics;
+}
+
+} // namespace np1sec
@@ -0,0 +1,228 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * A crypto backend signing and verifying with the OpenSSL EVP interface.
+ * OpenSSL has no ed25519 point multiplication, so the Diffie-Hellman
+ * products are computed by ed25519.cc.
+ */
+
+#include "cryptobackend.h"
+#include "ed25519.h"
+#include "publickeycache.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+namespace np1sec
+{
+
+struct PrivateKeyData
+{
+	SerializedPrivateKey seed;
+	EVP_PKEY* key;
+	PublicKey public_key;
+
+	PrivateKeyData():
+		key(nullptr)
+	{}
+
+	~PrivateKeyData()
+	{
+		EVP_PKEY_free(key);
+		secure_wipe(seed.buffer, sizeof(seed.buffer));
+	}
+
+	PrivateKeyData(const PrivateKeyData& other) = delete;
+	PrivateKeyData& operator=(const PrivateKeyData& other) = delete;
+};
+
+struct PrivateScalarData
+{
+	uint8_t scalar[32];
+
+	~PrivateScalarData()
+	{
+		secure_wipe(scalar, sizeof(scalar));
+	}
+
+	PrivateScalarData() = default;
+	PrivateScalarData(const PrivateScalarData& other) = delete;
+	PrivateScalarData& operator=(const PrivateScalarData& other) = delete;
+};
+
+static std::shared_ptr<const PrivateKeyData> make_key(const SerializedPrivateKey& seed)
+{
+	std::shared_ptr<PrivateKeyData> key = std::make_shared<PrivateKeyData>();
+	key->seed = seed;
+	key->key = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, nullptr, seed.buffer, sizeof(seed.buffer));
+	if (!key->key) {
+		throw CryptoException();
+	}
+	size_t public_key_size = sizeof(key->public_key.buffer);
+	if (!EVP_PKEY_get_raw_public_key(key->key, key->public_key.buffer, &public_key_size)) {
+		throw CryptoException();
+	}
+	if (public_key_size != sizeof(key->public_key.buffer)) {
+		throw CryptoException();
+	}
+	return key;
+}
+
+static std::shared_ptr<EVP_PKEY> signature_key(const PublicKey& key)
+{
+	EVP_PKEY* evp_key = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, nullptr, key.buffer, sizeof(key.buffer));
+	if (!evp_key) {
+		return nullptr;
+	}
+	return std::shared_ptr<EVP_PKEY>(evp_key, EVP_PKEY_free);
+}
+
+static std::shared_ptr<ed25519::Point> encryption_key(const PublicKey& key)
+{
+	std::shared_ptr<ed25519::Point> point = std::make_shared<ed25519::Point>();
+	if (!ed25519::decode_point(point.get(), key.buffer)) {
+		return nullptr;
+	}
+	return point;
+}
+
+static PublicKeyCache<EVP_PKEY>& signature_key_cache()
+{
+	static PublicKeyCache<EVP_PKEY> cache(signature_key);
+	return cache;
+}
+
+static PublicKeyCache<ed25519::Point>& encryption_key_cache()
+{
+	static PublicKeyCache<ed25519::Point> cache(encryption_key);
+	return cache;
+}
+
+const char* CryptoBackend::name()
+{
+	return "openssl";
+}
+
+std::shared_ptr<const PrivateKeyData> CryptoBackend::generate_key(bool transient)
+{
+	(void)transient;
+
+	SerializedPrivateKey seed;
+	if (RAND_priv_bytes(seed.buffer, sizeof(seed.buffer)) != 1) {
+		throw CryptoException();
+	}
+	try {
+		std::shared_ptr<const PrivateKeyData> key = make_key(seed);
+		secure_wipe(seed.buffer, sizeof(seed.buffer));
+		return key;
+	} catch(...) {
+		secure_wipe(seed.buffer, sizeof(seed.buffer));
+		throw;
+	}
+}
+
+std::shared_ptr<const PrivateKeyData> CryptoBackend::import_key(const SerializedPrivateKey& serialized_key)
+{
+	return make_key(serialized_key);
+}
+
+SerializedPrivateKey CryptoBackend::export_key(const PrivateKeyData& key)
+{
+	return key.seed;
+}
+
+PublicKey CryptoBackend::public_key(const PrivateKeyData& key)
+{
+	return key.public_key;
+}
+
+std::shared_ptr<const PrivateScalarData> CryptoBackend::private_scalar(const PrivateKeyData& key)
+{
+	unsigned char hash[SHA512_DIGEST_LENGTH];
+	SHA512(key.seed.buffer, sizeof(key.seed.buffer), hash);
+
+	std::shared_ptr<PrivateScalarData> scalar = std::make_shared<PrivateScalarData>();
+	memcpy(scalar->scalar, hash, sizeof(scalar->scalar));
+	scalar->scalar[0] &= 0xf8;
+	scalar->scalar[31] = (scalar->scalar[31] & 0x7f) | 0x40;
+	secure_wipe(hash, sizeof(hash));
+	return scalar;
+}
+
+Signature CryptoBackend::sign(const std::string& payload, const PrivateKeyData& key)
+{
+	EVP_MD_CTX* context = EVP_MD_CTX_new();
+	if (!context) {
+		throw CryptoException();
+	}
+	if (EVP_DigestSignInit(context, nullptr, nullptr, nullptr, key.key) != 1) {
+		EVP_MD_CTX_free(context);
+		throw CryptoException();
+	}
+
+	Signature result;
+	size_t signature_size = sizeof(result.buffer);
+	int status = EVP_DigestSign(context, result.buffer, &signature_size, reinterpret_cast<const unsigned char*>(payload.data()), payload.size());
+	EVP_MD_CTX_free(context);
+	if (status != 1 || signature_size != sizeof(result.buffer)) {
+		throw CryptoException();
+	}
+	return result;
+}
+
+bool CryptoBackend::verify(const std::string& payload, const Signature& signature, const PublicKey& key)
+{
+	std::shared_ptr<EVP_PKEY> evp_key = signature_key_cache().get(key);
+
+	EVP_MD_CTX* context = EVP_MD_CTX_new();
+	if (!context) {
+		throw CryptoException();
+	}
+	if (EVP_DigestVerifyInit(context, nullptr, nullptr, nullptr, evp_key.get()) != 1) {
+		EVP_MD_CTX_free(context);
+		throw CryptoException();
+	}
+	int status = EVP_DigestVerify(context, signature.buffer, sizeof(signature.buffer), reinterpret_cast<const unsigned char*>(payload.data()), payload.size());
+	EVP_MD_CTX_free(context);
+
+	return status == 1;
+}
+
+DiffieHellmanPoint CryptoBackend::diffie_hellman(const PrivateScalarData& scalar, const PublicKey& key)
+{
+	std::shared_ptr<ed25519::Point> point = encryption_key_cache().get(key);
+
+	DiffieHellmanPoint result;
+	ed25519::scalar_multiply(result.buffer, scalar.scalar, *point);
+	return result;
+}
+
+crypto::PublicKeyCacheStatistics CryptoBackend::public_key_cache_statistics()
+{
+	crypto::PublicKeyCacheStatistics statistics;
+	statistics.hits = 0;
+	statistics.misses = 0;
+	statistics.size = 0;
+	signature_key_cache().add_statistics(&statistics);
+	encryption_key_cache().add_statistics(&statistics);
+	return statistics;
+}
+
+} // namespace np1sec
@@ -0,0 +1,96 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SRC_CRYPTOBACKEND_H_
+#define SRC_CRYPTOBACKEND_H_
+
+#include "crypto.h"
+
+#include <memory>
+#include <string>
+
+/**
+ * Quickly overwrite a piece of memory with some byte to prevent RAM inspection.
+ * @param {void*} _ptr - A pointer to the first byte of memory to overwrite
+ * @param {uint8_t} _set - The byte to write over the memory block with
+ * @param {size_t} _len - The number of bytes to write over
+ */
+#define wipememory2(_ptr,_set,_len) do { \
+		volatile char *_vptr=(volatile char *)(_ptr); \
+		size_t _vlen=(_len); \
+		unsigned char _vset=(_set); \
+		while(_vlen) { *_vptr=(_vset); _vptr++; _vlen--; } \
+	} while(0)
+
+/**
+ * Quickly overwrite a piece of memory a few times to prevent RAM inspection.
+ * @param {void*} _ptr - A pointer to the first byte of memory to overwrite
+ * @param {size_t} _len - The number of bytes to write over
+ */
+#define secure_wipe(_ptr,_len) do { \
+		wipememory2(_ptr,0xff,_len); \
+		wipememory2(_ptr,0xaa,_len); \
+		wipememory2(_ptr,0x55,_len); \
+		wipememory2(_ptr,0x00,_len); \
+	} while (0)
+
+namespace np1sec
+{
+
+/*
+ * The Diffie-Hellman product of a private scalar and an ed25519 public
+ * key: the point in uncompressed form, 0x04 followed by the big-endian
+ * affine x and y coordinates. All backends must produce the same bytes.
+ */
+const size_t c_tdh_point_length = 65;
+typedef ByteArray<c_tdh_point_length> DiffieHellmanPoint;
+
+/**
+ * The public key operations behind PrivateKey, PrivateScalar and crypto::*.
+ *
+ * Exactly one backend is compiled in, chosen with the NP1SEC_CRYPTO_BACKEND
+ * CMake option: crypto_gcrypt.cc, the reference, or crypto_openssl.cc.
+ * Keys are ed25519 keys; the backends must agree on every output, so that
+ * users of different builds can talk to each other. Each backend defines
+ * PrivateKeyData and PrivateScalarData to hold its key material.
+ */
+class CryptoBackend
+{
+	public:
+	static const char* name();
+
+	static std::shared_ptr<const PrivateKeyData> generate_key(bool transient);
+	static std::shared_ptr<const PrivateKeyData> import_key(const SerializedPrivateKey& serialized_key);
+	static SerializedPrivateKey export_key(const PrivateKeyData& key);
+	static PublicKey public_key(const PrivateKeyData& key);
+
+	/* The clamped ed25519 secret scalar of the key, used for Diffie-Hellman. */
+	static std::shared_ptr<const PrivateScalarData> private_scalar(const PrivateKeyData& key);
+
+	static Signature sign(const std::string& payload, const PrivateKeyData& key);
+	static bool verify(const std::string& payload, const Signature& signature, const PublicKey& key);
+
+	/* For a public key [g]x and private scalar y, computes [g]xy. */
+	static DiffieHellmanPoint diffie_hellman(const PrivateScalarData& scalar, const PublicKey& key);
+
+	static crypto::PublicKeyCacheStatistics public_key_cache_statistics();
+};
+
+} // namespace np1sec
+
+#endif
@@ -27,6 +27,7 @@ std::ostream& operator<<(std::ostream& os, np1sec::Message::Type type)
 		case Type::Hello: os << "Hello"; break;
 		case Type::RoomAuthenticationRequest: os << "RoomAuthenticationRequest"; break;
 		case Type::RoomAuthentication: os << "RoomAuthentication"; break;
+		case Type::Batch: os << "Batch"; break;
 
 		case Type::Invite: os << "Invite"; break;
 		case Type::ConversationStatus: os << "ConversationStatus"; break;
@@ -52,6 +53,7 @@ std::ostream& operator<<(std::ostream& os, np1sec::Message::Type type)
 		case Type::KeyActivation: os << "KeyActivation"; break;
 		case Type::KeyRatchet: os << "KeyRatchet"; break;
 		case Type::Chat: os << "Chat"; break;
+		case Type::ChatChunk: os << "ChatChunk"; break;
 	}
 
 	return os;
@@ -81,6 +83,12 @@ std::ostream& operator<<(std::ostream& os, const np1sec::RoomAuthenticationMessa
 	return os;
 }
 
+std::ostream& operator<<(std::ostream& os, const np1sec::BatchMessage& msg)
+{
+	os << "messages:" << msg.messages.size();
+	return os;
+}
+
 std::ostream& operator<<(std::ostream& os, const np1sec::InviteMessage& msg)
 {
 	os << "username:" << msg.username;
@@ -247,6 +255,7 @@ std::ostream& operator<<(std::ostream& os, const np1sec::Message& msg)
 		case Type::Quit: os << msg.type << " " << QuitMessage::decode(msg); break;
 		case Type::RoomAuthenticationRequest: os << msg.type << " " << RoomAuthenticationRequestMessage::decode(msg); break;
 		case Type::RoomAuthentication: os << msg.type << " " << RoomAuthenticationMessage::decode(msg); break;
+		case Type::Batch: os << msg.type << " " << BatchMessage::decode(msg); break;
 		case Type::Invite: os << ConvMsg<InviteMessage>{msg}; break;
 		case Type::ConsistencyCheck: os << ConvMsg<ConsistencyCheckMessage>{msg}; break;
 		case Type::ConversationStatus: os << ConvMsg<ConversationStatusMessage>{msg}; break;
@@ -0,0 +1,745 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "ed25519.h"
+
+#include <cstring>
+#include <vector>
+
+namespace np1sec
+{
+namespace ed25519
+{
+
+typedef unsigned __int128 uint128_t;
+
+const uint64_t c_limb_mask = (uint64_t(1) << 51) - 1;
+
+/*
+ * Every operation leaves its result carried, with limbs at most a little
+ * over 51 bits, which is what the others expect of their inputs.
+ */
+
+static uint64_t load_64(const uint8_t* bytes)
+{
+	uint64_t result = 0;
+	for (int i = 7; i >= 0; i--) {
+		result = (result << 8) | bytes[i];
+	}
+	return result;
+}
+
+static void store_64(uint8_t* bytes, uint64_t value)
+{
+	for (int i = 0; i < 8; i++) {
+		bytes[i] = uint8_t(value >> (8 * i));
+	}
+}
+
+static void fe_set(FieldElement* h, uint64_t value)
+{
+	h->limbs[0] = value;
+	h->limbs[1] = 0;
+	h->limbs[2] = 0;
+	h->limbs[3] = 0;
+	h->limbs[4] = 0;
+}
+
+static void fe_carry(FieldElement* h)
+{
+	uint64_t* v = h->limbs;
+	v[1] += v[0] >> 51; v[0] &= c_limb_mask;
+	v[2] += v[1] >> 51; v[1] &= c_limb_mask;
+	v[3] += v[2] >> 51; v[2] &= c_limb_mask;
+	v[4] += v[3] >> 51; v[3] &= c_limb_mask;
+	v[0] += 19 * (v[4] >> 51); v[4] &= c_limb_mask;
+}
+
+static void fe_add(FieldElement* h, const FieldElement* f, const FieldElement* g)
+{
+	for (int i = 0; i < 5; i++) {
+		h->limbs[i] = f->limbs[i] + g->limbs[i];
+	}
+	fe_carry(h);
+}
+
+/* Adds 2p first, so that no limb goes negative. */
+static void fe_sub(FieldElement* h, const FieldElement* f, const FieldElement* g)
+{
+	h->limbs[0] = f->limbs[0] + 0xfffffffffffdaULL - g->limbs[0];
+	for (int i = 1; i < 5; i++) {
+		h->limbs[i] = f->limbs[i] + 0xffffffffffffeULL - g->limbs[i];
+	}
+	fe_carry(h);
+}
+
+static void fe_negate(FieldElement* h, const FieldElement* f)
+{
+	FieldElement zero;
+	fe_set(&zero, 0);
+	fe_sub(h, &zero, f);
+}
+
+static void fe_multiply(FieldElement* h, const FieldElement* f, const FieldElement* g)
+{
+	const uint64_t* a = f->limbs;
+	const uint64_t* b = g->limbs;
+	uint64_t b1_19 = 19 * b[1];
+	uint64_t b2_19 = 19 * b[2];
+	uint64_t b3_19 = 19 * b[3];
+	uint64_t b4_19 = 19 * b[4];
+
+	uint128_t r0 = uint128_t(a[0]) * b[0] + uint128_t(a[1]) * b4_19 + uint128_t(a[2]) * b3_19 + uint128_t(a[3]) * b2_19 + uint128_t(a[4]) * b1_19;
+	uint128_t r1 = uint128_t(a[0]) * b[1] + uint128_t(a[1]) * b[0] + uint128_t(a[2]) * b4_19 + uint128_t(a[3]) * b3_19 + uint128_t(a[4]) * b2_19;
+	uint128_t r2 = uint128_t(a[0]) * b[2] + uint128_t(a[1]) * b[1] + uint128_t(a[2]) * b[0] + uint128_t(a[3]) * b4_19 + uint128_t(a[4]) * b3_19;
+	uint128_t r3 = uint128_t(a[0]) * b[3] + uint128_t(a[1]) * b[2] + uint128_t(a[2]) * b[1] + uint128_t(a[3]) * b[0] + uint128_t(a[4]) * b4_19;
+	uint128_t r4 = uint128_t(a[0]) * b[4] + uint128_t(a[1]) * b[3] + uint128_t(a[2]) * b[2] + uint128_t(a[3]) * b[1] + uint128_t(a[4]) * b[0];
+
+	r1 += uint64_t(r0 >> 51);
+	r2 += uint64_t(r1 >> 51);
+	r3 += uint64_t(r2 >> 51);
+	r4 += uint64_t(r3 >> 51);
+	uint64_t h0 = (uint64_t(r0) & c_limb_mask) + 19 * uint64_t(r4 >> 51);
+	h->limbs[1] = (uint64_t(r1) & c_limb_mask) + (h0 >> 51);
+	h->limbs[0] = h0 & c_limb_mask;
+	h->limbs[2] = uint64_t(r2) & c_limb_mask;
+	h->limbs[3] = uint64_t(r3) & c_limb_mask;
+	h->limbs[4] = uint64_t(r4) & c_limb_mask;
+}
+
+static void fe_square(FieldElement* h, const FieldElement* f)
+{
+	fe_multiply(h, f, f);
+}
+
+static void fe_square_times(FieldElement* h, const FieldElement* f, int count)
+{
+	fe_square(h, f);
+	for (int i = 1; i < count; i++) {
+		fe_square(h, h);
+	}
+}
+
+/* The canonical little-endian encoding, the value reduced modulo p. */
+static void fe_to_bytes(uint8_t bytes[32], const FieldElement* f)
+{
+	FieldElement h = *f;
+	fe_carry(&h);
+	uint64_t* v = h.limbs;
+
+	// q is 1 exactly when the value is at least p = 2^255 - 19.
+	uint64_t q = (v[0] + 19) >> 51;
+	q = (v[1] + q) >> 51;
+	q = (v[2] + q) >> 51;
+	q = (v[3] + q) >> 51;
+	q = (v[4] + q) >> 51;
+
+	v[0] += 19 * q;
+	v[1] += v[0] >> 51; v[0] &= c_limb_mask;
+	v[2] += v[1] >> 51; v[1] &= c_limb_mask;
+	v[3] += v[2] >> 51; v[2] &= c_limb_mask;
+	v[4] += v[3] >> 51; v[3] &= c_limb_mask;
+	v[4] &= c_limb_mask;
+
+	store_64(bytes, v[0] | (v[1] << 51));
+	store_64(bytes + 8, (v[1] >> 13) | (v[2] << 38));
+	store_64(bytes + 16, (v[2] >> 26) | (v[3] << 25));
+	store_64(bytes + 24, (v[3] >> 39) | (v[4] << 12));
+}
+
+/* Ignores the top bit, which holds the sign of x in point encodings. */
+static void fe_from_bytes(FieldElement* h, const uint8_t bytes[32])
+{
+	uint64_t w0 = load_64(bytes);
+	uint64_t w1 = load_64(bytes + 8);
+	uint64_t w2 = load_64(bytes + 16);
+	uint64_t w3 = load_64(bytes + 24);
+	h->limbs[0] = w0 & c_limb_mask;
+	h->limbs[1] = ((w0 >> 51) | (w1 << 13)) & c_limb_mask;
+	h->limbs[2] = ((w1 >> 38) | (w2 << 26)) & c_limb_mask;
+	h->limbs[3] = ((w2 >> 25) | (w3 << 39)) & c_limb_mask;
+	h->limbs[4] = (w3 >> 12) & c_limb_mask;
+}
+
+static bool fe_is_zero(const FieldElement* f)
+{
+	uint8_t bytes[32];
+	fe_to_bytes(bytes, f);
+	uint8_t result = 0;
+	for (int i = 0; i < 32; i++) {
+		result |= bytes[i];
+	}
+	return result == 0;
+}
+
+static bool fe_is_negative(const FieldElement* f)
+{
+	uint8_t bytes[32];
+	fe_to_bytes(bytes, f);
+	return bytes[0] & 1;
+}
+
+/* Replaces h with g if flag is 1, in constant time. */
+static void fe_conditional_move(FieldElement* h, const FieldElement* g, uint64_t flag)
+{
+	uint64_t mask = 0 - flag;
+	for (int i = 0; i < 5; i++) {
+		h->limbs[i] ^= mask & (h->limbs[i] ^ g->limbs[i]);
+	}
+}
+
+/* Computes f^(2^250 - 1), the common prefix of the exponentiations below, and f^11. */
+static void fe_power_2_250_1(FieldElement* h, FieldElement* f_11, const FieldElement* f)
+{
+	FieldElement f_2, f_9, t, f_2_5_0, f_2_10_0, f_2_20_0, f_2_50_0, f_2_100_0;
+
+	fe_square(&f_2, f);
+	fe_square_times(&t, &f_2, 2);
+	fe_multiply(&f_9, &t, f);
+	fe_multiply(f_11, &f_9, &f_2);
+	fe_square(&t, f_11);
+	fe_multiply(&f_2_5_0, &t, &f_9);
+	fe_square_times(&t, &f_2_5_0, 5);
+	fe_multiply(&f_2_10_0, &t, &f_2_5_0);
+	fe_square_times(&t, &f_2_10_0, 10);
+	fe_multiply(&f_2_20_0, &t, &f_2_10_0);
+	fe_square_times(&t, &f_2_20_0, 20);
+	fe_multiply(&t, &t, &f_2_20_0);
+	fe_square_times(&t, &t, 10);
+	fe_multiply(&f_2_50_0, &t, &f_2_10_0);
+	fe_square_times(&t, &f_2_50_0, 50);
+	fe_multiply(&f_2_100_0, &t, &f_2_50_0);
+	fe_square_times(&t, &f_2_100_0, 100);
+	fe_multiply(&t, &t, &f_2_100_0);
+	fe_square_times(&t, &t, 50);
+	fe_multiply(h, &t, &f_2_50_0);
+}
+
+/* f^(p - 2) = 1/f */
+static void fe_invert(FieldElement* h, const FieldElement* f)
+{
+	FieldElement t, f_11;
+	fe_power_2_250_1(&t, &f_11, f);
+	fe_square_times(&t, &t, 5);
+	fe_multiply(h, &t, &f_11);
+}
+
+/* f^((p - 5) / 8) */
+static void fe_power_22523(FieldElement* h, const FieldElement* f)
+{
+	FieldElement t, f_11;
+	fe_power_2_250_1(&t, &f_11, f);
+	fe_square_times(&t, &t, 2);
+	fe_multiply(h, &t, f);
+}
+
+struct Constants
+{
+	// The curve parameter d = -121665/121666, and 2d.
+	FieldElement d;
+	FieldElement d_2;
+	// A square root of -1.
+	FieldElement sqrt_m1;
+
+	Constants()
+	{
+		FieldElement numerator, denominator;
+		fe_set(&numerator, 121665);
+		fe_set(&denominator, 121666);
+		fe_invert(&denominator, &denominator);
+		fe_multiply(&d, &numerator, &denominator);
+		fe_negate(&d, &d);
+		fe_add(&d_2, &d, &d);
+
+		// 2 is not a square, so 2^((p - 1) / 4) = 2^(2 (p - 5) / 8 + 1) squares to -1.
+		FieldElement two, t;
+		fe_set(&two, 2);
+		fe_power_22523(&t, &two);
+		fe_square(&t, &t);
+		fe_multiply(&sqrt_m1, &t, &two);
+	}
+};
+
+static const Constants& constants()
+{
+	static const Constants result;
+	return result;
+}
+
+static void point_identity(Point* r)
+{
+	fe_set(&r->x, 0);
+	fe_set(&r->y, 1);
+	fe_set(&r->z, 1);
+	fe_set(&r->t, 0);
+}
+
+/*
+ * The addition law for extended coordinates of Hisil, Wong, Carter and
+ * Dawson; complete on this curve, so it also doubles and adds the identity.
+ */
+static void point_add(Point* r, const Point* p, const Point* q)
+{
+	FieldElement a, b, c, d, e, f, g, h, t;
+
+	fe_sub(&a, &p->y, &p->x);
+	fe_sub(&t, &q->y, &q->x);
+	fe_multiply(&a, &a, &t);
+	fe_add(&b, &p->y, &p->x);
+	fe_add(&t, &q->y, &q->x);
+	fe_multiply(&b, &b, &t);
+	fe_multiply(&c, &p->t, &q->t);
+	fe_multiply(&c, &c, &constants().d_2);
+	fe_multiply(&d, &p->z, &q->z);
+	fe_add(&d, &d, &d);
+	fe_sub(&e, &b, &a);
+	fe_sub(&f, &d, &c);
+	fe_add(&g, &d, &c);
+	fe_add(&h, &b, &a);
+
+	fe_multiply(&r->x, &e, &f);
+	fe_multiply(&r->y, &g, &h);
+	fe_multiply(&r->t, &e, &h);
+	fe_multiply(&r->z, &f, &g);
+}
+
+static void point_double(Point* r, const Point* p)
+{
+	FieldElement a, b, c, e, f, g, h;
+
+	fe_square(&a, &p->x);
+	fe_square(&b, &p->y);
+	fe_square(&c, &p->z);
+	fe_add(&c, &c, &c);
+	fe_add(&e, &p->x, &p->y);
+	fe_square(&e, &e);
+	fe_sub(&e, &e, &a);
+	fe_sub(&e, &e, &b);
+	fe_sub(&g, &b, &a);
+	fe_sub(&f, &g, &c);
+	fe_add(&h, &a, &b);
+	fe_negate(&h, &h);
+
+	fe_multiply(&r->x, &e, &f);
+	fe_multiply(&r->y, &g, &h);
+	fe_multiply(&r->t, &e, &h);
+	fe_multiply(&r->z, &f, &g);
+}
+
+static void point_conditional_move(Point* r, const Point* p, uint64_t flag)
+{
+	fe_conditional_move(&r->x, &p->x, flag);
+	fe_conditional_move(&r->y, &p->y, flag);
+	fe_conditional_move(&r->z, &p->z, flag);
+	fe_conditional_move(&r->t, &p->t, flag);
+}
+
+bool decode_point(Point* point, const uint8_t encoded[32])
+{
+	const Constants& c = constants();
+	FieldElement x, y, z, u, v, v_3, v_x_2, check;
+
+	// x^2 = (y^2 - 1) / (d y^2 + 1) = u / v
+	fe_from_bytes(&y, encoded);
+	fe_set(&z, 1);
+	fe_square(&u, &y);
+	fe_multiply(&v, &u, &c.d);
+	fe_sub(&u, &u, &z);
+	fe_add(&v, &v, &z);
+
+	// x = u v^3 (u v^7)^((p - 5) / 8), which is a root of u/v or of -u/v
+	fe_square(&v_3, &v);
+	fe_multiply(&v_3, &v_3, &v);
+	fe_square(&x, &v_3);
+	fe_multiply(&x, &x, &v);
+	fe_multiply(&x, &x, &u);
+	fe_power_22523(&x, &x);
+	fe_multiply(&x, &x, &v_3);
+	fe_multiply(&x, &x, &u);
+
+	fe_square(&v_x_2, &x);
+	fe_multiply(&v_x_2, &v_x_2, &v);
+	fe_sub(&check, &v_x_2, &u);
+	if (!fe_is_zero(&check)) {
+		fe_add(&check, &v_x_2, &u);
+		if (!fe_is_zero(&check)) {
+			return false;
+		}
+		fe_multiply(&x, &x, &c.sqrt_m1);
+	}
+
+	if (fe_is_negative(&x) != bool(encoded[31] >> 7)) {
+		fe_negate(&x, &x);
+	}
+
+	point->x = x;
+	point->y = y;
+	point->z = z;
+	fe_multiply(&point->t, &x, &y);
+	return true;
+}
+
+/*
+ * Fixed four-bit windows, with every table entry read for each window so
+ * that the memory access pattern does not depend on the scalar.
+ */
+void scalar_multiply(uint8_t product[65], const uint8_t scalar[32], const Point& point)
+{
+	Point table[16];
+	point_identity(&table[0]);
+	table[1] = point;
+	for (int i = 2; i < 16; i++) {
+		point_add(&table[i], &table[i - 1], &point);
+	}
+
+	Point result;
+	point_identity(&result);
+	for (int i = 63; i >= 0; i--) {
+		for (int j = 0; j < 4; j++) {
+			point_double(&result, &result);
+		}
+
+		uint64_t window = (scalar[i / 2] >> (4 * (i & 1))) & 0x0f;
+		Point selected;
+		point_identity(&selected);
+		for (uint64_t j = 0; j < 16; j++) {
+			uint64_t equal = ((j ^ window) - 1) >> 63;
+			point_conditional_move(&selected, &table[j], equal);
+		}
+		point_add(&result, &result, &selected);
+	}
+
+	FieldElement z_inverse, x, y;
+	fe_invert(&z_inverse, &result.z);
+	fe_multiply(&x, &result.x, &z_inverse);
+	fe_multiply(&y, &result.y, &z_inverse);
+
+	uint8_t x_bytes[32];
+	uint8_t y_bytes[32];
+	fe_to_bytes(x_bytes, &x);
+	fe_to_bytes(y_bytes, &y);
+	product[0] = 0x04;
+	for (int i = 0; i < 32; i++) {
+		product[1 + i] = x_bytes[31 - i];
+		product[33 + i] = y_bytes[31 - i];
+	}
+}
+
+
+
+/*
+ * Scalars modulo the order of the base point,
+ * l = 2^252 + 27742317777372353535851937790883648493,
+ * in four 64-bit words, least significant first.
+ */
+struct Scalar
+{
+	uint64_t words[4];
+};
+
+static const uint64_t c_order[5] = {0x5812631a5cf5d3edULL, 0x14def9dea2f79cd6ULL, 0, 0x1000000000000000ULL, 0};
+
+/* r = a * b, for r of a_size + b_size words. */
+static void words_multiply(uint64_t* r, const uint64_t* a, size_t a_size, const uint64_t* b, size_t b_size)
+{
+	for (size_t i = 0; i < a_size + b_size; i++) {
+		r[i] = 0;
+	}
+	for (size_t i = 0; i < a_size; i++) {
+		uint64_t carry = 0;
+		for (size_t j = 0; j < b_size; j++) {
+			uint128_t product = uint128_t(a[i]) * b[j] + r[i + j] + carry;
+			r[i + j] = uint64_t(product);
+			carry = uint64_t(product >> 64);
+		}
+		r[i + b_size] = carry;
+	}
+}
+
+/* a -= b, modulo 2^(64 size) */
+static void words_subtract(uint64_t* a, const uint64_t* b, size_t size)
+{
+	uint64_t borrow = 0;
+	for (size_t i = 0; i < size; i++) {
+		uint128_t difference = uint128_t(a[i]) - b[i] - borrow;
+		a[i] = uint64_t(difference);
+		borrow = uint64_t(difference >> 64) & 1;
+	}
+}
+
+static bool words_less(const uint64_t* a, const uint64_t* b, size_t size)
+{
+	for (size_t i = size; i-- > 0;) {
+		if (a[i] != b[i]) {
+			return a[i] < b[i];
+		}
+	}
+	return false;
+}
+
+/* floor(2^512 / l), for Barrett reduction. */
+struct BarrettConstant
+{
+	uint64_t words[5];
+
+	BarrettConstant()
+	{
+		uint64_t remainder[5] = {0, 0, 0, 0, 0};
+		for (size_t i = 0; i < 5; i++) {
+			words[i] = 0;
+		}
+		for (int bit = 512; bit >= 0; bit--) {
+			for (size_t i = 4; i > 0; i--) {
+				remainder[i] = (remainder[i] << 1) | (remainder[i - 1] >> 63);
+			}
+			remainder[0] = (remainder[0] << 1) | (bit == 512 ? 1 : 0);
+			if (!words_less(remainder, c_order, 5)) {
+				words_subtract(remainder, c_order, 5);
+				words[bit / 64] |= uint64_t(1) << (bit % 64);
+			}
+		}
+	}
+};
+
+/* r = x mod l, for x of eight words; Barrett reduction as in HAC 14.42. */
+static void scalar_reduce(Scalar* r, const uint64_t x[8])
+{
+	static const BarrettConstant mu;
+
+	uint64_t quotient[10];
+	words_multiply(quotient, x + 3, 5, mu.words, 5);
+	uint64_t multiple[9];
+	words_multiply(multiple, quotient + 5, 5, c_order, 4);
+
+	uint64_t remainder[5] = {x[0], x[1], x[2], x[3], x[4]};
+	words_subtract(remainder, multiple, 5);
+	while (!words_less(remainder, c_order, 5)) {
+		words_subtract(remainder, c_order, 5);
+	}
+	for (size_t i = 0; i < 4; i++) {
+		r->words[i] = remainder[i];
+	}
+}
+
+/* r = a * b + c mod l */
+static void scalar_multiply_add(Scalar* r, const Scalar& a, const Scalar& b, const Scalar& c)
+{
+	uint64_t product[8];
+	words_multiply(product, a.words, 4, b.words, 4);
+	uint64_t carry = 0;
+	for (size_t i = 0; i < 8; i++) {
+		uint128_t sum = uint128_t(product[i]) + (i < 4 ? c.words[i] : 0) + carry;
+		product[i] = uint64_t(sum);
+		carry = uint64_t(sum >> 64);
+	}
+	scalar_reduce(r, product);
+}
+
+static void scalar_load(Scalar* r, const uint8_t* bytes, size_t size)
+{
+	for (size_t i = 0; i < 4; i++) {
+		r->words[i] = 8 * i < size ? load_64(bytes + 8 * i) : 0;
+	}
+}
+
+static unsigned int scalar_window(const Scalar& scalar, size_t window)
+{
+	return (scalar.words[window / 16] >> (4 * (window % 16))) & 0x0f;
+}
+
+static void point_negate(Point* r, const Point* p)
+{
+	fe_negate(&r->x, &p->x);
+	r->y = p->y;
+	r->z = p->z;
+	fe_negate(&r->t, &p->t);
+}
+
+/* decode_point(), rejecting any encoding but the canonical one. */
+static bool decode_canonical_point(Point* point, const uint8_t encoded[32])
+{
+	if (!decode_point(point, encoded)) {
+		return false;
+	}
+	uint8_t canonical[32];
+	fe_to_bytes(canonical, &point->y);
+	canonical[31] |= uint8_t(fe_is_negative(&point->x)) << 7;
+	return memcmp(canonical, encoded, sizeof(canonical)) == 0;
+}
+
+static bool point_is_identity(const Point& point)
+{
+	FieldElement y_minus_z;
+	fe_sub(&y_minus_z, &point.y, &point.z);
+	return fe_is_zero(&point.x) && fe_is_zero(&y_minus_z);
+}
+
+/* decode_canonical_point(), also rejecting the eight points of small order. */
+static bool decode_signature_point(Point* point, const uint8_t encoded[32])
+{
+	if (!decode_canonical_point(point, encoded)) {
+		return false;
+	}
+	Point multiple = *point;
+	for (int j = 0; j < 3; j++) {
+		point_double(&multiple, &multiple);
+	}
+	return !point_is_identity(multiple);
+}
+
+bool valid_signature_encoding(const uint8_t r[32], const uint8_t s[32], const uint8_t public_key[32])
+{
+	Scalar scalar;
+	scalar_load(&scalar, s, 32);
+	if (!words_less(scalar.words, c_order, 4)) {
+		return false;
+	}
+	Point point;
+	return decode_signature_point(&point, r) && decode_signature_point(&point, public_key);
+}
+
+static const Point& base_point()
+{
+	struct BasePoint
+	{
+		Point point;
+
+		BasePoint()
+		{
+			// y = 4/5, with x positive
+			uint8_t encoded[32];
+			memset(encoded, 0x66, sizeof(encoded));
+			encoded[0] = 0x58;
+			decode_point(&point, encoded);
+		}
+	};
+	static const BasePoint result;
+	return result.point;
+}
+
+/*
+ * Whether [8] of the sum of [scalars[i]] points[i] is the identity.
+ * Straus' method with four-bit windows: all terms share the doublings,
+ * and a term only costs additions for the windows its scalar spans.
+ */
+static bool combination_is_small_order(const std::vector<Point>& points, const std::vector<Scalar>& scalars)
+{
+	std::vector<Point> tables(16 * points.size());
+	int top = -1;
+	for (size_t i = 0; i < points.size(); i++) {
+		Point* table = &tables[16 * i];
+		point_identity(&table[0]);
+		table[1] = points[i];
+		for (size_t j = 2; j < 16; j++) {
+			point_add(&table[j], &table[j - 1], &points[i]);
+		}
+		for (int window = 63; window > top; window--) {
+			if (scalar_window(scalars[i], window)) {
+				top = window;
+			}
+		}
+	}
+
+	Point result;
+	point_identity(&result);
+	for (int window = top; window >= 0; window--) {
+		if (window != top) {
+			for (int j = 0; j < 4; j++) {
+				point_double(&result, &result);
+			}
+		}
+		for (size_t i = 0; i < points.size(); i++) {
+			unsigned int digit = scalar_window(scalars[i], window);
+			if (digit) {
+				point_add(&result, &result, &tables[16 * i + digit]);
+			}
+		}
+	}
+	for (int j = 0; j < 3; j++) {
+		point_double(&result, &result);
+	}
+
+	return point_is_identity(result);
+}
+
+/*
+ * With weights z, checks that
+ * [8]([sum z s]B - sum [z]R - sum [z challenge]A) is the identity.
+ * Signatures by the same key share one term for it.
+ */
+bool verify_batch(const BatchSignature* signatures, size_t count)
+{
+	std::vector<Point> points(1);
+	std::vector<Scalar> scalars(1);
+	points[0] = base_point();
+	memset(&scalars[0], 0, sizeof(scalars[0]));
+
+	std::vector<const uint8_t*> keys;
+	std::vector<size_t> key_terms;
+	for (size_t i = 0; i < count; i++) {
+		const BatchSignature& signature = signatures[i];
+
+		Scalar s, challenge, weight;
+		scalar_load(&s, signature.s, 32);
+		if (!words_less(s.words, c_order, 4)) {
+			return false;
+		}
+		uint64_t challenge_words[8];
+		for (size_t j = 0; j < 8; j++) {
+			challenge_words[j] = load_64(signature.challenge + 8 * j);
+		}
+		scalar_reduce(&challenge, challenge_words);
+		scalar_load(&weight, signature.weight, sizeof(signature.weight));
+
+		scalar_multiply_add(&scalars[0], weight, s, scalars[0]);
+
+		Point r;
+		if (!decode_signature_point(&r, signature.r)) {
+			return false;
+		}
+		points.emplace_back();
+		point_negate(&points.back(), &r);
+		scalars.push_back(weight);
+
+		size_t key;
+		for (key = 0; key < keys.size(); key++) {
+			if (memcmp(keys[key], signature.public_key, 32) == 0) {
+				break;
+			}
+		}
+		if (key == keys.size()) {
+			Point a;
+			if (!decode_signature_point(&a, signature.public_key)) {
+				return false;
+			}
+			keys.push_back(signature.public_key);
+			key_terms.push_back(points.size());
+			points.emplace_back();
+			point_negate(&points.back(), &a);
+			scalars.emplace_back();
+			memset(&scalars.back(), 0, sizeof(scalars.back()));
+		}
+		Scalar& key_scalar = scalars[key_terms[key]];
+		scalar_multiply_add(&key_scalar, weight, challenge, key_scalar);
+	}
+
+	return combination_is_small_order(points, scalars);
+}
+
+} // namespace ed25519
+} // namespace np1sec
@@ -0,0 +1,98 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SRC_ED25519_H_
+#define SRC_ED25519_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace np1sec
+{
+
+/*
+ * Point arithmetic on the edwards25519 curve, for batch signature
+ * verification and for the Diffie-Hellman products of the crypto backends
+ * that have no use for gcrypt's. Field elements are held in five 51-bit
+ * limbs, after curve25519-donna and the ref10 implementation.
+ */
+namespace ed25519
+{
+	struct FieldElement
+	{
+		uint64_t limbs[5];
+	};
+
+	/* A point in extended coordinates: x = X/Z, y = Y/Z, xy = T/Z. */
+	struct Point
+	{
+		FieldElement x;
+		FieldElement y;
+		FieldElement z;
+		FieldElement t;
+	};
+
+	/*
+	 * Decodes a point in the standard 32-byte encoding of ed25519 public
+	 * keys. Returns false if the encoding is not a point on the curve.
+	 */
+	bool decode_point(Point* point, const uint8_t encoded[32]);
+
+	/*
+	 * Multiplies point by the little-endian scalar, in time independent
+	 * of the scalar. The product is written in uncompressed form: 0x04
+	 * followed by the big-endian affine x and y coordinates.
+	 */
+	void scalar_multiply(uint8_t product[65], const uint8_t scalar[32], const Point& point);
+
+	/*
+	 * An ed25519 signature (r, s) by public_key, for verify_batch().
+	 * challenge is SHA-512(r || public_key || message), and weight a
+	 * secret random number the signature's equation is multiplied by.
+	 */
+	struct BatchSignature
+	{
+		const uint8_t* r;
+		const uint8_t* s;
+		const uint8_t* public_key;
+		uint8_t challenge[64];
+		uint8_t weight[16];
+	};
+
+	/*
+	 * Whether s is reduced, and r and public_key are canonical encodings
+	 * of points that are not of small order. verify_batch() refuses
+	 * signatures that are not.
+	 */
+	bool valid_signature_encoding(const uint8_t r[32], const uint8_t s[32], const uint8_t public_key[32]);
+
+	/*
+	 * Checks the weighted sum of the cofactored verification equations
+	 * [8][s]B = [8]R + [8][challenge]A of the signatures, which costs a
+	 * fraction of checking them one by one. If it holds, so does every
+	 * equation, except with probability 2^-128. If not, at least one
+	 * signature is invalid, or fails valid_signature_encoding().
+	 *
+	 * Runs in variable time; signatures are public.
+	 */
+	bool verify_batch(const BatchSignature* signatures, size_t count);
+}
+
+} // namespace np1sec
+
+#endif
@@ -25,11 +25,36 @@
 namespace np1sec
 {
 
+static const char* key_exchange_state_name(KeyExchange::State state)
+{
+	switch (state) {
+		case KeyExchange::State::PublicKey: return "PublicKey";
+		case KeyExchange::State::SecretShare: return "SecretShare";
+		case KeyExchange::State::Acceptance: return "Acceptance";
+		case KeyExchange::State::KeyAccepted: return "KeyAccepted";
+		case KeyExchange::State::Reveal: return "Reveal";
+		case KeyExchange::State::RevealFinished: return "RevealFinished";
+	}
+	return "";
+}
+
+static const char* key_exchange_finish_name(KeyExchange::State state)
+{
+	switch (state) {
+		case KeyExchange::State::PublicKey: return "finish_public_key";
+		case KeyExchange::State::SecretShare: return "finish_secret_share";
+		case KeyExchange::State::Acceptance: return "finish_acceptance";
+		case KeyExchange::State::Reveal: return "finish_reveal";
+		default: return "";
+	}
+}
+
 // timeout, in milliseconds, after which a session gets replaced
 const uint32_t c_session_ratchet_timeout = 120000;
 
 EncryptedChat::EncryptedChat(Conversation* conversation):
-	m_conversation(conversation)
+	m_conversation(conversation),
+	m_key_exchanges_version(1)
 {}
 
 void EncryptedChat::unserialize_key_exchange(const KeyExchangeState& exchange)
@@ -107,6 +132,7 @@ void EncryptedChat::create_solo_session(const Hash& session_id)
 	session_symmetric_key.key = crypto::nonce_hash();
 	
 	SessionData session;
+	session.key_exchange_start_time = RoomStatistics::now();
 	session.active = true;
 	session.participants.insert(self);
 	session.session = std::unique_ptr<Session>(new Session(m_conversation, session_id, accepted_users, session_symmetric_key, session_private_key));
@@ -182,7 +208,10 @@ void EncryptedChat::user_public_key(const std::string& username, const Hash& key
 	assert(m_participants.count(username));
 	assert(m_key_exchanges.count(key_id));
 	assert(m_key_exchanges.at(key_id).key_exchange->state() == KeyExchange::State::PublicKey);
+	TraceTime start = m_conversation->room()->trace_time();
 	m_key_exchanges[key_id].key_exchange->set_public_key(username, public_key);
+	m_key_exchanges_version++;
+	trace_contribution("public_key", username, key_id, KeyExchange::State::PublicKey, start);
 	if (m_key_exchanges.at(key_id).key_exchange->state() == KeyExchange::State::SecretShare) {
 		m_conversation->add_key_exchange_event(Message::Type::KeyExchangeSecretShare, key_id, m_key_exchanges.at(key_id).key_exchange->users());
 		
@@ -205,7 +234,10 @@ void EncryptedChat::user_secret_share(const std::string& username, const Hash& k
 		m_conversation->remove_user(username);
 		return;
 	}
+	TraceTime start = m_conversation->room()->trace_time();
 	m_key_exchanges[key_id].key_exchange->set_secret_share(username, secret_share);
+	m_key_exchanges_version++;
+	trace_contribution("secret_share", username, key_id, KeyExchange::State::SecretShare, start);
 	if (m_key_exchanges.at(key_id).key_exchange->state() == KeyExchange::State::Acceptance) {
 		m_conversation->add_key_exchange_event(Message::Type::KeyExchangeAcceptance, key_id, m_key_exchanges.at(key_id).key_exchange->users());
 		
@@ -223,7 +255,10 @@ void EncryptedChat::user_key_hash(const std::string& username, const Hash& key_i
 	assert(m_participants.count(username));
 	assert(m_key_exchanges.count(key_id));
 	assert(m_key_exchanges.at(key_id).key_exchange->state() == KeyExchange::State::Acceptance);
+	TraceTime start = m_conversation->room()->trace_time();
 	m_key_exchanges[key_id].key_exchange->set_key_hash(username, key_hash);
+	m_key_exchanges_version++;
+	trace_contribution("key_hash", username, key_id, KeyExchange::State::Acceptance, start);
 	if (m_key_exchanges.at(key_id).key_exchange->state() == KeyExchange::State::KeyAccepted) {
 		m_conversation->add_key_exchange_event(Message::Type::KeyActivation, key_id, m_key_exchanges.at(key_id).key_exchange->users());
 		m_latest_session_id = key_id;
@@ -253,7 +288,10 @@ void EncryptedChat::user_private_key(const std::string& username, const Hash& ke
 	assert(m_participants.count(username));
 	assert(m_key_exchanges.count(key_id));
 	assert(m_key_exchanges.at(key_id).key_exchange->state() == KeyExchange::State::Reveal);
+	TraceTime start = m_conversation->room()->trace_time();
 	m_key_exchanges[key_id].key_exchange->set_private_key(username, private_key);
+	m_key_exchanges_version++;
+	trace_contribution("private_key", username, key_id, KeyExchange::State::Reveal, start);
 	if (m_key_exchanges.at(key_id).key_exchange->state() == KeyExchange::State::RevealFinished) {
 		std::set<std::string> malicious_users = m_key_exchanges.at(key_id).key_exchange->malicious_users();
 		
@@ -269,12 +307,14 @@ void EncryptedChat::user_activation(const std::string& username, const Hash& key
 	assert(!m_sessions.empty());
 	m_participants[username].have_active_session = true;
 	m_participants[username].active_session = key_id;
+	m_conversation->room()->trace(TraceEvent::Type::Instant, "activation", key_id, username);
 	progress_sessions();
 }
 
 void EncryptedChat::replace_session(const Hash& key_id)
 {
 	if (m_key_exchanges.empty() && m_latest_session_id == key_id) {
+		m_conversation->room()->trace(TraceEvent::Type::Instant, "ratchet", key_id);
 		create_key_exchange();
 	}
 }
@@ -314,8 +354,17 @@ void EncryptedChat::insert_key_exchange(std::unique_ptr<KeyExchange>&& key_excha
 		m_participants[username].key_exchanges.insert(key_id);
 	}
 	
+	if (key_exchange->contains(m_conversation->room()->username())) {
+		m_conversation->room()->mutable_statistics().key_exchanges_started++;
+	}
+	
 	bool empty = m_key_exchanges.empty();
 	m_key_exchanges[key_id].key_exchange = std::move(key_exchange);
+	m_key_exchanges[key_id].start_time = RoomStatistics::now();
+	if (m_conversation->room()->tracing()) {
+		m_conversation->room()->trace(TraceEvent::Type::Begin, "key_exchange", key_id, std::string(),
+			std::to_string(m_key_exchanges[key_id].key_exchange->users().size()) + " participants, " + key_exchange_state_name(m_key_exchanges[key_id].key_exchange->state()));
+	}
 	if (empty) {
 		m_key_exchange_first = key_id;
 		m_key_exchanges[key_id].has_previous = false;
@@ -327,11 +376,13 @@ void EncryptedChat::insert_key_exchange(std::unique_ptr<KeyExchange>&& key_excha
 	}
 	m_key_exchanges[key_id].has_next = false;
 	m_key_exchange_last = key_id;
+	m_key_exchanges_version++;
 }
 
 void EncryptedChat::erase_key_exchange(Hash key_id)
 {
 	const KeyExchangeData& exchange = m_key_exchanges[key_id];
+	m_conversation->room()->trace(TraceEvent::Type::End, "key_exchange", key_id, std::string(), key_exchange_state_name(exchange.key_exchange->state()));
 	if (exchange.has_previous) {
 		assert(m_key_exchanges.count(exchange.previous));
 		assert(m_key_exchanges[exchange.previous].has_next);
@@ -365,6 +416,7 @@ void EncryptedChat::erase_key_exchange(Hash key_id)
 		m_participants[username].key_exchanges.erase(key_id);
 	}
 	m_key_exchanges.erase(key_id);
+	m_key_exchanges_version++;
 }
 
 void EncryptedChat::create_key_exchange()
@@ -389,6 +441,21 @@ void EncryptedChat::create_key_exchange()
 	}
 }
 
+void EncryptedChat::trace_contribution(const char* name, const std::string& username, const Hash& key_id, KeyExchange::State state, const TraceTime& start)
+{
+	Room* room = m_conversation->room();
+	if (!room->tracing()) {
+		return;
+	}
+	KeyExchange::State new_state = m_key_exchanges.at(key_id).key_exchange->state();
+	if (new_state == state) {
+		room->trace(TraceEvent::Type::Instant, name, key_id, username);
+	} else {
+		// The last contribution of a phase: whoever it came from was the one everyone waited for.
+		room->trace(TraceEvent::Type::Complete, key_exchange_finish_name(state), key_id, username, key_exchange_state_name(new_state), start);
+	}
+}
+
 void EncryptedChat::create_session(const Hash& key_id)
 {
 	assert(m_key_exchanges.count(key_id));
@@ -405,7 +472,10 @@ void EncryptedChat::create_session(const Hash& key_id)
 	
 	m_session_queue.push_back(key_id);
 	m_sessions[key_id].session = std::move(session);
+	m_sessions[key_id].key_exchange_start_time = m_key_exchanges.at(key_id).start_time;
 	m_sessions[key_id].active = false;
+	m_conversation->room()->mutable_statistics().key_exchanges_completed++;
+	m_conversation->room()->trace(TraceEvent::Type::Begin, "session_activation", key_id);
 	for (const auto& i : users) {
 		Identity identity;
 		identity.username = i.username;
@@ -422,7 +492,7 @@ void EncryptedChat::create_session(const Hash& key_id)
 
 void EncryptedChat::prepare_session_replacement(Hash key_id)
 {
-	m_session_ratchet_timer = Timer(m_conversation->room()->interface(), c_session_ratchet_timeout, [key_id, this] {
+	m_session_ratchet_timer = Deadline(m_conversation->deadlines(), c_session_ratchet_timeout, [key_id, this] {
 		if (m_key_exchanges.empty() && m_latest_session_id == key_id) {
 			send_ratchet(key_id);
 		}
@@ -431,6 +501,7 @@ void EncryptedChat::prepare_session_replacement(Hash key_id)
 
 void EncryptedChat::send_ratchet(Hash key_id)
 {
+	m_conversation->room()->trace(TraceEvent::Type::Instant, "send_ratchet", key_id);
 	KeyRatchetMessage message;
 	message.key_id = key_id;
 	m_conversation->send_message(message.encode());
@@ -465,8 +536,11 @@ void EncryptedChat::progress_sessions()
 					}
 				}
 				m_sessions[key_id].active = true;
+				m_conversation->room()->mutable_statistics().activation_time.add(RoomStatistics::now() - data.key_exchange_start_time);
+				m_conversation->room()->trace(TraceEvent::Type::End, "session_activation", key_id);
 				
 				if (!self_active) {
+					m_conversation->room()->trace(TraceEvent::Type::Instant, "joined_chat", key_id);
 					if (m_conversation->interface()) m_conversation->interface()->joined_chat();
 				}
 			}
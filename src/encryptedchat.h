@@ -20,8 +20,10 @@
 #define SRC_ENCRYPTEDCHAT_H_
 
 #include "keyexchange.h"
+#include "participanttable.h"
 #include "session.h"
 #include "timer.h"
+#include "trace.h"
 
 #include <deque>
 #include <map>
@@ -54,6 +56,13 @@ class EncryptedChat
 		return m_sessions.count(key_id) > 0;
 	}
 	std::vector<KeyExchangeState> encode_key_exchanges() const;
+	/*
+	 * Incremented whenever the output of encode_key_exchanges() changes.
+	 */
+	uint64_t key_exchanges_version() const
+	{
+		return m_key_exchanges_version;
+	}
 	bool replacing_session(const Hash& key_id) const;
 	const Hash& latest_session_id() const
 	{
@@ -88,6 +97,11 @@ class EncryptedChat
 	void erase_key_exchange(Hash key_id);
 	
 	void create_key_exchange();
+	/*
+	 * Trace the contribution \p name of \p username to a key exchange
+	 * that was in \p state before it, and the phase it completed if any.
+	 */
+	void trace_contribution(const char* name, const std::string& username, const Hash& key_id, KeyExchange::State state, const TraceTime& start);
 	void create_session(const Hash& key_id);
 	void prepare_session_replacement(Hash key_id);
 	void send_ratchet(Hash key_id);
@@ -123,6 +137,8 @@ class EncryptedChat
 	struct KeyExchangeData
 	{
 		std::unique_ptr<KeyExchange> key_exchange;
+		// RoomStatistics::now() when we learned of the key exchange.
+		uint64_t start_time;
 		// key exchanges are ordered as a linked list, the old-fashioned way.
 		bool has_next;
 		bool has_previous;
@@ -133,6 +149,7 @@ class EncryptedChat
 	struct SessionData
 	{
 		std::unique_ptr<Session> session;
+		uint64_t key_exchange_start_time;
 		bool active;
 		std::set<Identity> participants;
 		std::set<Identity> former_participants;
@@ -141,19 +158,20 @@ class EncryptedChat
 	
 	Conversation* m_conversation;
 	
-	std::map<std::string, Participant> m_participants;
+	ParticipantTable<Participant> m_participants;
 	std::map<Identity, FormerParticipant> m_former_participants;
 	
 	std::map<Hash, KeyExchangeData> m_key_exchanges;
 	// first and last are undefined if m_key_exchanges is empty.
 	Hash m_key_exchange_first;
 	Hash m_key_exchange_last;
+	uint64_t m_key_exchanges_version;
 	
 	std::map<Hash, SessionData> m_sessions;
 	std::deque<Hash> m_session_queue;
 	
 	Hash m_latest_session_id;
-	Timer m_session_ratchet_timer;
+	Deadline m_session_ratchet_timer;
 };
 
 } // namespace np1sec
@@ -21,6 +21,9 @@
 
 #include "crypto.h"
 
+#include <chrono>
+#include <functional>
+
 namespace np1sec
 {
 
@@ -173,6 +176,43 @@ class RoomInterface
 	 */
 	virtual void send_message(const std::string& message) = 0;
 
+	/**
+	 * Capability flag, queried by Room::connect.
+	 *
+	 * Return true if the transport delivers messages byte for byte,
+	 * including NUL and non-UTF-8 bytes. The library then sends messages
+	 * through RoomInterface::send_message in a binary framing that skips
+	 * base64, saving a third of the bandwidth. Room::message_received
+	 * accepts both framings, but every user of the channel must be able
+	 * to receive what the others send, so text-only transports such as
+	 * XMPP must keep the default.
+	 */
+	virtual bool binary_transport() const { return false; }
+
+	/**
+	 * Capability flag, queried by Room::connect.
+	 *
+	 * Return true to have the messages the library sends while processing
+	 * one received message combined into a single call to
+	 * RoomInterface::send_message, which saves per-message overhead such
+	 * as XMPP stanzas. Batches are kept to a few kilobytes, and larger
+	 * ones are split. As with binary_transport, every user of the channel
+	 * must run a version that understands batches.
+	 */
+	virtual bool batch_messages() const { return false; }
+
+	/**
+	 * Capability flag, queried by Room::connect.
+	 *
+	 * Return true to have chat messages larger than a couple of kilobytes
+	 * sent as a run of chunks, each signed and encrypted on its own, which
+	 * bounds the work and memory per message. Chunks are always
+	 * reassembled on receipt, but a version that predates them loses every
+	 * later chat message from the sender, so every user of the channel
+	 * must run a version that understands chunks.
+	 */
+	virtual bool chunk_messages() const { return false; }
+
 	/**
 	 * Used by the library to set timers 
 	 * 
@@ -196,6 +236,47 @@ class RoomInterface
 	 * * After the room creating this token is destroyed
 	 */
 	virtual TimerToken* set_timer(uint32_t interval, TimerCallback* callback) = 0;
+
+	/**
+	 * The current time in milliseconds, on the clock that the intervals
+	 * passed to RoomInterface::set_timer are measured by.
+	 *
+	 * The library uses this to share one timer between many deadlines.
+	 * The default reads std::chrono::steady_clock; hosts whose timers run
+	 * on a different clock, such as a simulated one, must override it.
+	 */
+	virtual uint64_t current_time()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	/**
+	 * Optional executor for CPU-heavy work.
+	 *
+	 * Some steps of a key exchange, such as reconstructing every
+	 * participant's secret share when a key exchange fails, consist of many
+	 * independent Diffie-Hellman computations. If this function returns a
+	 * nonzero number, the library spreads such computations over up to
+	 * that many jobs passed to RoomInterface::execute, in addition to
+	 * the calling thread.
+	 *
+	 * The default of zero keeps all computation on the calling thread.
+	 */
+	virtual size_t executor_concurrency() { return 0; }
+
+	/**
+	 * Run \p job once, asynchronously, on any thread.
+	 *
+	 * The library only calls this when RoomInterface::executor_concurrency
+	 * is nonzero. Jobs never call back into the library or the interface.
+	 * The library does not wait for a job to start; if every worker is
+	 * busy, the calling thread does the work itself, so queueing jobs
+	 * behind other work is harmless. The results are collected on the
+	 * calling thread before the key exchange advances, so no callback ever
+	 * runs on a worker thread.
+	 */
+	virtual void execute(std::function<void()> job) { job(); }
 	
 	/*
 	 * Callbacks
@@ -19,12 +19,96 @@
 #include "keyexchange.h"
 #include "room.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
 namespace np1sec
 {
 
+/*
+ * Runs job(0) to job(count - 1), spreading them over the executor if
+ * there is one. The calling thread takes jobs as well, and returns only
+ * once all of them have run. The first exception thrown by a job is
+ * rethrown here.
+ */
+static void parallel_for(RoomInterface* executor, size_t count, std::function<void(size_t)> job)
+{
+	size_t helpers = 0;
+	if (executor && count > 1) {
+		helpers = std::min(executor->executor_concurrency(), count - 1);
+	}
+	if (helpers == 0) {
+		for (size_t i = 0; i < count; i++) {
+			job(i);
+		}
+		return;
+	}
+	
+	/*
+	 * Helpers may start after all the work is done, so they share
+	 * ownership of the state and never call the job once it is exhausted.
+	 */
+	struct State
+	{
+		std::function<void(size_t)> job;
+		size_t count;
+		std::atomic<size_t> next;
+		
+		std::mutex mutex;
+		std::condition_variable finished;
+		size_t completed;
+		std::exception_ptr exception;
+	};
+	std::shared_ptr<State> state = std::make_shared<State>();
+	state->job = std::move(job);
+	state->count = count;
+	state->next = 0;
+	state->completed = 0;
+	
+	auto work = [] (State& state) {
+		size_t completed = 0;
+		std::exception_ptr exception;
+		for (size_t i = state.next++; i < state.count; i = state.next++) {
+			try {
+				state.job(i);
+			} catch(...) {
+				if (!exception) {
+					exception = std::current_exception();
+				}
+			}
+			completed++;
+		}
+		if (completed > 0) {
+			std::unique_lock<std::mutex> lock(state.mutex);
+			if (exception && !state.exception) {
+				state.exception = exception;
+			}
+			state.completed += completed;
+			if (state.completed == state.count) {
+				state.finished.notify_all();
+			}
+		}
+	};
+	
+	for (size_t i = 0; i < helpers; i++) {
+		executor->execute([state, work] { work(*state); });
+	}
+	work(*state);
+	
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [&] { return state->completed == state->count; });
+	if (state->exception) {
+		std::rethrow_exception(state->exception);
+	}
+}
+
 KeyExchange::KeyExchange(const Hash& key_id, const std::map<std::string, PublicKey>& participants, Room* room):
 	m_key_id(key_id),
 	m_room(room),
+	m_executor(room ? room->interface() : nullptr),
 	m_state(State::PublicKey),
 	m_ephemeral_private_key(PrivateKey::generate(true))
 {
@@ -32,6 +116,7 @@ KeyExchange::KeyExchange(const Hash& key_id, const std::map<std::string, PublicK
 		m_room = nullptr;
 	}
 	
+	m_participants.reserve(participants.size());
 	for (const auto& i : participants) {
 		Participant participant;
 		participant.username = i.first;
@@ -47,7 +132,8 @@ KeyExchange::KeyExchange(const Hash& key_id, const std::map<std::string, PublicK
 }
 
 KeyExchange::KeyExchange(const KeyExchangeState& encoded_state):
-	m_room(nullptr)
+	m_room(nullptr),
+	m_executor(nullptr)
 {
 	m_contributions_remaining = 0;
 	
@@ -416,8 +502,14 @@ void KeyExchange::finish_public_key()
 			return crypto::hash(buffer);
 		};
 		
-		m_right_secret_share = secret_share(right_neighbour);
-		Hash left_secret_share = secret_share(left_neighbour);
+		Hash left_secret_share;
+		parallel_for(m_executor, 2, [&] (size_t i) {
+			if (i == 0) {
+				m_right_secret_share = secret_share(right_neighbour);
+			} else {
+				left_secret_share = secret_share(left_neighbour);
+			}
+		});
 		for (size_t i = 0; i < sizeof(m_secret_share.buffer); i++) {
 			m_secret_share.buffer[i] = m_right_secret_share.buffer[i] ^ left_secret_share.buffer[i];
 		}
@@ -449,8 +541,9 @@ void KeyExchange::finish_secret_share()
 		for (size_t i = 1; i < users.size(); i++) {
 			int prev_index = (my_index + i - 1) % users.size();
 			int next_index = (my_index + i) % users.size();
-			assert(m_participants[users[next_index]].has_secret_share);
-			const Hash& user_share = m_participants[users[next_index]].secret_share;
+			const Participant& participant = (m_participants.begin() + next_index)->second;
+			assert(participant.has_secret_share);
+			const Hash& user_share = participant.secret_share;
 			for (size_t j = 0; j < sizeof(secret_shares[next_index].buffer); j++) {
 				secret_shares[next_index].buffer[j] = secret_shares[prev_index].buffer[j] ^ user_share.buffer[j];
 			}
@@ -499,19 +592,26 @@ void KeyExchange::finish_reveal()
 	assert(m_contributions_remaining == 0);
 	assert(m_malicious_users.empty());
 	
+	/*
+	 * Unserializing the revealed keys and reconstructing the secret shares
+	 * both cost a scalar multiplication or more per participant, and are
+	 * independent of each other.
+	 */
 	std::vector<const Participant*> participants;
-	std::vector<PrivateKey> private_keys;
 	for (const auto& i : m_participants) {
 		participants.push_back(&i.second);
+	}
+	std::vector<PrivateKey> private_keys(participants.size());
+	std::vector<char> valid_private_keys(participants.size(), false);
+	parallel_for(m_executor, participants.size(), [&] (size_t i) {
 		try {
-			PrivateKey private_key = PrivateKey::unserialize(i.second.ephemeral_private_key);
-			private_keys.push_back(private_key);
-			if (private_key.public_key() != i.second.ephemeral_public_key) {
-				m_malicious_users.insert(i.second.username);
-				continue;
-			}
-		} catch(CryptoException) {
-			m_malicious_users.insert(i.second.username);
+			private_keys[i] = PrivateKey::unserialize(participants[i]->ephemeral_private_key);
+			valid_private_keys[i] = private_keys[i].public_key() == participants[i]->ephemeral_public_key;
+		} catch(CryptoException) {}
+	});
+	for (size_t i = 0; i < participants.size(); i++) {
+		if (!valid_private_keys[i]) {
+			m_malicious_users.insert(participants[i]->username);
 		}
 	}
 	if (!m_malicious_users.empty()) {
@@ -519,8 +619,8 @@ void KeyExchange::finish_reveal()
 		return;
 	}
 	
-	std::vector<Hash> right_secret_shares;
-	for (size_t i = 0; i < participants.size(); i++) {
+	std::vector<Hash> right_secret_shares(participants.size());
+	parallel_for(m_executor, participants.size(), [&] (size_t i) {
 		size_t next = (i + 1) % participants.size();
 		Hash token = crypto::reconstruct_triple_diffie_hellman(
 			participants[i]->long_term_public_key,
@@ -531,8 +631,8 @@ void KeyExchange::finish_reveal()
 		std::string buffer;
 		buffer += token.as_string();
 		buffer += m_group_hash.as_string();
-		right_secret_shares.push_back(crypto::hash(buffer));
-	}
+		right_secret_shares[i] = crypto::hash(buffer);
+	});
 	
 	for (size_t i = 0; i < participants.size(); i++) {
 		size_t prev = (i + participants.size() - 1) % participants.size();
@@ -21,6 +21,7 @@
 
 #include "crypto.h"
 #include "message.h"
+#include "participanttable.h"
 
 #include <cassert>
 #include <map>
@@ -30,6 +31,7 @@ namespace np1sec
 {
 
 class Room;
+class RoomInterface;
 
 class KeyExchange
 {
@@ -210,8 +212,10 @@ class KeyExchange
 	};
 	
 	Hash m_key_id;
-	std::map<std::string, Participant> m_participants;
+	ParticipantTable<Participant> m_participants;
 	Room* m_room;
+	/* Runs the independent computations of finish_public_key and finish_reveal; may be null. */
+	RoomInterface* m_executor;
 	
 	State m_state;
 	int m_contributions_remaining;
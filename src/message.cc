@@ -26,6 +26,10 @@ namespace np1sec
 {
 
 const std::string c_np1sec_protocol_name(":o3np1sec0:");
+/*
+ * Binary messages start with a NUL byte, which no text message can.
+ */
+const std::string c_np1sec_binary_protocol_name(std::string(1, '\0') + "o3np1sec0");
 
 
 
@@ -47,7 +51,7 @@ void encode_integer(MessageBuffer* buffer, T value)
 }
 
 template<typename T>
-T decode_integer(MessageBuffer* buffer)
+T decode_integer(MessageReader* buffer)
 {
 	int shift = 0;
 	T result = 0;
@@ -100,88 +104,141 @@ void MessageBuffer::add_opaque(const std::string& buffer)
 	append(buffer);
 }
 
-void MessageBuffer::check_empty()
+void MessageReader::check_empty()
 {
 	if (!empty()) {
 		throw MessageFormatException();
 	}
 }
 
-bool MessageBuffer::remove_bit()
+bool MessageReader::remove_bit()
 {
 	return remove_byte() != 0;
 }
 
-uint8_t MessageBuffer::remove_byte()
+uint8_t MessageReader::remove_byte()
 {
-	if (size() < 1) {
+	if (m_size < 1) {
 		throw MessageFormatException();
 	}
 	
-	uint8_t result = byte(0);
+	uint8_t result = (uint8_t)(*m_data);
 	
-	erase(0, 1);
+	m_data++;
+	m_size--;
 	
 	return result;
 }
 
-uint64_t MessageBuffer::remove_integer()
+uint64_t MessageReader::remove_integer()
 {
 	return decode_integer<uint64_t>(this);
 }
 
-std::string MessageBuffer::remove_bytes(size_t size)
+std::string MessageReader::remove_bytes(size_t size)
+{
+	MessageReader reader = remove_reader(size);
+	return std::string(reader.m_data, reader.m_size);
+}
+
+std::string MessageReader::remove_opaque()
+{
+	return remove_bytes(remove_integer());
+}
+
+std::string MessageReader::remove_remaining()
+{
+	return remove_bytes(m_size);
+}
+
+MessageReader MessageReader::remove_reader(size_t size)
 {
-	if (this->size() < size) {
+	if (m_size < size) {
 		throw MessageFormatException();
 	}
 	
-	std::string result(*this, 0, size);
+	MessageReader result(m_data, size);
 	
-	erase(0, size);
+	m_data += size;
+	m_size -= size;
 	
 	return result;
 }
 
-std::string MessageBuffer::remove_opaque()
+MessageReader MessageReader::remove_opaque_reader()
 {
-	return remove_bytes(remove_integer());
+	return remove_reader(remove_integer());
 }
 
 
 
 std::string Message::encode() const
 {
-	MessageBuffer buffer;
-	buffer.add_byte(uint8_t(type));
-	buffer.add_bytes(payload);
-	
-	char* base64_buffer = new char[((buffer.size() + 3 - 1) / 3) * 4];
-	size_t base64_size = base64_encode(base64_buffer, reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size());
-	std::string base64_encoded(base64_buffer, base64_size);
-	delete[] base64_buffer;
+	/*
+	 * The encoded message is the protocol name followed by the base64
+	 * encoding of the type byte and the payload. The first base64 block
+	 * holds the type byte and the first two bytes of the payload, after
+	 * which the payload can be encoded in place.
+	 */
+	size_t size = 1 + payload.size();
+	std::string result(c_np1sec_protocol_name.size() + ((size + 2) / 3) * 4, '\0');
+	result.replace(0, c_np1sec_protocol_name.size(), c_np1sec_protocol_name);
+	char* output = &result[c_np1sec_protocol_name.size()];
+	
+	unsigned char head[3];
+	size_t head_size = size < 3 ? size : 3;
+	head[0] = uint8_t(type);
+	for (size_t i = 1; i < head_size; i++) {
+		head[i] = payload[i - 1];
+	}
+	output += base64_encode(output, head, head_size);
+	if (size > 3) {
+		base64_encode(output, reinterpret_cast<const unsigned char*>(payload.data()) + 2, payload.size() - 2);
+	}
 	
-	std::string result = c_np1sec_protocol_name;
-	result.append(base64_encoded);
+	return result;
+}
+
+std::string Message::encode_binary() const
+{
+	std::string result;
+	result.reserve(c_np1sec_binary_protocol_name.size() + 1 + payload.size());
+	result += c_np1sec_binary_protocol_name;
+	result += char(uint8_t(type));
+	result += payload;
 	return result;
 }
 
 Message Message::decode(const std::string& encoded)
 {
-	if (encoded.substr(0, c_np1sec_protocol_name.size()) != c_np1sec_protocol_name) {
+	if (encoded.compare(0, c_np1sec_binary_protocol_name.size(), c_np1sec_binary_protocol_name) == 0) {
+		if (encoded.size() < c_np1sec_binary_protocol_name.size() + 1) {
+			throw MessageFormatException();
+		}
+		Message message;
+		message.type = Message::Type(uint8_t(encoded[c_np1sec_binary_protocol_name.size()]));
+		message.payload = encoded.substr(c_np1sec_binary_protocol_name.size() + 1);
+		return message;
+	}
+	
+	if (encoded.compare(0, c_np1sec_protocol_name.size(), c_np1sec_protocol_name) != 0) {
 		throw MessageFormatException();
 	}
-	std::string base64_payload = encoded.substr(c_np1sec_protocol_name.size());
-	unsigned char* base64_buffer = new unsigned char[((base64_payload.size() + 4 - 1) / 4) * 3];
-	size_t base64_size = base64_decode(base64_buffer, base64_payload.data(), base64_payload.size());
-	std::string base64_decoded(reinterpret_cast<char *>(base64_buffer), base64_size);
-	delete[] base64_buffer;
-	// TODO: reject malformed base64 for strict compatibility
-	
-	MessageBuffer buffer(base64_decoded);
+	const char* base64_payload = encoded.data() + c_np1sec_protocol_name.size();
+	size_t base64_size = encoded.size() - c_np1sec_protocol_name.size();
+	
 	Message message;
-	message.type = Message::Type(buffer.remove_byte());
-	message.payload = buffer;
+	message.payload.resize(((base64_size + 4 - 1) / 4) * 3);
+	size_t size;
+	if (!base64_decode(reinterpret_cast<unsigned char*>(&message.payload[0]), base64_payload, base64_size, &size)) {
+		throw MessageFormatException();
+	}
+	if (size < 1) {
+		throw MessageFormatException();
+	}
+	message.type = Message::Type(uint8_t(message.payload[0]));
+	message.payload.resize(size);
+	message.payload.erase(0, 1);
 	
 	return message;
 }
@@ -210,6 +267,7 @@ bool Message::is_conversation_message(Type type)
 		|| type == Type::KeyActivation
 		|| type == Type::KeyRatchet
 		|| type == Type::Chat
+		|| type == Type::ChatChunk
 	;
 }
 
@@ -231,34 +289,38 @@ Message ConversationMessage::sign(const UnsignedConversationMessage& message, co
 
 ConversationMessage ConversationMessage::decode(const Message& encoded)
 {
-	MessageBuffer buffer(encoded.payload);
+	MessageReader buffer(encoded.payload);
 	
 	ConversationMessage result;
 	result.type = encoded.type;
 	result.conversation_public_key = buffer.remove_public_key();
 	result.signature = buffer.remove_signature();
-	result.payload = buffer;
+	result.payload = buffer.remove_remaining();
 	return result;
 }
 
-bool ConversationMessage::verify() const
+std::string ConversationMessage::signed_body() const
 {
 	std::string signed_body;
 	signed_body.push_back(uint8_t(type));
 	signed_body += payload;
-	
-	return crypto::verify(std::move(signed_body), signature, conversation_public_key);
+	return signed_body;
+}
+
+bool ConversationMessage::verify() const
+{
+	return crypto::verify(signed_body(), signature, conversation_public_key);
 }
 
 
 
 template<class MessageType>
-static MessageBuffer get_message_payload(const MessageType& message, Message::Type expected_type)
+static const std::string& get_message_payload(const MessageType& message, Message::Type expected_type)
 {
 	if (message.type != expected_type) {
 		throw MessageFormatException();
 	}
-	return MessageBuffer(message.payload);
+	return message.payload;
 }
 
 static MessageBuffer encode_user_set(const ConversationStatusMessage& status, bool include_invites, const std::set<std::string>& users)
@@ -300,9 +362,8 @@ static MessageBuffer encode_user_set(const ConversationStatusMessage& status, bo
 	return buffer;
 }
 
-static std::set<std::string> decode_user_set(const ConversationStatusMessage& status, bool include_invites, const std::string& encoded)
+static std::set<std::string> decode_user_set(const ConversationStatusMessage& status, bool include_invites, MessageReader buffer)
 {
-	MessageBuffer buffer(encoded);
 	std::set<std::string> output;
 	uint8_t byte = 0;
 	int bits = 0;
@@ -366,7 +427,7 @@ Message QuitMessage::encode() const
 
 QuitMessage QuitMessage::decode(const Message& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::Quit));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::Quit));
 	
 	QuitMessage result;
 	result.nonce = buffer.remove_hash();
@@ -389,7 +450,7 @@ Message HelloMessage::encode() const
 
 HelloMessage HelloMessage::decode(const Message& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::Hello));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::Hello));
 	
 	HelloMessage result;
 	result.long_term_public_key = buffer.remove_public_key();
@@ -413,7 +474,7 @@ Message RoomAuthenticationRequestMessage::encode() const
 
 RoomAuthenticationRequestMessage RoomAuthenticationRequestMessage::decode(const Message& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::RoomAuthenticationRequest));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::RoomAuthenticationRequest));
 	
 	RoomAuthenticationRequestMessage result;
 	result.username = buffer.remove_opaque();
@@ -433,7 +494,7 @@ Message RoomAuthenticationMessage::encode() const
 
 RoomAuthenticationMessage RoomAuthenticationMessage::decode(const Message& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::RoomAuthentication));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::RoomAuthentication));
 	
 	RoomAuthenticationMessage result;
 	result.username = buffer.remove_opaque();
@@ -442,6 +503,35 @@ RoomAuthenticationMessage RoomAuthenticationMessage::decode(const Message& encod
 	return result;
 }
 
+Message BatchMessage::encode() const
+{
+	MessageBuffer buffer;
+	for (const Message& message : messages) {
+		assert(message.type != Message::Type::Batch);
+		buffer.add_byte(uint8_t(message.type));
+		buffer.add_opaque(message.payload);
+	}
+	
+	return Message(Message::Type::Batch, buffer);
+}
+
+BatchMessage BatchMessage::decode(const Message& encoded)
+{
+	MessageReader buffer(get_message_payload(encoded, Message::Type::Batch));
+	
+	BatchMessage result;
+	while (!buffer.empty()) {
+		Message message;
+		message.type = Message::Type(buffer.remove_byte());
+		if (message.type == Message::Type::Batch) {
+			throw MessageFormatException();
+		}
+		message.payload = buffer.remove_opaque();
+		result.messages.push_back(std::move(message));
+	}
+	return result;
+}
+
 UnsignedConversationMessage InviteMessage::encode() const
 {
 	MessageBuffer buffer;
@@ -453,7 +543,7 @@ UnsignedConversationMessage InviteMessage::encode() const
 
 InviteMessage InviteMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::Invite));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::Invite));
 	
 	InviteMessage result;
 	result.username = buffer.remove_opaque();
@@ -463,10 +553,21 @@ InviteMessage InviteMessage::decode(const UnsignedConversationMessage& encoded)
 }
 
 UnsignedConversationMessage ConversationStatusMessage::encode() const
+{
+	return encode_sections(
+		invitee_username,
+		invitee_long_term_public_key,
+		encode_membership(),
+		conversation_status_hash,
+		latest_session_id,
+		encode_key_exchanges(),
+		encode_events()
+	);
+}
+
+std::string ConversationStatusMessage::encode_membership() const
 {
 	MessageBuffer buffer;
-	buffer.add_opaque(invitee_username);
-	buffer.add_public_key(invitee_long_term_public_key);
 	
 	MessageBuffer participants_buffer;
 	for (const Participant& participant : participants) {
@@ -509,38 +610,68 @@ UnsignedConversationMessage ConversationStatusMessage::encode() const
 	buffer.add_opaque(timeout_buffer);
 	buffer.add_opaque(votekick_buffer);
 	
-	buffer.add_hash(conversation_status_hash);
-	buffer.add_hash(latest_session_id);
-	
+	return buffer;
+}
+
+std::string ConversationStatusMessage::encode_key_exchanges() const
+{
 	MessageBuffer key_exchange_buffer;
 	for (const KeyExchangeState& exchange : key_exchanges) {
 		key_exchange_buffer.add_hash(exchange.key_id);
 		key_exchange_buffer.add_byte(uint8_t(exchange.state));
 		key_exchange_buffer.add_opaque(exchange.payload);
 	}
-	buffer.add_opaque(key_exchange_buffer);
 	
+	MessageBuffer buffer;
+	buffer.add_opaque(key_exchange_buffer);
+	return buffer;
+}
+
+std::string ConversationStatusMessage::encode_events() const
+{
 	MessageBuffer event_buffer;
 	for (const ConversationEvent& event : events) {
 		event_buffer.add_byte(uint8_t(event.type));
 		event_buffer.add_opaque(event.payload);
 	}
+	
+	MessageBuffer buffer;
 	buffer.add_opaque(event_buffer);
+	return buffer;
+}
+
+UnsignedConversationMessage ConversationStatusMessage::encode_sections(
+	const std::string& invitee_username,
+	const PublicKey& invitee_long_term_public_key,
+	const std::string& membership,
+	const Hash& conversation_status_hash,
+	const Hash& latest_session_id,
+	const std::string& key_exchanges,
+	const std::string& events
+) {
+	MessageBuffer buffer;
+	buffer.add_opaque(invitee_username);
+	buffer.add_public_key(invitee_long_term_public_key);
+	buffer.add_bytes(membership);
+	buffer.add_hash(conversation_status_hash);
+	buffer.add_hash(latest_session_id);
+	buffer.add_bytes(key_exchanges);
+	buffer.add_bytes(events);
 	
 	return UnsignedConversationMessage(Message::Type::ConversationStatus, buffer);
 }
 
 ConversationStatusMessage ConversationStatusMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::ConversationStatus));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::ConversationStatus));
 	
 	ConversationStatusMessage result;
 	result.invitee_username = buffer.remove_opaque();
 	result.invitee_long_term_public_key = buffer.remove_public_key();
 	
-	MessageBuffer participants_buffer = buffer.remove_opaque();
+	MessageReader participants_buffer = buffer.remove_opaque_reader();
 	while (!participants_buffer.empty()) {
-		MessageBuffer participant_buffer = participants_buffer.remove_opaque();
+		MessageReader participant_buffer = participants_buffer.remove_opaque_reader();
 		Participant participant;
 		participant.username = participant_buffer.remove_opaque();
 		participant.long_term_public_key = participant_buffer.remove_public_key();
@@ -549,9 +680,9 @@ ConversationStatusMessage ConversationStatusMessage::decode(const UnsignedConver
 		result.participants.push_back(participant);
 	}
 	
-	MessageBuffer confirmed_invites_buffer = buffer.remove_opaque();
+	MessageReader confirmed_invites_buffer = buffer.remove_opaque_reader();
 	while (!confirmed_invites_buffer.empty()) {
-		MessageBuffer invite_buffer = confirmed_invites_buffer.remove_opaque();
+		MessageReader invite_buffer = confirmed_invites_buffer.remove_opaque_reader();
 		ConfirmedInvite invite;
 		invite.inviter = invite_buffer.remove_opaque();
 		invite.username = invite_buffer.remove_opaque();
@@ -562,9 +693,9 @@ ConversationStatusMessage ConversationStatusMessage::decode(const UnsignedConver
 		result.confirmed_invites.push_back(invite);
 	}
 	
-	MessageBuffer unconfirmed_invites_buffer = buffer.remove_opaque();
+	MessageReader unconfirmed_invites_buffer = buffer.remove_opaque_reader();
 	while (!unconfirmed_invites_buffer.empty()) {
-		MessageBuffer invite_buffer = unconfirmed_invites_buffer.remove_opaque();
+		MessageReader invite_buffer = unconfirmed_invites_buffer.remove_opaque_reader();
 		UnconfirmedInvite invite;
 		invite.inviter = invite_buffer.remove_opaque();
 		invite.username = invite_buffer.remove_opaque();
@@ -573,17 +704,17 @@ ConversationStatusMessage ConversationStatusMessage::decode(const UnsignedConver
 		result.unconfirmed_invites.push_back(invite);
 	}
 	
-	MessageBuffer timeout_buffer = buffer.remove_opaque();
-	MessageBuffer votekick_buffer = buffer.remove_opaque();
+	MessageReader timeout_buffer = buffer.remove_opaque_reader();
+	MessageReader votekick_buffer = buffer.remove_opaque_reader();
 	for (Participant& participant : result.participants) {
-		participant.timeout_peers = decode_user_set(result, true, timeout_buffer.remove_opaque());
-		participant.votekick_peers = decode_user_set(result, true, votekick_buffer.remove_opaque());
+		participant.timeout_peers = decode_user_set(result, true, timeout_buffer.remove_opaque_reader());
+		participant.votekick_peers = decode_user_set(result, true, votekick_buffer.remove_opaque_reader());
 	}
 	
 	result.conversation_status_hash = buffer.remove_hash();
 	result.latest_session_id = buffer.remove_hash();
 	
-	MessageBuffer key_exchange_buffer = buffer.remove_opaque();
+	MessageReader key_exchange_buffer = buffer.remove_opaque_reader();
 	while (!key_exchange_buffer.empty()) {
 		KeyExchangeState exchange;
 		exchange.key_id = key_exchange_buffer.remove_hash();
@@ -592,7 +723,7 @@ ConversationStatusMessage ConversationStatusMessage::decode(const UnsignedConver
 		result.key_exchanges.push_back(std::move(exchange));
 	}
 	
-	MessageBuffer event_buffer = buffer.remove_opaque();
+	MessageReader event_buffer = buffer.remove_opaque_reader();
 	while (!event_buffer.empty()) {
 		ConversationEvent event;
 		event.type = Message::Type(event_buffer.remove_byte());
@@ -616,7 +747,7 @@ UnsignedConversationMessage ConversationConfirmationMessage::encode() const
 
 ConversationConfirmationMessage ConversationConfirmationMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::ConversationConfirmation));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::ConversationConfirmation));
 	
 	ConversationConfirmationMessage result;
 	result.invitee_username = buffer.remove_opaque();
@@ -639,7 +770,7 @@ UnsignedConversationMessage InviteAcceptanceMessage::encode() const
 
 InviteAcceptanceMessage InviteAcceptanceMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::InviteAcceptance));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::InviteAcceptance));
 	
 	InviteAcceptanceMessage result;
 	result.my_long_term_public_key = buffer.remove_public_key();
@@ -661,7 +792,7 @@ UnsignedConversationMessage AuthenticationRequestMessage::encode() const
 
 AuthenticationRequestMessage AuthenticationRequestMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::AuthenticationRequest));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::AuthenticationRequest));
 	
 	AuthenticationRequestMessage result;
 	result.username = buffer.remove_opaque();
@@ -681,7 +812,7 @@ UnsignedConversationMessage AuthenticationMessage::encode() const
 
 AuthenticationMessage AuthenticationMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::Authentication));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::Authentication));
 	
 	AuthenticationMessage result;
 	result.username = buffer.remove_opaque();
@@ -702,7 +833,7 @@ UnsignedConversationMessage AuthenticateInviteMessage::encode() const
 
 AuthenticateInviteMessage AuthenticateInviteMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::AuthenticateInvite));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::AuthenticateInvite));
 	
 	AuthenticateInviteMessage result;
 	result.username = buffer.remove_opaque();
@@ -723,7 +854,7 @@ UnsignedConversationMessage CancelInviteMessage::encode() const
 
 CancelInviteMessage CancelInviteMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::CancelInvite));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::CancelInvite));
 	
 	CancelInviteMessage result;
 	result.username = buffer.remove_opaque();
@@ -741,7 +872,7 @@ UnsignedConversationMessage JoinMessage::encode() const
 
 JoinMessage JoinMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::Join));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::Join));
 	
 	JoinMessage result;
 	buffer.check_empty();
@@ -757,7 +888,7 @@ UnsignedConversationMessage LeaveMessage::encode() const
 
 LeaveMessage LeaveMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::Leave));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::Leave));
 	
 	LeaveMessage result;
 	buffer.check_empty();
@@ -773,7 +904,7 @@ UnsignedConversationMessage ConsistencyStatusMessage::encode() const
 
 ConsistencyStatusMessage ConsistencyStatusMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::ConsistencyStatus));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::ConsistencyStatus));
 	
 	ConsistencyStatusMessage result;
 	buffer.check_empty();
@@ -791,7 +922,7 @@ UnsignedConversationMessage ConsistencyCheckMessage::encode() const
 
 ConsistencyCheckMessage ConsistencyCheckMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::ConsistencyCheck));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::ConsistencyCheck));
 	
 	ConsistencyCheckMessage result;
 	result.conversation_status_hash = buffer.remove_hash();
@@ -810,7 +941,7 @@ UnsignedConversationMessage TimeoutMessage::encode() const
 
 TimeoutMessage TimeoutMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::Timeout));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::Timeout));
 	
 	TimeoutMessage result;
 	result.victim = buffer.remove_opaque();
@@ -830,7 +961,7 @@ UnsignedConversationMessage VotekickMessage::encode() const
 
 VotekickMessage VotekickMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::Votekick));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::Votekick));
 	
 	VotekickMessage result;
 	result.victim = buffer.remove_opaque();
@@ -850,7 +981,7 @@ UnsignedConversationMessage KeyExchangePublicKeyMessage::encode() const
 
 KeyExchangePublicKeyMessage KeyExchangePublicKeyMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::KeyExchangePublicKey));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::KeyExchangePublicKey));
 	
 	KeyExchangePublicKeyMessage result;
 	result.key_id = buffer.remove_hash();
@@ -871,7 +1002,7 @@ UnsignedConversationMessage KeyExchangeSecretShareMessage::encode() const
 
 KeyExchangeSecretShareMessage KeyExchangeSecretShareMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::KeyExchangeSecretShare));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::KeyExchangeSecretShare));
 	
 	KeyExchangeSecretShareMessage result;
 	result.key_id = buffer.remove_hash();
@@ -892,7 +1023,7 @@ UnsignedConversationMessage KeyExchangeAcceptanceMessage::encode() const
 
 KeyExchangeAcceptanceMessage KeyExchangeAcceptanceMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::KeyExchangeAcceptance));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::KeyExchangeAcceptance));
 	
 	KeyExchangeAcceptanceMessage result;
 	result.key_id = buffer.remove_hash();
@@ -912,7 +1043,7 @@ UnsignedConversationMessage KeyExchangeRevealMessage::encode() const
 
 KeyExchangeRevealMessage KeyExchangeRevealMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::KeyExchangeReveal));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::KeyExchangeReveal));
 	
 	KeyExchangeRevealMessage result;
 	result.key_id = buffer.remove_hash();
@@ -931,7 +1062,7 @@ UnsignedConversationMessage KeyActivationMessage::encode() const
 
 KeyActivationMessage KeyActivationMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::KeyActivation));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::KeyActivation));
 	
 	KeyActivationMessage result;
 	result.key_id = buffer.remove_hash();
@@ -949,7 +1080,7 @@ UnsignedConversationMessage KeyRatchetMessage::encode() const
 
 KeyRatchetMessage KeyRatchetMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::KeyRatchet));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::KeyRatchet));
 	
 	KeyRatchetMessage result;
 	result.key_id = buffer.remove_hash();
@@ -965,29 +1096,31 @@ UnsignedConversationMessage ChatMessage::encode() const
 	buffer.add_hash(key_id);
 	buffer.add_bytes(encrypted_payload);
 	
-	return UnsignedConversationMessage(Message::Type::Chat, buffer);
+	return UnsignedConversationMessage(partial ? Message::Type::ChatChunk : Message::Type::Chat, buffer);
 }
 
 ChatMessage ChatMessage::decode(const UnsignedConversationMessage& encoded)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::Chat));
+	bool partial = encoded.type == Message::Type::ChatChunk;
+	MessageReader buffer(get_message_payload(encoded, partial ? Message::Type::ChatChunk : Message::Type::Chat));
 	
 	ChatMessage result;
+	result.partial = partial;
 	result.key_id = buffer.remove_hash();
-	result.encrypted_payload = buffer;
+	result.encrypted_payload = buffer.remove_remaining();
 	return result;
 }
 
-std::string ChatMessage::decrypt(const SymmetricKey& symmetric_key) const
+std::string ChatMessage::decrypt(SymmetricCipher& cipher) const
 {
-	return crypto::decrypt(encrypted_payload, symmetric_key);
+	return cipher.decrypt(encrypted_payload);
 }
 
-ChatMessage ChatMessage::encrypt(std::string plaintext, const Hash& key_id, const SymmetricKey& symmetric_key)
+ChatMessage ChatMessage::encrypt(const std::string& plaintext, const Hash& key_id, SymmetricCipher& cipher)
 {
 	ChatMessage result;
 	result.key_id = key_id;
-	result.encrypted_payload = crypto::encrypt(plaintext, symmetric_key);
+	result.encrypted_payload = cipher.encrypt(plaintext);
 	return result;
 }
 
@@ -1012,12 +1145,12 @@ std::string PlaintextChatMessage::sign(const UnsignedChatMessage& message, const
 
 PlaintextChatMessage PlaintextChatMessage::decode(const std::string& encoded)
 {
-	MessageBuffer buffer(encoded);
+	MessageReader buffer(encoded);
 	
 	PlaintextChatMessage result;
 	result.signature = buffer.remove_signature();
 	result.message_id = buffer.remove_integer();
-	result.message = buffer;
+	result.message = buffer.remove_remaining();
 	return result;
 }
 
@@ -1043,7 +1176,7 @@ ConversationEvent ConversationStatusEvent::encode(const ConversationStatusMessag
 
 ConversationStatusEvent ConversationStatusEvent::decode(const ConversationEvent& encoded, const ConversationStatusMessage& status)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::ConversationStatus));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::ConversationStatus));
 	
 	ConversationStatusEvent result;
 	result.invitee_username = buffer.remove_opaque();
@@ -1067,13 +1200,13 @@ ConversationEvent ConversationConfirmationEvent::encode(const ConversationStatus
 
 ConversationConfirmationEvent ConversationConfirmationEvent::decode(const ConversationEvent& encoded, const ConversationStatusMessage& status)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::ConversationConfirmation));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::ConversationConfirmation));
 	
 	ConversationConfirmationEvent result;
 	result.invitee_username = buffer.remove_opaque();
 	result.invitee_long_term_public_key = buffer.remove_public_key();
 	result.status_message_hash = buffer.remove_hash();
-	result.remaining_users = decode_user_set(status, true, buffer.remove_opaque());
+	result.remaining_users = decode_user_set(status, true, buffer.remove_opaque_reader());
 	buffer.check_empty();
 	return result;
 }
@@ -1089,11 +1222,11 @@ ConversationEvent ConsistencyCheckEvent::encode(const ConversationStatusMessage&
 
 ConsistencyCheckEvent ConsistencyCheckEvent::decode(const ConversationEvent& encoded, const ConversationStatusMessage& status)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::ConsistencyCheck));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::ConsistencyCheck));
 	
 	ConsistencyCheckEvent result;
 	result.conversation_status_hash = buffer.remove_hash();
-	result.remaining_users = decode_user_set(status, true, buffer.remove_opaque());
+	result.remaining_users = decode_user_set(status, true, buffer.remove_opaque_reader());
 	buffer.check_empty();
 	return result;
 }
@@ -1126,14 +1259,14 @@ KeyExchangeEvent KeyExchangeEvent::decode(const ConversationEvent& encoded, cons
 	)) {
 		throw MessageFormatException();
 	}
-	MessageBuffer buffer(encoded.payload);
+	MessageReader buffer(encoded.payload);
 	
 	KeyExchangeEvent result;
 	result.type = encoded.type;
 	result.key_id = buffer.remove_hash();
 	result.cancelled = buffer.remove_bit();
 	if (result.cancelled) {
-		result.remaining_users = decode_user_set(status, false, buffer.remove_opaque());
+		result.remaining_users = decode_user_set(status, false, buffer.remove_opaque_reader());
 	}
 	buffer.check_empty();
 	return result;
@@ -1150,11 +1283,11 @@ ConversationEvent KeyActivationEvent::encode(const ConversationStatusMessage& st
 
 KeyActivationEvent KeyActivationEvent::decode(const ConversationEvent& encoded, const ConversationStatusMessage& status)
 {
-	MessageBuffer buffer(get_message_payload(encoded, Message::Type::KeyActivation));
+	MessageReader buffer(get_message_payload(encoded, Message::Type::KeyActivation));
 	
 	KeyActivationEvent result;
 	result.key_id = buffer.remove_hash();
-	result.remaining_users = decode_user_set(status, false, buffer.remove_opaque());
+	result.remaining_users = decode_user_set(status, false, buffer.remove_opaque_reader());
 	buffer.check_empty();
 	return result;
 }
@@ -1171,7 +1304,7 @@ void PublicKeyParticipant::encode_to(MessageBuffer* buffer) const
 	}
 }
 
-PublicKeyParticipant PublicKeyParticipant::decode_from(MessageBuffer* buffer)
+PublicKeyParticipant PublicKeyParticipant::decode_from(MessageReader* buffer)
 {
 	PublicKeyParticipant result;
 	result.username = buffer->remove_opaque();
@@ -1194,7 +1327,7 @@ void SecretShareParticipant::encode_to(MessageBuffer* buffer) const
 	}
 }
 
-SecretShareParticipant SecretShareParticipant::decode_from(MessageBuffer* buffer)
+SecretShareParticipant SecretShareParticipant::decode_from(MessageReader* buffer)
 {
 	SecretShareParticipant result;
 	result.username = buffer->remove_opaque();
@@ -1219,7 +1352,7 @@ void AcceptanceParticipant::encode_to(MessageBuffer* buffer) const
 	}
 }
 
-AcceptanceParticipant AcceptanceParticipant::decode_from(MessageBuffer* buffer)
+AcceptanceParticipant AcceptanceParticipant::decode_from(MessageReader* buffer)
 {
 	AcceptanceParticipant result;
 	result.username = buffer->remove_opaque();
@@ -1246,7 +1379,7 @@ void RevealParticipant::encode_to(MessageBuffer* buffer) const
 	}
 }
 
-RevealParticipant RevealParticipant::decode_from(MessageBuffer* buffer)
+RevealParticipant RevealParticipant::decode_from(MessageReader* buffer)
 {
 	RevealParticipant result;
 	result.username = buffer->remove_opaque();
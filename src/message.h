@@ -20,6 +20,7 @@
 #define SRC_MESSAGE_H_
 
 #include <cstdint>
+#include <cstring>
 #include <set>
 #include <string>
 #include <vector>
@@ -55,6 +56,23 @@ class MessageBuffer : public std::string
 	void add_signature(const Signature& signature) { add_byte_array(signature); }
 	void add_bytes(const std::string& buffer);
 	void add_opaque(const std::string& buffer);
+};
+
+/*
+ * Read cursor over an encoded message. A reader does not own the data it
+ * reads, which must outlive it; reading advances the cursor without
+ * modifying or copying the underlying buffer.
+ */
+class MessageReader
+{
+	public:
+	MessageReader(): m_data(nullptr), m_size(0) {}
+	MessageReader(const std::string& buffer): m_data(buffer.data()), m_size(buffer.size()) {}
+	MessageReader(const char* data, size_t size): m_data(data), m_size(size) {}
+	MessageReader(std::string&& buffer) = delete;
+	
+	bool empty() const { return m_size == 0; }
+	size_t size() const { return m_size; }
 	
 	void check_empty();
 	bool remove_bit();
@@ -63,16 +81,15 @@ class MessageBuffer : public std::string
 	
 	template<int n> ByteArray<n> remove_byte_array()
 	{
-		if (size() < n) {
+		if (m_size < n) {
 			throw MessageFormatException();
 		}
 		
 		ByteArray<n> result;
-		for (int i = 0; i < n; i++) {
-			result.buffer[i] = at(i);
-		}
+		memcpy(result.buffer, m_data, n);
 		
-		erase(0, n);
+		m_data += n;
+		m_size -= n;
 		
 		return result;
 	}
@@ -83,6 +100,18 @@ class MessageBuffer : public std::string
 	Signature remove_signature() { return remove_byte_array<c_signature_length>(); }
 	std::string remove_bytes(size_t size);
 	std::string remove_opaque();
+	std::string remove_remaining();
+	
+	/*
+	 * Like remove_bytes() and remove_opaque(), but return a reader over
+	 * the removed bytes instead of a copy.
+	 */
+	MessageReader remove_reader(size_t size);
+	MessageReader remove_opaque_reader();
+	
+	protected:
+	const char* m_data;
+	size_t m_size;
 };
 
 
@@ -94,6 +123,7 @@ struct Message
 		Hello = 0x02,
 		RoomAuthenticationRequest = 0x03,
 		RoomAuthentication = 0x04,
+		Batch = 0x05,
 		
 		Invite = 0x11,
 		ConversationStatus = 0x12,
@@ -119,6 +149,7 @@ struct Message
 		KeyActivation = 0x41,
 		KeyRatchet = 0x42,
 		Chat = 0x43,
+		ChatChunk = 0x44,
 	};
 	
 	Message() {}
@@ -127,7 +158,14 @@ struct Message
 	Type type;
 	std::string payload;
 	
+	/*
+	 * Messages are normally sent as text: the protocol name followed by
+	 * the base64 encoding of the type and payload. Transports that carry
+	 * arbitrary bytes can use the binary framing instead, which sends the
+	 * type and payload as they are. Decoding accepts either.
+	 */
 	std::string encode() const;
+	std::string encode_binary() const;
 	static Message decode(const std::string& encoded);
 	
 	static bool is_conversation_message(Type type);
@@ -149,6 +187,7 @@ struct ConversationMessage : public UnsignedConversationMessage
 	
 	static Message sign(const UnsignedConversationMessage& message, const PrivateKey& key);
 	static ConversationMessage decode(const Message& encoded);
+	std::string signed_body() const;
 	bool verify() const;
 };
 
@@ -202,7 +241,7 @@ struct ParticipantKeyExchangeState
 		}
 		ParticipantKeyExchangeState result;
 		result.key_id = encoded.key_id;
-		MessageBuffer buffer(encoded.payload);
+		MessageReader buffer(encoded.payload);
 		while (!buffer.empty()) {
 			result.participants.push_back(ParticipantState::decode_from(&buffer));
 		}
@@ -249,6 +288,18 @@ struct RoomAuthenticationMessage
 	static RoomAuthenticationMessage decode(const Message& encoded);
 };
 
+/*
+ * Several messages sent as one, to save the transport the overhead of
+ * each. Batches do not nest.
+ */
+struct BatchMessage
+{
+	std::vector<Message> messages;
+	
+	Message encode() const;
+	static BatchMessage decode(const Message& encoded);
+};
+
 
 
 struct InviteMessage
@@ -302,6 +353,27 @@ struct ConversationStatusMessage
 	
 	UnsignedConversationMessage encode() const;
 	static ConversationStatusMessage decode(const UnsignedConversationMessage& encoded);
+	
+	/*
+	 * The encoded status consists of independently encoded sections for the
+	 * membership (participants, invites, and timeout/votekick sets), the key
+	 * exchanges, and the events. Callers that know which parts of the status
+	 * did not change can cache these sections and reassemble them using
+	 * encode_sections(), which produces output identical to encode().
+	 * Events are encoded relative to the membership section.
+	 */
+	std::string encode_membership() const;
+	std::string encode_key_exchanges() const;
+	std::string encode_events() const;
+	static UnsignedConversationMessage encode_sections(
+		const std::string& invitee_username,
+		const PublicKey& invitee_long_term_public_key,
+		const std::string& membership,
+		const Hash& conversation_status_hash,
+		const Hash& latest_session_id,
+		const std::string& key_exchanges,
+		const std::string& events
+	);
 };
 
 struct ConversationConfirmationMessage
@@ -467,16 +539,22 @@ struct KeyRatchetMessage
 
 
 
+/*
+ * A chat message too large for one message is sent as a run of partial
+ * messages, each encrypted and signed on its own, followed by a final one.
+ * Partial messages are sent as ChatChunk.
+ */
 struct ChatMessage
 {
 	Hash key_id;
+	bool partial = false;
 	std::string encrypted_payload;
 	
 	UnsignedConversationMessage encode() const;
 	static ChatMessage decode(const UnsignedConversationMessage& encoded);
 	
-	std::string decrypt(const SymmetricKey& symmetric_key) const;
-	static ChatMessage encrypt(std::string plaintext, const Hash& key_id, const SymmetricKey& symmetric_key);
+	std::string decrypt(SymmetricCipher& cipher) const;
+	static ChatMessage encrypt(const std::string& plaintext, const Hash& key_id, SymmetricCipher& cipher);
 };
 struct UnsignedChatMessage
 {
@@ -551,7 +629,7 @@ struct PublicKeyParticipant
 	PublicKey ephemeral_public_key;
 	
 	void encode_to(MessageBuffer* buffer) const;
-	static PublicKeyParticipant decode_from(MessageBuffer* buffer);
+	static PublicKeyParticipant decode_from(MessageReader* buffer);
 	static const KeyExchangeState::State state = KeyExchangeState::State::PublicKey;
 };
 typedef ParticipantKeyExchangeState<PublicKeyParticipant> PublicKeyKeyExchangeState;
@@ -565,7 +643,7 @@ struct SecretShareParticipant
 	Hash secret_share;
 	
 	void encode_to(MessageBuffer* buffer) const;
-	static SecretShareParticipant decode_from(MessageBuffer* buffer);
+	static SecretShareParticipant decode_from(MessageReader* buffer);
 	static const KeyExchangeState::State state = KeyExchangeState::State::SecretShare;
 };
 typedef ParticipantKeyExchangeState<SecretShareParticipant> SecretShareKeyExchangeState;
@@ -580,7 +658,7 @@ struct AcceptanceParticipant
 	Hash key_hash;
 	
 	void encode_to(MessageBuffer* buffer) const;
-	static AcceptanceParticipant decode_from(MessageBuffer* buffer);
+	static AcceptanceParticipant decode_from(MessageReader* buffer);
 	static const KeyExchangeState::State state = KeyExchangeState::State::Acceptance;
 };
 typedef ParticipantKeyExchangeState<AcceptanceParticipant> AcceptanceKeyExchangeState;
@@ -596,7 +674,7 @@ struct RevealParticipant
 	SerializedPrivateKey ephemeral_private_key;
 	
 	void encode_to(MessageBuffer* buffer) const;
-	static RevealParticipant decode_from(MessageBuffer* buffer);
+	static RevealParticipant decode_from(MessageReader* buffer);
 	static const KeyExchangeState::State state = KeyExchangeState::State::Reveal;
 };
 typedef ParticipantKeyExchangeState<RevealParticipant> RevealKeyExchangeState;
@@ -0,0 +1,147 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SRC_PARTICIPANTTABLE_H_
+#define SRC_PARTICIPANTTABLE_H_
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace np1sec
+{
+
+/*
+ * A table of participants keyed by username, with the interface of the
+ * std::map it replaces. Entries are kept sorted by username in a single
+ * contiguous vector, so iteration order is unchanged, lookups are a binary
+ * search over adjacent entries, and the position of a participant in the
+ * table is its index in the sorted participant list.
+ *
+ * Unlike std::map, inserting or erasing an entry invalidates all iterators
+ * and references into the table, so callers must not hold one across
+ * anything that may add or remove participants, such as sending a message.
+ */
+template<class Value>
+class ParticipantTable
+{
+	public:
+	typedef std::pair<std::string, Value> value_type;
+	typedef typename std::vector<value_type>::iterator iterator;
+	typedef typename std::vector<value_type>::const_iterator const_iterator;
+	typedef typename std::vector<value_type>::reverse_iterator reverse_iterator;
+	typedef typename std::vector<value_type>::const_reverse_iterator const_reverse_iterator;
+
+	iterator begin() { return m_entries.begin(); }
+	iterator end() { return m_entries.end(); }
+	const_iterator begin() const { return m_entries.begin(); }
+	const_iterator end() const { return m_entries.end(); }
+	reverse_iterator rbegin() { return m_entries.rbegin(); }
+	reverse_iterator rend() { return m_entries.rend(); }
+	const_reverse_iterator rbegin() const { return m_entries.rbegin(); }
+	const_reverse_iterator rend() const { return m_entries.rend(); }
+
+	size_t size() const { return m_entries.size(); }
+	bool empty() const { return m_entries.empty(); }
+	void clear() { m_entries.clear(); }
+	void reserve(size_t size) { m_entries.reserve(size); }
+
+	iterator find(const std::string& username)
+	{
+		iterator it = lower_bound(username);
+		return (it != m_entries.end() && it->first == username) ? it : m_entries.end();
+	}
+
+	const_iterator find(const std::string& username) const
+	{
+		const_iterator it = lower_bound(username);
+		return (it != m_entries.end() && it->first == username) ? it : m_entries.end();
+	}
+
+	size_t count(const std::string& username) const
+	{
+		return find(username) == m_entries.end() ? 0 : 1;
+	}
+
+	Value& at(const std::string& username)
+	{
+		iterator it = find(username);
+		if (it == m_entries.end()) {
+			throw std::out_of_range("ParticipantTable::at");
+		}
+		return it->second;
+	}
+
+	const Value& at(const std::string& username) const
+	{
+		const_iterator it = find(username);
+		if (it == m_entries.end()) {
+			throw std::out_of_range("ParticipantTable::at");
+		}
+		return it->second;
+	}
+
+	Value& operator[](const std::string& username)
+	{
+		iterator it = lower_bound(username);
+		if (it == m_entries.end() || it->first != username) {
+			it = m_entries.emplace(it, std::string(username), Value());
+		}
+		return it->second;
+	}
+
+	iterator erase(iterator it)
+	{
+		return m_entries.erase(it);
+	}
+
+	size_t erase(const std::string& username)
+	{
+		iterator it = find(username);
+		if (it == m_entries.end()) {
+			return 0;
+		}
+		m_entries.erase(it);
+		return 1;
+	}
+
+	protected:
+	static bool entry_before(const value_type& entry, const std::string& username)
+	{
+		return entry.first < username;
+	}
+
+	iterator lower_bound(const std::string& username)
+	{
+		return std::lower_bound(m_entries.begin(), m_entries.end(), username, entry_before);
+	}
+
+	const_iterator lower_bound(const std::string& username) const
+	{
+		return std::lower_bound(m_entries.begin(), m_entries.end(), username, entry_before);
+	}
+
+	protected:
+	std::vector<value_type> m_entries;
+};
+
+} // namespace np1sec
+
+#endif
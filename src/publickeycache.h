@@ -0,0 +1,112 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SRC_PUBLICKEYCACHE_H_
+#define SRC_PUBLICKEYCACHE_H_
+
+#include "crypto.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace np1sec
+{
+
+const size_t c_public_key_cache_size = 256;
+
+/*
+ * Bounded cache of public keys parsed into the representation of a crypto
+ * backend, shared between threads. When full, the least recently used key
+ * is evicted; values handed out before an eviction stay valid until the
+ * last user releases them.
+ */
+template<class Value>
+class PublicKeyCache
+{
+	public:
+	/* Returns null if the key cannot be parsed. */
+	typedef std::shared_ptr<Value> (*Parser)(const PublicKey& key);
+
+	explicit PublicKeyCache(Parser parser):
+		m_parser(parser),
+		m_hits(0),
+		m_misses(0)
+	{}
+
+	std::shared_ptr<Value> get(const PublicKey& key)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_entries.find(key);
+			if (it != m_entries.end()) {
+				m_hits++;
+				m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+				return it->second.value;
+			}
+			m_misses++;
+		}
+
+		std::shared_ptr<Value> value = m_parser(key);
+		if (!value) {
+			throw CryptoException();
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_entries.count(key)) {
+			return m_entries.at(key).value;
+		}
+		if (m_entries.size() >= c_public_key_cache_size) {
+			m_entries.erase(m_lru.back());
+			m_lru.pop_back();
+		}
+		m_lru.push_front(key);
+		Entry& entry = m_entries[key];
+		entry.value = value;
+		entry.lru = m_lru.begin();
+		return value;
+	}
+
+	void add_statistics(crypto::PublicKeyCacheStatistics* statistics)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		statistics->hits += m_hits;
+		statistics->misses += m_misses;
+		statistics->size += m_entries.size();
+	}
+
+	protected:
+	struct Entry
+	{
+		std::shared_ptr<Value> value;
+		typename std::list<PublicKey>::iterator lru;
+	};
+
+	Parser m_parser;
+	std::mutex m_mutex;
+	std::map<PublicKey, Entry> m_entries;
+	// most recently used first
+	std::list<PublicKey> m_lru;
+	uint64_t m_hits;
+	uint64_t m_misses;
+};
+
+} // namespace np1sec
+
+#endif
@@ -23,12 +23,23 @@
 namespace np1sec
 {
 
+// payload bytes beyond which a batch is sent without waiting for more
+const size_t c_max_batch_size = 2048;
+
 Room::Room(RoomInterface* interface, const std::string& username, const PrivateKey& private_key):
 	m_interface(interface),
 	m_username(username),
 	m_long_term_private_key(private_key),
+	m_long_term_private_scalar(private_key),
+	m_binary_transport(false),
+	m_batch_messages(false),
+	m_chunk_messages(false),
+	m_batch_depth(0),
+	m_outbound_batch_size(0),
 	m_disconnecting(false),
-	m_conversations(this)
+	m_conversations(this),
+	m_statistics_interval(0),
+	m_trace_sink(nullptr)
 {
 	assert(m_interface);
 }
@@ -66,7 +77,11 @@ void Room::connect()
 		disconnect();
 	}
 	
+	m_binary_transport = m_interface->binary_transport();
+	m_batch_messages = m_interface->batch_messages();
+	m_chunk_messages = m_interface->chunk_messages();
 	m_ephemeral_private_key = PrivateKey::generate(true);
+	m_ephemeral_private_scalar = PrivateScalar(m_ephemeral_private_key);
 	
 	HelloMessage hello_message;
 	hello_message.long_term_public_key = m_long_term_private_key.public_key();
@@ -77,6 +92,7 @@ void Room::connect()
 
 void Room::disconnect()
 {
+	flush_batch();
 	m_disconnecting = true;
 	m_disconnect_nonce = crypto::nonce_hash();
 	
@@ -100,23 +116,126 @@ void Room::create_conversation()
 
 void Room::message_received(const std::string& sender, const std::string& text_message)
 {
-	auto filter = [&] (Message& message) {
+	std::vector<InboundMessage> inbound(1);
+	decode_message(text_message, &inbound[0]);
+	verify_signatures(&inbound);
+	
+	begin_batch();
+	process_message(sender, text_message, inbound[0]);
+	end_batch();
+}
+
+void Room::messages_received(const std::vector<ReceivedMessage>& messages)
+{
+	std::vector<InboundMessage> inbound(messages.size());
+	for (size_t i = 0; i < messages.size(); i++) {
+		decode_message(messages[i].text_message, &inbound[i]);
+	}
+	verify_signatures(&inbound);
+	
+	for (size_t i = 0; i < messages.size(); i++) {
+		begin_batch();
+		process_message(messages[i].sender, messages[i].text_message, inbound[i]);
+		end_batch();
+	}
+}
+
+void Room::decode_message(const std::string& text_message, InboundMessage* inbound)
+{
+	inbound->decoded = false;
+	inbound->batch = false;
+	
+	uint64_t decode_start = RoomStatistics::now();
+	Message np1sec_message;
+	try {
+		np1sec_message = Message::decode(text_message);
+	} catch(MessageFormatException) {
+		return;
+	}
+	
+	if (np1sec_message.type == Message::Type::Batch) {
+		BatchMessage batch;
+		try {
+			batch = BatchMessage::decode(np1sec_message);
+		} catch(MessageFormatException) {
+			return;
+		}
+		inbound->batch = true;
+		inbound->messages.resize(batch.messages.size());
+		for (size_t i = 0; i < batch.messages.size(); i++) {
+			inbound->messages[i].message = std::move(batch.messages[i]);
+		}
+	} else {
+		inbound->messages.resize(1);
+		inbound->messages[0].message = std::move(np1sec_message);
+	}
+	inbound->decoded = true;
+	
+	for (DecodedMessage& message : inbound->messages) {
+		message.signature_status = SignatureStatus::Unverified;
+		if (Message::is_conversation_message(message.message.type)) {
+			try {
+				message.conversation_message = ConversationMessage::decode(message.message);
+			} catch(MessageFormatException) {
+				message.signature_status = SignatureStatus::Invalid;
+			}
+		}
+	}
+	m_statistics.decode_time.add(RoomStatistics::now() - decode_start);
+}
+
+void Room::verify_signatures(std::vector<InboundMessage>* inbound)
+{
+	std::vector<DecodedMessage*> signed_messages;
+	std::vector<crypto::SignedPayload> signatures;
+	for (InboundMessage& received : *inbound) {
+		for (DecodedMessage& message : received.messages) {
+			if (
+				   !Message::is_conversation_message(message.message.type)
+				|| message.signature_status != SignatureStatus::Unverified
+			) {
+				continue;
+			}
+			signatures.emplace_back();
+			signatures.back().payload = message.conversation_message.signed_body();
+			signatures.back().signature = message.conversation_message.signature;
+			signatures.back().key = message.conversation_message.conversation_public_key;
+			signed_messages.push_back(&message);
+		}
+	}
+	if (signatures.empty()) {
+		return;
+	}
+	
+	uint64_t verify_start = RoomStatistics::now();
+	std::vector<bool> valid = crypto::verify_batch(signatures);
+	uint64_t verify_time = (RoomStatistics::now() - verify_start) / signatures.size();
+	for (size_t i = 0; i < signed_messages.size(); i++) {
+		signed_messages[i]->signature_status = valid[i] ? SignatureStatus::Valid : SignatureStatus::Invalid;
+		m_statistics.verify_time.add(verify_time);
+	}
+}
+
+void Room::process_message(const std::string& sender, const std::string& text_message, const InboundMessage& inbound)
+{
+	auto filter = [&] (const Message& message) {
 		if (!m_inbound_message_filter) return true;
 		return m_inbound_message_filter(sender, message);
 	};
+	
+	m_statistics.transport_messages_in++;
+	m_statistics.transport_bytes_in += text_message.size();
 
 	if (m_disconnecting) {
 		if (sender != username()) {
 			return;
 		}
 		
-		Message np1sec_message;
-		try {
-			np1sec_message = Message::decode(text_message);
-			if (!filter(np1sec_message)) return;
-		} catch(MessageFormatException) {
+		if (!inbound.decoded || inbound.batch) {
 			return;
 		}
+		const Message& np1sec_message = inbound.messages[0].message;
+		if (!filter(np1sec_message)) return;
 		
 		QuitMessage quit_message;
 		try {
@@ -139,14 +258,38 @@ void Room::message_received(const std::string& sender, const std::string& text_m
 		m_message_queue.pop_front();
 	}
 	
-	Message np1sec_message;
-	try {
-		np1sec_message = Message::decode(text_message);
-		if (!filter(np1sec_message)) return;
-	} catch(MessageFormatException) {
+	if (!inbound.decoded) {
 		return;
 	}
 	
+	for (const DecodedMessage& message : inbound.messages) {
+		if (m_disconnecting) {
+			return;
+		}
+		if (filter(message.message)) {
+			dispatch_message(sender, message);
+		}
+	}
+}
+
+void Room::dispatch_message(const std::string& sender, const DecodedMessage& message)
+{
+	Message::Type type = message.message.type;
+	MessageTypeStatistics& statistics = m_statistics.message_type(type);
+	statistics.messages_in++;
+	statistics.payload_bytes_in += message.message.payload.size();
+	
+	uint64_t start = RoomStatistics::now();
+	
+	handle_message(sender, message);
+	
+	// The handler may have reset the statistics.
+	m_statistics.message_type(type).handler_time.add(RoomStatistics::now() - start);
+}
+
+void Room::handle_message(const std::string& sender, const DecodedMessage& decoded_message)
+{
+	const Message& np1sec_message = decoded_message.message;
 	if (np1sec_message.type == Message::Type::Quit) {
 		user_disconnected(sender);
 	} else if (np1sec_message.type == Message::Type::Hello) {
@@ -174,6 +317,7 @@ void Room::message_received(const std::string& sender, const std::string& text_m
 		user.ephemeral_public_key = message.ephemeral_public_key;
 		user.authenticated = false;
 		user.authentication_nonce = crypto::nonce_hash();
+		user.triple_diffie_hellman_computed = false;
 		m_users[sender] = std::move(user);
 		
 		if (sender == username()) {
@@ -210,15 +354,12 @@ void Room::message_received(const std::string& sender, const std::string& text_m
 		if (!m_users.count(sender)) {
 			return;
 		}
-		const User& user = m_users.at(sender);
+		User& user = m_users.at(sender);
 		
 		RoomAuthenticationMessage reply;
 		reply.username = sender;
 		reply.authentication_confirmation = crypto::authentication_token(
-			m_long_term_private_key,
-			m_ephemeral_private_key,
-			user.long_term_public_key,
-			user.ephemeral_public_key,
+			triple_diffie_hellman_token(user),
 			message.nonce,
 			username()
 		);
@@ -244,10 +385,7 @@ void Room::message_received(const std::string& sender, const std::string& text_m
 			return;
 		}
 		if (message.authentication_confirmation == crypto::authentication_token(
-			m_long_term_private_key,
-			m_ephemeral_private_key,
-			user.long_term_public_key,
-			user.ephemeral_public_key,
+			triple_diffie_hellman_token(user),
 			user.authentication_nonce,
 			sender
 		)) {
@@ -257,18 +395,11 @@ void Room::message_received(const std::string& sender, const std::string& text_m
 	}
 	
 	if (Message::is_conversation_message(np1sec_message.type)) {
-		ConversationMessage message;
-		try {
-			message = ConversationMessage::decode(np1sec_message);
-		} catch(MessageFormatException) {
+		if (decoded_message.signature_status != SignatureStatus::Valid) {
 			return;
 		}
 		
-		if (!message.verify()) {
-			return;
-		}
-		
-		m_conversations.message_received(sender, message);
+		m_conversations.message_received(sender, decoded_message.conversation_message);
 	}
 }
 
@@ -282,20 +413,146 @@ void Room::left_room()
 	// TODO: left_room() conversations
 }
 
+void Room::reset_statistics()
+{
+	m_statistics = RoomStatistics();
+}
+
+void Room::set_statistics_callback(std::function<void(const RoomStatistics&)> callback, uint32_t interval)
+{
+	m_statistics_callback = std::move(callback);
+	m_statistics_interval = interval;
+	m_statistics_timer.stop();
+	if (m_statistics_callback) {
+		arm_statistics_timer();
+	}
+}
+
+TraceTime Room::trace_time()
+{
+	TraceTime result;
+	if (m_trace_sink) {
+		result.host_time = m_interface->current_time();
+		result.time = RoomStatistics::now();
+	}
+	return result;
+}
+
+void Room::trace(TraceEvent::Type type, const char* name, const Hash& id, const std::string& participant, const std::string& detail, const TraceTime& start)
+{
+	if (!m_trace_sink) {
+		return;
+	}
+	
+	static const char digits[] = "0123456789abcdef";
+	TraceEvent event;
+	event.type = type;
+	event.name = name;
+	// Enough of the hash to tell spans apart.
+	for (size_t i = 0; i < 8; i++) {
+		event.id += digits[id.buffer[i] >> 4];
+		event.id += digits[id.buffer[i] & 0xf];
+	}
+	event.room = m_username;
+	event.participant = participant;
+	event.detail = detail;
+	if (type == TraceEvent::Type::Complete) {
+		event.host_time = start.host_time;
+		event.time = start.time;
+		event.duration = RoomStatistics::now() - start.time;
+	} else {
+		event.host_time = m_interface->current_time();
+		event.time = RoomStatistics::now();
+		event.duration = 0;
+	}
+	m_trace_sink->trace(event);
+}
+
 void Room::send_message(const Message& message)
 {
 	if (m_outbound_message_filter && !m_outbound_message_filter(message)) {
 		return;
 	}
-	send_message(message.encode());
+	MessageTypeStatistics& statistics = m_statistics.message_type(message.type);
+	statistics.messages_out++;
+	statistics.payload_bytes_out += message.payload.size();
+	
+	if (m_batch_depth > 0 && m_batch_messages && !m_disconnecting) {
+		if (!m_outbound_batch.empty() && m_outbound_batch_size + message.payload.size() > c_max_batch_size) {
+			flush_batch();
+		}
+		m_outbound_batch.push_back(message);
+		m_outbound_batch_size += message.payload.size();
+		return;
+	}
+	send_message(m_binary_transport ? message.encode_binary() : message.encode());
 }
 
 void Room::send_message(const std::string& message)
 {
+	m_statistics.transport_messages_out++;
+	m_statistics.transport_bytes_out += message.size();
 	m_message_queue.push_back(message);
 	m_interface->send_message(message);
 }
 
+void Room::begin_batch()
+{
+	m_batch_depth++;
+}
+
+void Room::end_batch()
+{
+	assert(m_batch_depth > 0);
+	m_batch_depth--;
+	if (m_batch_depth == 0) {
+		flush_batch();
+	}
+}
+
+void Room::flush_batch()
+{
+	if (m_outbound_batch.empty()) {
+		return;
+	}
+	
+	Message message;
+	if (m_outbound_batch.size() == 1) {
+		message = std::move(m_outbound_batch.front());
+	} else {
+		BatchMessage batch;
+		batch.messages = std::move(m_outbound_batch);
+		message = batch.encode();
+	}
+	m_outbound_batch.clear();
+	m_outbound_batch_size = 0;
+	send_message(m_binary_transport ? message.encode_binary() : message.encode());
+}
+
+const Hash& Room::triple_diffie_hellman_token(User& user)
+{
+	if (!user.triple_diffie_hellman_computed) {
+		user.triple_diffie_hellman_token = crypto::triple_diffie_hellman(
+			m_long_term_private_scalar,
+			m_ephemeral_private_scalar,
+			user.long_term_public_key,
+			user.ephemeral_public_key
+		);
+		user.triple_diffie_hellman_computed = true;
+	}
+	return user.triple_diffie_hellman_token;
+}
+
+void Room::arm_statistics_timer()
+{
+	m_statistics_timer = Timer(m_interface, m_statistics_interval, [this] {
+		// Rearmed first, so that the callback can replace or stop it.
+		std::function<void(const RoomStatistics&)> callback = m_statistics_callback;
+		arm_statistics_timer();
+		callback(m_statistics);
+	});
+}
+
 void Room::user_removed(const std::string& username)
 {
 	if (!m_users.count(username)) {
@@ -22,12 +22,16 @@
 #include "conversationlist.h"
 #include "interface.h"
 #include "message.h"
+#include "statistics.h"
 #include "timer.h"
+#include "trace.h"
+#include "username.h"
 
 #include <functional>
 #include <deque>
 #include <map>
 #include <set>
+#include <vector>
 
 namespace np1sec
 {
@@ -112,10 +116,30 @@ class Room
 	 * function.
 	 *
 	 * \param sender Clear text user name of the sender
-	 * \param text_message Encrypted message.
+	 * \param text_message Encrypted message, in either the text or the
+	 *        binary framing (see RoomInterface::binary_transport).
 	 */
 	void message_received(const std::string& sender, const std::string& text_message);
 
+	struct ReceivedMessage
+	{
+		std::string sender;
+		std::string text_message;
+	};
+
+	/**
+	 * Tell the library that a sequence of (n+1)sec messages has arrived.
+	 *
+	 * Equivalent to calling Room::message_received for each message in
+	 * order, except that the signatures of all conversation messages in
+	 * the sequence are verified together before any of them is processed,
+	 * which takes a fraction of the time. Transports that receive messages
+	 * in bursts, such as when catching up after reconnecting, should
+	 * prefer this function. RoomHost uses it for consecutive messages
+	 * queued for the same room.
+	 */
+	void messages_received(const std::vector<ReceivedMessage>& messages);
+
 
 	/**
 	 * Indicate to the library a user has left.
@@ -127,6 +151,36 @@ class Room
 	 */
 	void left_room();
 	
+	/* Statistics */
+	
+	/**
+	 * Counters and timings of what the room has been doing since it was
+	 * created or the statistics were last reset.
+	 */
+	const RoomStatistics& statistics() const
+	{
+		return m_statistics;
+	}
+	
+	void reset_statistics();
+	
+	/**
+	 * Call \p callback with the statistics every \p interval
+	 * milliseconds, using RoomInterface::set_timer, until it is replaced
+	 * by another callback. An empty callback stops the reports.
+	 */
+	void set_statistics_callback(std::function<void(const RoomStatistics&)> callback, uint32_t interval);
+	
+	/**
+	 * Report key exchange and session lifecycle events to \p sink, or
+	 * stop reporting if it is null. The sink is not owned, and must
+	 * outlive the room or be unset first.
+	 */
+	void set_trace_sink(TraceSink* sink)
+	{
+		m_trace_sink = sink;
+	}
+	
 	
 	
 	/*
@@ -153,6 +207,40 @@ class Room
 		return m_interface;
 	}
 	
+	/* Whether chat messages are sent in chunks; see RoomInterface::chunk_messages. */
+	bool chunk_messages() const
+	{
+		return m_chunk_messages;
+	}
+	
+	RoomStatistics& mutable_statistics()
+	{
+		return m_statistics;
+	}
+	
+	/* Whether trace() does anything, so callers can skip preparing events. */
+	bool tracing() const
+	{
+		return m_trace_sink != nullptr;
+	}
+	
+	/*
+	 * The start time of an operation to be traced as complete; zero,
+	 * without reading the clocks, when not tracing.
+	 */
+	TraceTime trace_time();
+	
+	/*
+	 * For TraceEvent::Type::Complete, \p start is the trace_time() at
+	 * which the operation started, and it ends now.
+	 */
+	void trace(TraceEvent::Type type, const char* name, const Hash& id, const std::string& participant = std::string(), const std::string& detail = std::string(), const TraceTime& start = TraceTime());
+	
+	Username intern_username(const std::string& username)
+	{
+		return m_usernames.intern(username);
+	}
+	
 	/* Operations */
 	void send_message(const Message& message);
 	void send_message(const std::string& message);
@@ -198,6 +286,41 @@ class Room
 	}
 
 	protected:
+	enum class SignatureStatus { Unverified, Valid, Invalid };
+	/*
+	 * A protocol message, with the conversation message it carries if it
+	 * is one. Those have a signature status, Invalid if they did not decode.
+	 */
+	struct DecodedMessage
+	{
+		Message message;
+		ConversationMessage conversation_message;
+		SignatureStatus signature_status;
+	};
+	/*
+	 * A transport message, decoded as far as can be done without looking
+	 * at the room state, so that the signatures of a whole sequence of
+	 * messages can be verified together before any of it is processed.
+	 */
+	struct InboundMessage
+	{
+		bool decoded;
+		bool batch;
+		std::vector<DecodedMessage> messages;
+	};
+	void decode_message(const std::string& text_message, InboundMessage* inbound);
+	void verify_signatures(std::vector<InboundMessage>* inbound);
+	void process_message(const std::string& sender, const std::string& text_message, const InboundMessage& inbound);
+	void dispatch_message(const std::string& sender, const DecodedMessage& message);
+	void handle_message(const std::string& sender, const DecodedMessage& message);
+	void arm_statistics_timer();
+	/*
+	 * Between begin_batch() and the matching end_batch(), messages are
+	 * collected to be sent together.
+	 */
+	void begin_batch();
+	void end_batch();
+	void flush_batch();
 	void user_removed(const std::string& username);
 	void user_disconnected(const std::string& username);
 	
@@ -207,6 +330,14 @@ class Room
 	std::string m_username;
 	PrivateKey m_long_term_private_key;
 	PrivateKey m_ephemeral_private_key;
+	PrivateScalar m_long_term_private_scalar;
+	PrivateScalar m_ephemeral_private_scalar;
+	bool m_binary_transport;
+	bool m_batch_messages;
+	bool m_chunk_messages;
+	size_t m_batch_depth;
+	std::vector<Message> m_outbound_batch;
+	size_t m_outbound_batch_size;
 	
 	std::deque<std::string> m_message_queue;
 	bool m_disconnecting;
@@ -221,9 +352,18 @@ class Room
 		PublicKey ephemeral_public_key;
 		bool authenticated;
 		Hash authentication_nonce;
+		/*
+		 * The triple Diffie-Hellman token between our keys and this user's,
+		 * shared by the authentication we send and the one we verify.
+		 */
+		bool triple_diffie_hellman_computed;
+		Hash triple_diffie_hellman_token;
 	};
+	const Hash& triple_diffie_hellman_token(User& user);
 	std::map<std::string, User> m_users;
 	
+	/* Must outlive m_conversations, which hold handles into it. */
+	UsernameTable m_usernames;
 	ConversationList m_conversations;
 
 	/* Called before the message is processed. If the function returns false,
@@ -233,6 +373,13 @@ class Room
 	/* Called before the message is sent. If the function returns false,
 	 * the message won't be sent. It is used for debugging and testing. */
 	std::function<bool(const Message&)> m_outbound_message_filter;
+	
+	RoomStatistics m_statistics;
+	std::function<void(const RoomStatistics&)> m_statistics_callback;
+	uint32_t m_statistics_interval;
+	Timer m_statistics_timer;
+	
+	TraceSink* m_trace_sink;
 };
 
 } // namespace np1sec
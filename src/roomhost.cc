@@ -0,0 +1,445 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "roomhost.h"
+#include "room.h"
+#include "timerwheel.h"
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace np1sec
+{
+
+// resolution of the worker timer wheels, in milliseconds
+const uint32_t c_room_host_timer_resolution = 10;
+// tasks a worker runs before it checks its timers again
+const size_t c_room_host_batch_size = 256;
+
+static uint64_t monotonic_milliseconds()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * A call queued for a worker: a function, or a message for a room. The
+ * worker delivers a message together with the messages for the same room
+ * queued right after it, so that the room verifies their signatures in
+ * one batch.
+ */
+struct Task
+{
+	std::function<void()> function;
+	HostedRoom* room = nullptr;
+	Room::ReceivedMessage message;
+};
+
+/*
+ * Multiple-producer single-consumer queue of tasks, after Dmitry Vyukov's
+ * intrusive MPSC queue. Producers never block each other or the consumer;
+ * a push is one atomic exchange.
+ */
+class TaskQueue
+{
+	public:
+	TaskQueue():
+		m_head(&m_stub),
+		m_tail(&m_stub)
+	{
+		m_stub.next.store(nullptr, std::memory_order_relaxed);
+	}
+
+	~TaskQueue()
+	{
+		Task task;
+		while (pop(&task)) {}
+	}
+
+	/* Any thread */
+	void push(Task task)
+	{
+		Node* node = new Node;
+		node->task = std::move(task);
+		enqueue(node);
+	}
+
+	/* Consumer only */
+	bool pop(Task* task)
+	{
+		Node* tail = m_tail;
+		Node* next = tail->next.load(std::memory_order_acquire);
+		if (tail == &m_stub) {
+			if (!next) {
+				return false;
+			}
+			m_tail = next;
+			tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		if (next) {
+			m_tail = next;
+			*task = std::move(tail->task);
+			delete tail;
+			return true;
+		}
+		if (tail != m_head.load(std::memory_order_acquire)) {
+			// A push is halfway done; the consumer will be woken when it completes.
+			return false;
+		}
+		enqueue(&m_stub);
+		next = tail->next.load(std::memory_order_acquire);
+		if (next) {
+			m_tail = next;
+			*task = std::move(tail->task);
+			delete tail;
+			return true;
+		}
+		return false;
+	}
+
+	/* Consumer only */
+	bool empty() const
+	{
+		return m_tail == &m_stub ? m_stub.next.load(std::memory_order_acquire) == nullptr : false;
+	}
+
+	protected:
+	struct Node
+	{
+		std::atomic<Node*> next;
+		Task task;
+	};
+
+	void enqueue(Node* node)
+	{
+		node->next.store(nullptr, std::memory_order_relaxed);
+		Node* previous = m_head.exchange(node, std::memory_order_acq_rel);
+		previous->next.store(node, std::memory_order_release);
+	}
+
+	protected:
+	std::atomic<Node*> m_head;
+	Node* m_tail;
+	Node m_stub;
+};
+
+class RoomHostWorker
+{
+	public:
+	RoomHostWorker():
+		m_timers(c_room_host_timer_resolution, monotonic_milliseconds()),
+		m_has_next_task(false),
+		m_stopping(false),
+		m_sleeping(false)
+	{
+		m_thread = std::thread([this] { run(); });
+	}
+
+	~RoomHostWorker()
+	{
+		stop();
+		join();
+		destroy_rooms();
+	}
+
+	/*
+	 * The worker finishes the tasks queued so far and exits. Tasks queued
+	 * afterwards are discarded; rooms whose creation was discarded are
+	 * still destroyed by destroy_rooms().
+	 */
+	void stop()
+	{
+		m_stopping.store(true);
+		wake();
+	}
+
+	void join()
+	{
+		if (m_thread.joinable()) {
+			m_thread.join();
+		}
+	}
+
+	void post(std::function<void()> function)
+	{
+		Task task;
+		task.function = std::move(function);
+		m_tasks.push(std::move(task));
+		wake();
+	}
+
+	void post_message(HostedRoom* room, const std::string& sender, const std::string& text_message)
+	{
+		Task task;
+		task.room = room;
+		task.message.sender = sender;
+		task.message.text_message = text_message;
+		m_tasks.push(std::move(task));
+		wake();
+	}
+
+	TimerWheel* timers()
+	{
+		return &m_timers;
+	}
+
+	/* Any thread */
+	void add_room(HostedRoom* room)
+	{
+		std::lock_guard<std::mutex> lock(m_rooms_mutex);
+		m_rooms.insert(room);
+	}
+
+	/* Any thread */
+	void remove_room(HostedRoom* room)
+	{
+		std::lock_guard<std::mutex> lock(m_rooms_mutex);
+		m_rooms.erase(room);
+	}
+
+	/* Once the worker thread has exited */
+	void destroy_rooms()
+	{
+		std::set<HostedRoom*> rooms;
+		{
+			std::lock_guard<std::mutex> lock(m_rooms_mutex);
+			rooms.swap(m_rooms);
+		}
+		for (HostedRoom* room : rooms) {
+			delete room;
+		}
+	}
+
+	protected:
+	void wake()
+	{
+		// Orders the push before the load, against the fence in run().
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_sleeping.load()) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_wakeup.notify_one();
+		}
+	}
+
+	/* The task left over by the last run of messages, or the next queued one. */
+	bool next_task(Task* task)
+	{
+		if (m_has_next_task) {
+			*task = std::move(m_next_task);
+			m_has_next_task = false;
+			return true;
+		}
+		return m_tasks.pop(task);
+	}
+
+	bool idle() const
+	{
+		return !m_has_next_task && m_tasks.empty();
+	}
+
+	void run()
+	{
+		for (;;) {
+			Task task;
+			size_t count = 0;
+			while (count < c_room_host_batch_size && next_task(&task)) {
+				count++;
+				if (!task.room) {
+					task.function();
+					continue;
+				}
+
+				HostedRoom* room = task.room;
+				std::vector<Room::ReceivedMessage> messages;
+				messages.push_back(std::move(task.message));
+				while (count < c_room_host_batch_size && m_tasks.pop(&m_next_task)) {
+					if (m_next_task.room != room) {
+						m_has_next_task = true;
+						break;
+					}
+					messages.push_back(std::move(m_next_task.message));
+					count++;
+				}
+				room->m_room->messages_received(messages);
+			}
+			m_timers.poll(monotonic_milliseconds());
+
+			if (m_stopping.load() && idle()) {
+				break;
+			}
+
+			/*
+			 * A producer that pushes after the emptiness check below sees
+			 * m_sleeping set, and cannot notify before we wait, as that
+			 * requires the mutex.
+			 */
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_sleeping.store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (idle() && !m_stopping.load()) {
+				uint64_t expiry = m_timers.next_expiry();
+				if (expiry == UINT64_MAX) {
+					m_wakeup.wait(lock);
+				} else {
+					uint64_t now = monotonic_milliseconds();
+					if (expiry > now) {
+						m_wakeup.wait_for(lock, std::chrono::milliseconds(expiry - now));
+					}
+				}
+			}
+			m_sleeping.store(false);
+		}
+	}
+
+	protected:
+	TimerWheel m_timers;
+	TaskQueue m_tasks;
+	Task m_next_task;
+	bool m_has_next_task;
+
+	std::atomic<bool> m_stopping;
+	std::atomic<bool> m_sleeping;
+	std::mutex m_mutex;
+	std::condition_variable m_wakeup;
+
+	/* Every room handle pinned to this worker that was not destroyed yet */
+	std::mutex m_rooms_mutex;
+	std::set<HostedRoom*> m_rooms;
+
+	std::thread m_thread;
+};
+
+
+
+TimerToken* HostedRoomInterface::set_timer(uint32_t interval, TimerCallback* callback)
+{
+	assert(m_timers);
+	return m_timers->set_timer(interval, callback);
+}
+
+uint64_t HostedRoomInterface::current_time()
+{
+	assert(m_timers);
+	return m_timers->now();
+}
+
+
+
+RoomHost::RoomHost(size_t worker_count):
+	m_next_worker(0)
+{
+	if (worker_count == 0) {
+		worker_count = std::thread::hardware_concurrency();
+	}
+	if (worker_count == 0) {
+		worker_count = 1;
+	}
+	for (size_t i = 0; i < worker_count; i++) {
+		m_workers.emplace_back(new RoomHostWorker());
+	}
+}
+
+RoomHost::~RoomHost()
+{
+	/*
+	 * Rooms may queue work for rooms on other workers until the end, so
+	 * no room is destroyed before all workers have stopped.
+	 */
+	for (auto& worker : m_workers) {
+		worker->stop();
+	}
+	for (auto& worker : m_workers) {
+		worker->join();
+	}
+	for (auto& worker : m_workers) {
+		worker->destroy_rooms();
+	}
+	m_workers.clear();
+}
+
+HostedRoom* RoomHost::create_room(HostedRoomInterface* interface, const std::string& username, const PrivateKey& private_key)
+{
+	assert(!interface->m_timers);
+	size_t index = m_next_worker++ % m_workers.size();
+	RoomHostWorker* worker = m_workers[index].get();
+	interface->m_timers = worker->timers();
+
+	/*
+	 * The handle is registered before the creation is queued, so that it
+	 * is destroyed with the worker even if the worker stops first.
+	 */
+	HostedRoom* room = new HostedRoom(worker, index);
+	worker->add_room(room);
+	worker->post([room, interface, username, private_key] {
+		room->m_room.reset(new Room(interface, username, private_key));
+	});
+	return room;
+}
+
+void RoomHost::destroy_room(HostedRoom* room)
+{
+	RoomHostWorker* worker = room->m_worker;
+	worker->post([worker, room] {
+		worker->remove_room(room);
+		delete room;
+	});
+}
+
+
+
+HostedRoom::HostedRoom(RoomHostWorker* worker, size_t worker_index):
+	m_worker(worker),
+	m_worker_index(worker_index)
+{}
+
+HostedRoom::~HostedRoom()
+{}
+
+void HostedRoom::connect()
+{
+	post([] (Room* room) { room->connect(); });
+}
+
+void HostedRoom::disconnect()
+{
+	post([] (Room* room) { room->disconnect(); });
+}
+
+void HostedRoom::message_received(const std::string& sender, const std::string& text_message)
+{
+	m_worker->post_message(this, sender, text_message);
+}
+
+void HostedRoom::user_left(const std::string& username)
+{
+	post([username] (Room* room) { room->user_left(username); });
+}
+
+void HostedRoom::post(std::function<void(Room*)> task)
+{
+	m_worker->post(std::bind([this] (std::function<void(Room*)>& task) {
+		task(m_room.get());
+	}, std::move(task)));
+}
+
+} // namespace np1sec
@@ -0,0 +1,158 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SRC_ROOMHOST_H_
+#define SRC_ROOMHOST_H_
+
+#include "interface.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace np1sec
+{
+
+class HostedRoom;
+class Room;
+class RoomHostWorker;
+class TimerWheel;
+
+/**
+ * The RoomInterface of a room run by a RoomHost.
+ *
+ * Timers are provided by the worker thread the room is pinned to, so
+ * implementations supply everything but set_timer and current_time. All
+ * callbacks are made on that worker thread.
+ */
+class HostedRoomInterface : public RoomInterface
+{
+	public:
+	HostedRoomInterface():
+		m_timers(nullptr)
+	{}
+
+	TimerToken* set_timer(uint32_t interval, TimerCallback* callback) final;
+	uint64_t current_time() final;
+
+	protected:
+	friend class RoomHost;
+
+	TimerWheel* m_timers;
+};
+
+/**
+ * Runs many rooms on a fixed pool of worker threads.
+ *
+ * Every room is pinned to one worker when it is created. All calls into
+ * the room, and all its timer and interface callbacks, happen on that
+ * worker's thread, so the rooms themselves stay single-threaded. Other
+ * threads reach a room through its HostedRoom handle, which queues the
+ * call on the room's worker through a lock-free queue and returns.
+ */
+class RoomHost
+{
+	public:
+	/**
+	 * \param worker_count Number of worker threads; zero picks one per core.
+	 */
+	explicit RoomHost(size_t worker_count = 0);
+
+	/**
+	 * Stops the workers, then destroys the remaining rooms. Calls queued
+	 * before the destructor are processed first.
+	 */
+	~RoomHost();
+
+	RoomHost(const RoomHost&) = delete;
+	RoomHost& operator=(const RoomHost&) = delete;
+
+	size_t worker_count() const
+	{
+		return m_workers.size();
+	}
+
+	/**
+	 * Create a room on the next worker in turn. Thread-safe.
+	 *
+	 * The room is constructed on its worker; \p interface must stay valid
+	 * until the room is destroyed, and must not be shared between rooms.
+	 */
+	HostedRoom* create_room(HostedRoomInterface* interface, const std::string& username, const PrivateKey& private_key);
+
+	/**
+	 * Queue the destruction of \p room on its worker. The handle must not
+	 * be used afterwards.
+	 */
+	void destroy_room(HostedRoom* room);
+
+	protected:
+	std::vector<std::unique_ptr<RoomHostWorker>> m_workers;
+	std::atomic<size_t> m_next_worker;
+};
+
+/**
+ * A thread-safe handle to a room run by a RoomHost.
+ *
+ * Each call is queued and executed later on the room's worker, in the
+ * order the calls were made by each calling thread.
+ */
+class HostedRoom
+{
+	public:
+	void connect();
+	void disconnect();
+	/*
+	 * Messages queued back to back for the same room reach it in one
+	 * Room::messages_received call.
+	 */
+	void message_received(const std::string& sender, const std::string& text_message);
+	void user_left(const std::string& username);
+
+	/**
+	 * Run \p task with the room on the room's worker thread, for any
+	 * operation not covered above.
+	 */
+	void post(std::function<void(Room*)> task);
+
+	/**
+	 * The index of the worker this room is pinned to.
+	 */
+	size_t worker() const
+	{
+		return m_worker_index;
+	}
+
+	protected:
+	friend class RoomHost;
+	friend class RoomHostWorker;
+
+	HostedRoom(RoomHostWorker* worker, size_t worker_index);
+	~HostedRoom();
+
+	RoomHostWorker* m_worker;
+	size_t m_worker_index;
+	// Accessed only on the worker thread.
+	std::unique_ptr<Room> m_room;
+};
+
+} // namespace np1sec
+
+#endif
@@ -20,37 +20,68 @@
 #include "room.h"
 #include "session.h"
 
+#include <algorithm>
+
 namespace np1sec
 {
 
+// plaintext bytes per chat message; larger messages are split
+const size_t c_chat_chunk_size = 2048;
+// largest chunked message a receiver reassembles
+const size_t c_max_chat_message_size = 16 * 1024 * 1024;
+
+// largest chat message sent in one piece; the framing around it fits in the rest of a signed payload
+const size_t c_max_unchunked_chat_message_size = crypto::c_max_signed_payload_size - 1024;
+
 Session::Session(Conversation* conversation, const Hash& key_id, const std::vector<KeyExchange::AcceptedUser>& users, const SymmetricKey& symmetric_key, const PrivateKey& private_key):
 	m_conversation(conversation),
 	m_key_id(key_id),
-	m_symmetric_key(symmetric_key),
+	m_cipher(symmetric_key),
 	m_private_key(private_key),
 	m_signature_id(1)
 {
+	m_participants.reserve(users.size());
 	for (const KeyExchange::AcceptedUser& user : users) {
 		Participant participant;
 		participant.username = user.username;
 		participant.long_term_public_key = user.long_term_public_key;
 		participant.ephemeral_public_key = user.ephemeral_public_key;
 		participant.signature_id = 1;
+		participant.discarding_message = false;
 		m_participants[user.username] = std::move(participant);
 	}
 }
 
+/*
+ * Each chunk is signed and encrypted as a message of its own, so the work
+ * and memory per message stay bounded however large the chat message is.
+ * Consecutive message ids keep the chunks in order. Unless the room
+ * enabled chunking, the message goes out whole, as older versions expect;
+ * but one too large to sign whole is chunked all the same, since no
+ * version would accept it whole.
+ */
 void Session::send_message(const std::string& message)
 {
-	UnsignedChatMessage payload;
-	payload.message_id = m_signature_id++;
-	payload.message = message;
-	
-	std::string signed_payload = PlaintextChatMessage::sign(payload, m_private_key);
-	
-	ChatMessage encrypted = ChatMessage::encrypt(signed_payload, m_key_id, m_symmetric_key);
-	
-	m_conversation->send_message(encrypted.encode());
+	size_t chunk_size = c_chat_chunk_size;
+	if (!m_conversation->room()->chunk_messages() && message.size() <= c_max_unchunked_chat_message_size) {
+		chunk_size = message.size();
+	}
+	size_t offset = 0;
+	do {
+		size_t size = std::min(chunk_size, message.size() - offset);
+		
+		UnsignedChatMessage payload;
+		payload.message_id = m_signature_id++;
+		payload.message = message.substr(offset, size);
+		offset += size;
+		
+		std::string signed_payload = PlaintextChatMessage::sign(payload, m_private_key);
+		
+		ChatMessage encrypted = ChatMessage::encrypt(signed_payload, m_key_id, m_cipher);
+		encrypted.partial = offset < message.size();
+		
+		m_conversation->send_message(encrypted.encode());
+	} while (offset < message.size());
 }
 
 void Session::decrypt_message(const std::string& sender, const ChatMessage& encrypted_message)
@@ -58,7 +89,7 @@ void Session::decrypt_message(const std::string& sender, const ChatMessage& encr
 	assert(m_participants.count(sender));
 	
 	try {
-		std::string decrypted_payload = encrypted_message.decrypt(m_symmetric_key);
+		std::string decrypted_payload = encrypted_message.decrypt(m_cipher);
 		
 		PlaintextChatMessage payload = PlaintextChatMessage::decode(decrypted_payload);
 		
@@ -66,10 +97,33 @@ void Session::decrypt_message(const std::string& sender, const ChatMessage& encr
 			return;
 		}
 		
-		if (payload.message_id != m_participants.at(sender).signature_id) {
+		Participant& participant = m_participants.at(sender);
+		if (payload.message_id != participant.signature_id) {
+			participant.partial_message.clear();
 			return;
 		}
-		m_participants[sender].signature_id++;
+		participant.signature_id++;
+		
+		if (
+			   (encrypted_message.partial || !participant.partial_message.empty())
+			&& participant.partial_message.size() + payload.message.size() > c_max_chat_message_size
+		) {
+			participant.partial_message = std::string();
+			participant.discarding_message = true;
+		}
+		if (participant.discarding_message) {
+			participant.discarding_message = encrypted_message.partial;
+			return;
+		}
+		if (encrypted_message.partial) {
+			participant.partial_message += payload.message;
+			return;
+		}
+		if (!participant.partial_message.empty()) {
+			participant.partial_message += payload.message;
+			payload.message.swap(participant.partial_message);
+			participant.partial_message = std::string();
+		}
 		
 		if (m_conversation->interface()) m_conversation->interface()->message_received(sender, payload.message);
 	} catch(MessageFormatException) {}
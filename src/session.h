@@ -21,8 +21,9 @@
 
 #include "crypto.h"
 #include "keyexchange.h"
+#include "participanttable.h"
 
-#include <map>
+#include <vector>
 
 namespace np1sec
 {
@@ -44,12 +45,16 @@ class Session
 		PublicKey long_term_public_key;
 		PublicKey ephemeral_public_key;
 		uint64_t signature_id;
+		// The chunks received so far of a chunked message.
+		std::string partial_message;
+		// The chunked message being received is over the size limit.
+		bool discarding_message;
 	};
 	
 	Conversation* m_conversation;
 	Hash m_key_id;
-	std::map<std::string, Participant> m_participants;
-	SymmetricKey m_symmetric_key;
+	ParticipantTable<Participant> m_participants;
+	SymmetricCipher m_cipher;
 	PrivateKey m_private_key;
 	uint64_t m_signature_id;
 };
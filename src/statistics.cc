@@ -0,0 +1,108 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "statistics.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace np1sec
+{
+
+LatencyHistogram::LatencyHistogram():
+	m_count(0),
+	m_total(0),
+	m_max(0)
+{
+	memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+void LatencyHistogram::add(uint64_t nanoseconds)
+{
+	size_t index = nanoseconds ? 63 - __builtin_clzll(nanoseconds) : 0;
+	if (index >= c_buckets) {
+		index = c_buckets - 1;
+	}
+	m_buckets[index]++;
+	m_count++;
+	m_total += nanoseconds;
+	if (nanoseconds > m_max) {
+		m_max = nanoseconds;
+	}
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+	if (m_count == 0) {
+		return 0;
+	}
+	uint64_t rank = uint64_t(fraction * m_count);
+	if (rank >= m_count) {
+		rank = m_count - 1;
+	}
+	uint64_t seen = 0;
+	for (size_t i = 0; i < c_buckets - 1; i++) {
+		seen += m_buckets[i];
+		if (seen > rank) {
+			uint64_t end = (uint64_t(1) << (i + 1)) - 1;
+			return end < m_max ? end : m_max;
+		}
+	}
+	return m_max;
+}
+
+size_t RoomStatistics::message_type_index(Message::Type type)
+{
+	switch (type) {
+		case Message::Type::Quit: return 0;
+		case Message::Type::Hello: return 1;
+		case Message::Type::RoomAuthenticationRequest: return 2;
+		case Message::Type::RoomAuthentication: return 3;
+		case Message::Type::Batch: return 4;
+		case Message::Type::Invite: return 5;
+		case Message::Type::ConversationStatus: return 6;
+		case Message::Type::ConversationConfirmation: return 7;
+		case Message::Type::InviteAcceptance: return 8;
+		case Message::Type::AuthenticationRequest: return 9;
+		case Message::Type::Authentication: return 10;
+		case Message::Type::AuthenticateInvite: return 11;
+		case Message::Type::CancelInvite: return 12;
+		case Message::Type::Join: return 13;
+		case Message::Type::Leave: return 14;
+		case Message::Type::ConsistencyStatus: return 15;
+		case Message::Type::ConsistencyCheck: return 16;
+		case Message::Type::Timeout: return 17;
+		case Message::Type::Votekick: return 18;
+		case Message::Type::KeyExchangePublicKey: return 19;
+		case Message::Type::KeyExchangeSecretShare: return 20;
+		case Message::Type::KeyExchangeAcceptance: return 21;
+		case Message::Type::KeyExchangeReveal: return 22;
+		case Message::Type::KeyActivation: return 23;
+		case Message::Type::KeyRatchet: return 24;
+		case Message::Type::Chat: return 25;
+		case Message::Type::ChatChunk: return 26;
+	}
+	return c_unknown_message_type;
+}
+
+uint64_t RoomStatistics::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace np1sec
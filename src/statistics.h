@@ -0,0 +1,157 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SRC_STATISTICS_H_
+#define SRC_STATISTICS_H_
+
+#include "message.h"
+
+#include <cstdint>
+
+namespace np1sec
+{
+
+/*
+ * A histogram of durations in nanoseconds, in power of two buckets:
+ * bucket i counts the samples in [2^i, 2^(i+1)), with 0 counted in
+ * bucket 0 and anything beyond the last bucket in the last. Adding a
+ * sample is a handful of instructions and no allocation.
+ */
+class LatencyHistogram
+{
+	public:
+	static const size_t c_buckets = 40;
+
+	LatencyHistogram();
+
+	void add(uint64_t nanoseconds);
+
+	uint64_t count() const
+	{
+		return m_count;
+	}
+
+	uint64_t total() const
+	{
+		return m_total;
+	}
+
+	uint64_t max() const
+	{
+		return m_max;
+	}
+
+	uint64_t bucket(size_t index) const
+	{
+		return m_buckets[index];
+	}
+
+	/*
+	 * An upper bound of the fraction \p fraction (between 0 and 1) of the
+	 * samples: the end of the bucket that sample falls into, or max() if
+	 * that is lower. 0 if there are no samples.
+	 */
+	uint64_t percentile(double fraction) const;
+
+	protected:
+	uint64_t m_count;
+	uint64_t m_total;
+	uint64_t m_max;
+	uint64_t m_buckets[c_buckets];
+};
+
+struct MessageTypeStatistics
+{
+	/*
+	 * Protocol messages of this type, and their payload sizes. Inbound
+	 * messages include our own, as echoed back by the channel.
+	 */
+	uint64_t messages_in = 0;
+	uint64_t payload_bytes_in = 0;
+	uint64_t messages_out = 0;
+	uint64_t payload_bytes_out = 0;
+
+	/* Time spent processing an inbound message, not counting decoding and signature verification. */
+	LatencyHistogram handler_time;
+};
+
+struct TimerStatistics
+{
+	/* Protocol deadlines, such as event timeouts and ratchets. */
+	uint64_t deadlines_set = 0;
+	uint64_t deadlines_expired = 0;
+	/* Timers requested from RoomInterface::set_timer, and the callbacks run. */
+	uint64_t host_timers_armed = 0;
+	uint64_t host_timers_fired = 0;
+};
+
+/**
+ * What a Room has been doing since it was created, or since
+ * Room::reset_statistics. Recording is always on; it costs a few clock
+ * readings and counter updates per message, against the milliseconds of
+ * cryptography most messages take.
+ */
+struct RoomStatistics
+{
+	/* Messages through RoomInterface::send_message and Room::message_received, and their sizes. */
+	uint64_t transport_messages_in = 0;
+	uint64_t transport_bytes_in = 0;
+	uint64_t transport_messages_out = 0;
+	uint64_t transport_bytes_out = 0;
+
+	/*
+	 * Per protocol message, with batches counted as the messages they
+	 * contain. Each Message::Type has a slot; type bytes outside it, which
+	 * a peer may send, share the last one.
+	 */
+	static const size_t c_message_types = 28;
+	static const size_t c_unknown_message_type = c_message_types - 1;
+	MessageTypeStatistics message_types[c_message_types];
+
+	static size_t message_type_index(Message::Type type);
+
+	MessageTypeStatistics& message_type(Message::Type type)
+	{
+		return message_types[message_type_index(type)];
+	}
+
+	const MessageTypeStatistics& message_type(Message::Type type) const
+	{
+		return message_types[message_type_index(type)];
+	}
+
+	/* Parsing the framing, batches and signed conversation messages. */
+	LatencyHistogram decode_time;
+	/* One sample per conversation message signature checked. */
+	LatencyHistogram verify_time;
+
+	/* Key exchanges this user took part in, and those that produced a session. */
+	uint64_t key_exchanges_started = 0;
+	uint64_t key_exchanges_completed = 0;
+	/* From the start of a key exchange to its session becoming active for every participant. */
+	LatencyHistogram activation_time;
+
+	TimerStatistics timers;
+
+	/* A monotonic clock, in nanoseconds, used for all of the above. */
+	static uint64_t now();
+};
+
+} // namespace np1sec
+
+#endif
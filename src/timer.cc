@@ -0,0 +1,223 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "timer.h"
+
+#include <cstdint>
+#include <new>
+
+namespace np1sec
+{
+
+/*
+ * Blocks are grouped in size classes of c_size_class_granularity bytes;
+ * larger bodies, which would need an unusually big lambda capture, bypass
+ * the pool. At most c_max_free_blocks blocks per class are kept for reuse.
+ */
+const size_t c_size_class_granularity = 32;
+const size_t c_size_classes = 8;
+const size_t c_max_free_blocks = 1024;
+
+namespace {
+
+struct FreeBlock
+{
+	FreeBlock* next;
+};
+
+struct FreeLists
+{
+	FreeBlock* heads[c_size_classes];
+	size_t sizes[c_size_classes];
+
+	FreeLists()
+	{
+		for (size_t i = 0; i < c_size_classes; i++) {
+			heads[i] = nullptr;
+			sizes[i] = 0;
+		}
+	}
+
+	~FreeLists();
+};
+
+/*
+ * A body may be freed by a thread whose free lists have already been
+ * destroyed, in which case it goes straight back to the heap.
+ */
+thread_local bool free_lists_destroyed = false;
+thread_local FreeLists free_lists;
+
+FreeLists::~FreeLists()
+{
+	for (size_t i = 0; i < c_size_classes; i++) {
+		while (heads[i]) {
+			FreeBlock* block = heads[i];
+			heads[i] = block->next;
+			::operator delete(block);
+		}
+	}
+	free_lists_destroyed = true;
+}
+
+size_t size_class(size_t size)
+{
+	return (size + c_size_class_granularity - 1) / c_size_class_granularity - 1;
+}
+
+} // namespace
+
+void* TimerBodyPool::allocate(size_t size)
+{
+	size_t index = size_class(size);
+	if (index >= c_size_classes) {
+		return ::operator new(size);
+	}
+
+	if (!free_lists_destroyed) {
+		FreeLists& lists = free_lists;
+		if (lists.heads[index]) {
+			FreeBlock* block = lists.heads[index];
+			lists.heads[index] = block->next;
+			lists.sizes[index]--;
+			return block;
+		}
+	}
+	return ::operator new((index + 1) * c_size_class_granularity);
+}
+
+void TimerBodyPool::deallocate(void* pointer, size_t size)
+{
+	size_t index = size_class(size);
+	if (index >= c_size_classes || free_lists_destroyed) {
+		::operator delete(pointer);
+		return;
+	}
+
+	FreeLists& lists = free_lists;
+	if (lists.sizes[index] >= c_max_free_blocks) {
+		::operator delete(pointer);
+		return;
+	}
+	FreeBlock* block = static_cast<FreeBlock*>(pointer);
+	block->next = lists.heads[index];
+	lists.heads[index] = block;
+	lists.sizes[index]++;
+}
+
+DeadlineQueue::DeadlineQueue(RoomInterface* interface, uint32_t granularity, TimerStatistics* statistics):
+	m_interface(interface),
+	m_granularity(granularity),
+	m_statistics(statistics),
+	m_timer_deadline(0),
+	m_destroyed(nullptr)
+{}
+
+DeadlineQueue::~DeadlineQueue()
+{
+	assert(m_deadlines.empty());
+	if (m_destroyed) {
+		*m_destroyed = true;
+	}
+}
+
+void DeadlineQueue::insert(Deadline::Body* body, uint32_t timeout)
+{
+	if (m_statistics) {
+		m_statistics->deadlines_set++;
+	}
+	uint64_t now = m_interface->current_time();
+	body->position = m_deadlines.insert(m_deadlines.end(), std::make_pair(now + timeout, body));
+	if (!m_timer.active() || expiry(now + timeout) < m_timer_deadline) {
+		arm(now);
+	}
+}
+
+/*
+ * Cancelling the earliest deadline leaves the host timer armed; when it
+ * fires early, expire() finds nothing due and moves it to the next one.
+ */
+void DeadlineQueue::remove(Deadline::Body* body)
+{
+	m_deadlines.erase(body->position);
+	if (m_deadlines.empty()) {
+		m_timer.stop();
+	}
+}
+
+void DeadlineQueue::expire()
+{
+	bool destroyed = false;
+	m_destroyed = &destroyed;
+	
+	uint64_t now = m_interface->current_time();
+	while (!m_deadlines.empty() && m_deadlines.begin()->first <= now) {
+		Deadline::Body* body = m_deadlines.begin()->second;
+		m_deadlines.erase(m_deadlines.begin());
+		body->deadline->m_body = nullptr;
+		if (m_statistics) {
+			m_statistics->deadlines_expired++;
+		}
+		body->execute_payload();
+		delete body;
+		if (destroyed) {
+			return;
+		}
+	}
+	
+	m_destroyed = nullptr;
+	arm(now);
+}
+
+void DeadlineQueue::arm(uint64_t now)
+{
+	if (m_deadlines.empty()) {
+		m_timer.stop();
+		return;
+	}
+	
+	uint64_t deadline = expiry(m_deadlines.begin()->first);
+	if (m_timer.active() && m_timer_deadline <= deadline) {
+		return;
+	}
+	
+	uint64_t interval = deadline > now ? deadline - now : 0;
+	if (interval > UINT32_MAX) {
+		interval = UINT32_MAX;
+	}
+	m_timer_deadline = deadline;
+	if (m_statistics) {
+		m_statistics->host_timers_armed++;
+	}
+	m_timer = Timer(m_interface, uint32_t(interval), [this] {
+		if (m_statistics) {
+			m_statistics->host_timers_fired++;
+		}
+		expire();
+	});
+}
+
+uint64_t DeadlineQueue::expiry(uint64_t deadline) const
+{
+	if (m_granularity <= 1) {
+		return deadline;
+	}
+	return (deadline + m_granularity - 1) / m_granularity * m_granularity;
+}
+
+} // namespace np1sec
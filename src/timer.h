@@ -20,13 +20,29 @@
 #define SRC_TIMER_H_
 
 #include "interface.h"
+#include "statistics.h"
 
 #include <cassert>
+#include <cstddef>
+#include <map>
 #include <utility>
 
 namespace np1sec
 {
 
+/*
+ * Allocator for timer bodies. Conversations create and cancel timers
+ * constantly, and the bodies come in a handful of sizes, so freed blocks
+ * are kept on per-thread free lists by size class and reused rather than
+ * returned to the heap.
+ */
+class TimerBodyPool
+{
+	public:
+	static void* allocate(size_t size);
+	static void deallocate(void* pointer, size_t size);
+};
+
 class Timer
 {
 	protected:
@@ -44,6 +60,16 @@ class Timer
 		virtual void execute_payload() = 0;
 		TimerToken* token;
 		Timer* timer;
+		
+		static void* operator new(size_t size)
+		{
+			return TimerBodyPool::allocate(size);
+		}
+		
+		static void operator delete(void* pointer, size_t size)
+		{
+			TimerBodyPool::deallocate(pointer, size);
+		}
 	};
 	
 	public:
@@ -127,6 +153,175 @@ class Timer
 	Body* m_body;
 };
 
+class DeadlineQueue;
+
+/*
+ * A timer set in a DeadlineQueue rather than directly with the host.
+ * Behaves like Timer otherwise.
+ */
+class Deadline
+{
+	protected:
+	class Body
+	{
+		public:
+		virtual ~Body() {}
+		virtual void execute_payload() = 0;
+		Deadline* deadline;
+		std::multimap<uint64_t, Body*>::iterator position;
+		
+		static void* operator new(size_t size)
+		{
+			return TimerBodyPool::allocate(size);
+		}
+		
+		static void operator delete(void* pointer, size_t size)
+		{
+			TimerBodyPool::deallocate(pointer, size);
+		}
+	};
+	
+	public:
+	Deadline():
+		m_queue(nullptr),
+		m_body(nullptr)
+	{}
+	
+	template<class Function>
+	Deadline(DeadlineQueue* queue, uint32_t timeout, Function function);
+	
+	Deadline(Deadline&& other):
+		m_queue(nullptr),
+		m_body(nullptr)
+	{
+		(*this) = std::move(other);
+	}
+	
+	Deadline& operator=(Deadline&& other)
+	{
+		if (&other != this) {
+			stop();
+			m_queue = other.m_queue;
+			m_body = other.m_body;
+			if (m_body) {
+				m_body->deadline = this;
+			}
+			other.m_body = nullptr;
+		}
+		return *this;
+	}
+	
+	~Deadline()
+	{
+		stop();
+	}
+	
+	inline void stop();
+	
+	bool active() const
+	{
+		return m_body != nullptr;
+	}
+	
+	protected:
+	friend class DeadlineQueue;
+	
+	DeadlineQueue* m_queue;
+	Body* m_body;
+};
+
+/*
+ * A set of deadlines that share a single host timer, armed for the
+ * earliest of them. Conversations declare an event timeout for every
+ * event and a status deadline for every participant, nearly all with the
+ * same interval; queueing them costs a map insertion instead of a host
+ * timer each, and the host timer only needs to be moved when a deadline
+ * earlier than all others is set.
+ *
+ * The host timer is armed for the end of the granularity period in
+ * which the earliest deadline falls, so that deadlines set in a burst
+ * expire together; a deadline never expires early, and at most one
+ * granularity period late.
+ *
+ * The queue must outlive the Deadlines set in it.
+ */
+class DeadlineQueue
+{
+	public:
+	static const uint32_t c_default_granularity = 250;
+	
+	/*
+	 * If \p statistics is set, the deadlines and host timers of the queue
+	 * are counted in it.
+	 */
+	explicit DeadlineQueue(RoomInterface* interface, uint32_t granularity = c_default_granularity, TimerStatistics* statistics = nullptr);
+	~DeadlineQueue();
+	
+	DeadlineQueue(const DeadlineQueue&) = delete;
+	DeadlineQueue& operator=(const DeadlineQueue&) = delete;
+	
+	size_t size() const
+	{
+		return m_deadlines.size();
+	}
+	
+	protected:
+	friend class Deadline;
+	
+	void insert(Deadline::Body* body, uint32_t timeout);
+	void remove(Deadline::Body* body);
+	void expire();
+	void arm(uint64_t now);
+	uint64_t expiry(uint64_t deadline) const;
+	
+	protected:
+	RoomInterface* m_interface;
+	uint32_t m_granularity;
+	TimerStatistics* m_statistics;
+	std::multimap<uint64_t, Deadline::Body*> m_deadlines;
+	
+	Timer m_timer;
+	uint64_t m_timer_deadline;
+	
+	// Points to a flag in expire() while it runs, to detect the queue being destroyed by a callback.
+	bool* m_destroyed;
+};
+
+template<class Function>
+Deadline::Deadline(DeadlineQueue* queue, uint32_t timeout, Function function):
+	m_queue(queue)
+{
+	class Payload : public Body
+	{
+		protected:
+		Function m_function;
+		
+		public:
+		Payload(const Function& function):
+			m_function(function)
+		{}
+		
+		void execute_payload()
+		{
+			m_function();
+		}
+	};
+	
+	m_body = new Payload(function);
+	m_body->deadline = this;
+	m_queue->insert(m_body, timeout);
+}
+
+void Deadline::stop()
+{
+	if (m_body) {
+		assert(m_body->deadline == this);
+		m_queue->remove(m_body);
+		delete m_body;
+		m_body = nullptr;
+	}
+}
+
 } // namespace np1sec
 
 #endif
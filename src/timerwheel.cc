@@ -0,0 +1,265 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "timerwheel.h"
+
+#include <cassert>
+
+namespace np1sec
+{
+
+const size_t c_timer_wheel_slab_size = 64;
+
+/* The number of steps spanned by a slot of the given level. */
+static uint64_t level_span(size_t level)
+{
+	return uint64_t(1) << (c_timer_wheel_slot_bits * level);
+}
+
+TimerWheel::TimerWheel(uint32_t resolution, uint64_t now):
+	m_resolution(resolution),
+	m_origin(now),
+	m_tick(0),
+	m_remainder(0),
+	m_size(0),
+	m_advancing(false),
+	m_slots(c_timer_wheel_levels * c_timer_wheel_slots),
+	m_free_entries(nullptr)
+{
+	assert(resolution > 0);
+	for (Link& slot : m_slots) {
+		link_init(&slot);
+	}
+}
+
+TimerWheel::~TimerWheel()
+{
+	// Pending timers are dropped without executing; their entries are freed with the slabs.
+}
+
+TimerToken* TimerWheel::set_timer(uint32_t interval, TimerCallback* callback)
+{
+	/*
+	 * The timer is due at the first step boundary at least interval
+	 * milliseconds from now, where now is m_remainder milliseconds past
+	 * the boundary of step m_tick.
+	 */
+	uint64_t steps = (uint64_t(m_remainder) + interval + m_resolution - 1) / m_resolution;
+	if (steps == 0) {
+		steps = 1;
+	}
+
+	Entry* entry = allocate_entry();
+	entry->callback = callback;
+	entry->deadline = m_tick + steps;
+	schedule(entry);
+	m_size++;
+	return entry;
+}
+
+void TimerWheel::poll(uint64_t now)
+{
+	assert(now >= this->now());
+	advance(now - this->now());
+}
+
+void TimerWheel::advance(uint64_t milliseconds)
+{
+	assert(!m_advancing);
+	m_advancing = true;
+
+	uint64_t remaining = uint64_t(m_remainder) + milliseconds;
+	// Callbacks run at the boundary of the step being processed.
+	m_remainder = 0;
+	while (remaining >= m_resolution) {
+		remaining -= m_resolution;
+		m_tick++;
+
+		/*
+		 * Every time a level's slot comes around, its timers move to the
+		 * levels below, the lowest of which holds exactly the timers due
+		 * in this step.
+		 */
+		for (size_t level = c_timer_wheel_levels - 1; level > 0; level--) {
+			if ((m_tick & (level_span(level) - 1)) == 0) {
+				cascade(level);
+			}
+		}
+
+		/*
+		 * Unlink the expired timers first, so that the callbacks are free
+		 * to set new timers or cancel expired ones.
+		 */
+		Link expired;
+		link_init(&expired);
+		Link* slot = &m_slots[m_tick & (c_timer_wheel_slots - 1)];
+		while (slot->next != slot) {
+			Link* link = slot->next;
+			link_remove(link);
+			link_append(&expired, link);
+		}
+
+		while (expired.next != &expired) {
+			Entry* entry = static_cast<Entry*>(expired.next);
+			assert(entry->deadline == m_tick);
+			TimerCallback* callback = entry->callback;
+			link_remove(entry);
+			release_entry(entry);
+			m_size--;
+			callback->execute();
+		}
+	}
+	m_remainder = remaining;
+
+	m_advancing = false;
+}
+
+/*
+ * The slot of a level that comes around first holds the earliest timers
+ * on that level; for level 0 that is their expiry, and for upper levels
+ * the step at which they cascade down, which is no later.
+ */
+uint64_t TimerWheel::next_expiry() const
+{
+	if (m_size == 0) {
+		return UINT64_MAX;
+	}
+
+	uint64_t step = UINT64_MAX;
+	for (size_t level = 0; level < c_timer_wheel_levels; level++) {
+		uint64_t position = m_tick >> (c_timer_wheel_slot_bits * level);
+		for (size_t i = 1; i <= c_timer_wheel_slots; i++) {
+			const Link* slot = &m_slots[level * c_timer_wheel_slots + ((position + i) & (c_timer_wheel_slots - 1))];
+			if (slot->next != slot) {
+				uint64_t slot_step = (position + i) << (c_timer_wheel_slot_bits * level);
+				if (slot_step < step) {
+					step = slot_step;
+				}
+				break;
+			}
+		}
+	}
+	return m_origin + step * m_resolution;
+}
+
+void TimerWheel::Entry::unset()
+{
+	wheel->cancel(this);
+}
+
+void TimerWheel::link_init(Link* list)
+{
+	list->previous = list;
+	list->next = list;
+}
+
+void TimerWheel::link_append(Link* list, Link* link)
+{
+	link->previous = list->previous;
+	link->next = list;
+	list->previous->next = link;
+	list->previous = link;
+}
+
+void TimerWheel::link_remove(Link* link)
+{
+	link->previous->next = link->next;
+	link->next->previous = link->previous;
+	link->previous = nullptr;
+	link->next = nullptr;
+}
+
+/*
+ * A timer goes to the lowest level whose span covers its distance, in the
+ * slot that comes around when the remaining distance fits the level below.
+ * Timers beyond the top level wait in its furthest slot and are
+ * rescheduled when that slot comes around.
+ */
+void TimerWheel::schedule(Entry* entry)
+{
+	assert(entry->deadline > m_tick);
+	uint64_t distance = entry->deadline - m_tick;
+	uint64_t position = entry->deadline;
+
+	size_t level = 0;
+	while (level < c_timer_wheel_levels - 1 && distance >= level_span(level + 1)) {
+		level++;
+	}
+	if (distance >= level_span(c_timer_wheel_levels)) {
+		position = m_tick + level_span(c_timer_wheel_levels) - 1;
+	}
+
+	size_t slot = (position >> (c_timer_wheel_slot_bits * level)) & (c_timer_wheel_slots - 1);
+	link_append(&m_slots[level * c_timer_wheel_slots + slot], entry);
+}
+
+void TimerWheel::cascade(size_t level)
+{
+	size_t slot = (m_tick >> (c_timer_wheel_slot_bits * level)) & (c_timer_wheel_slots - 1);
+	Link* list = &m_slots[level * c_timer_wheel_slots + slot];
+	Link pending;
+	link_init(&pending);
+	while (list->next != list) {
+		Link* link = list->next;
+		link_remove(link);
+		link_append(&pending, link);
+	}
+	while (pending.next != &pending) {
+		Entry* entry = static_cast<Entry*>(pending.next);
+		link_remove(entry);
+		if (entry->deadline == m_tick) {
+			link_append(&m_slots[m_tick & (c_timer_wheel_slots - 1)], entry);
+		} else {
+			schedule(entry);
+		}
+	}
+}
+
+TimerWheel::Entry* TimerWheel::allocate_entry()
+{
+	if (!m_free_entries) {
+		std::unique_ptr<Entry[]> slab(new Entry[c_timer_wheel_slab_size]);
+		for (size_t i = 0; i < c_timer_wheel_slab_size; i++) {
+			slab[i].wheel = this;
+			release_entry(&slab[i]);
+		}
+		m_slabs.push_back(std::move(slab));
+	}
+
+	Entry* entry = m_free_entries;
+	m_free_entries = static_cast<Entry*>(entry->next);
+	entry->next = nullptr;
+	return entry;
+}
+
+void TimerWheel::release_entry(Entry* entry)
+{
+	entry->callback = nullptr;
+	entry->next = m_free_entries;
+	m_free_entries = entry;
+}
+
+void TimerWheel::cancel(Entry* entry)
+{
+	assert(entry->callback);
+	link_remove(entry);
+	release_entry(entry);
+	m_size--;
+}
+
+} // namespace np1sec
@@ -0,0 +1,152 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SRC_TIMERWHEEL_H_
+#define SRC_TIMERWHEEL_H_
+
+#include "interface.h"
+
+#include <memory>
+#include <vector>
+
+namespace np1sec
+{
+
+const size_t c_timer_wheel_slot_bits = 6;
+const size_t c_timer_wheel_slots = size_t(1) << c_timer_wheel_slot_bits;
+const size_t c_timer_wheel_levels = 4;
+
+/**
+ * A reference implementation of RoomInterface::set_timer for hosts that
+ * drive their own clock.
+ *
+ * Timers are kept in a hierarchical timing wheel: c_timer_wheel_levels
+ * levels of c_timer_wheel_slots slots each, where a slot of level n spans
+ * c_timer_wheel_slots^n resolution steps. Setting and cancelling a timer
+ * takes constant time, a timer is moved down a level at most once per
+ * level before it fires, and tokens are recycled rather than allocated per
+ * timer. With the default 1ms resolution the wheel covers about 4.6 hours
+ * directly; timers further away are parked in the last slot of the top
+ * level until they come into range.
+ *
+ * The wheel is single-threaded. The host forwards RoomInterface::set_timer
+ * to TimerWheel::set_timer and calls TimerWheel::poll from its event loop
+ * with the current time of a monotonic millisecond clock. A timer fires no
+ * earlier than its interval, and at most one resolution step late; the
+ * order among timers that expire in the same step is unspecified. The
+ * wheel must outlive every room using it.
+ */
+class TimerWheel
+{
+	public:
+	/**
+	 * \param resolution Length of a wheel step, in milliseconds.
+	 * \param now The current time, on the clock later passed to poll().
+	 */
+	explicit TimerWheel(uint32_t resolution = 1, uint64_t now = 0);
+	~TimerWheel();
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	TimerToken* set_timer(uint32_t interval, TimerCallback* callback);
+
+	/**
+	 * Execute the callbacks of all timers that have expired by \p now,
+	 * which must not be earlier than the time of the previous call.
+	 *
+	 * Callbacks may set and cancel timers, but must not call poll() or
+	 * advance().
+	 */
+	void poll(uint64_t now);
+
+	/**
+	 * Equivalent to poll(now() + milliseconds).
+	 */
+	void advance(uint64_t milliseconds);
+
+	/**
+	 * The time of the wheel's clock. Inside a callback, this is the
+	 * boundary of the step in which the timer expired.
+	 */
+	uint64_t now() const
+	{
+		return m_origin + m_tick * m_resolution + m_remainder;
+	}
+
+	/**
+	 * A time before which poll() runs no callback: the expiry of the
+	 * earliest timer, or earlier when that timer is still on an upper
+	 * level. UINT64_MAX when no timer is set. Hosts can sleep until then.
+	 */
+	uint64_t next_expiry() const;
+
+	/**
+	 * The number of timers that are set and have not fired yet.
+	 */
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	protected:
+	struct Link
+	{
+		Link* previous;
+		Link* next;
+	};
+
+	class Entry : public Link, public TimerToken
+	{
+		public:
+		void unset();
+
+		TimerWheel* wheel;
+		TimerCallback* callback;
+		uint64_t deadline;
+	};
+
+	static void link_init(Link* list);
+	static void link_append(Link* list, Link* link);
+	static void link_remove(Link* link);
+
+	void schedule(Entry* entry);
+	void cascade(size_t level);
+	Entry* allocate_entry();
+	void release_entry(Entry* entry);
+	void cancel(Entry* entry);
+
+	protected:
+	uint32_t m_resolution;
+	uint64_t m_origin;
+	uint64_t m_tick;
+	uint32_t m_remainder;
+	size_t m_size;
+	bool m_advancing;
+
+	/* m_slots[level * c_timer_wheel_slots + slot] */
+	std::vector<Link> m_slots;
+
+	/* Entries are allocated in slabs, and unused ones are chained through Link::next. */
+	std::vector<std::unique_ptr<Entry[]>> m_slabs;
+	Entry* m_free_entries;
+};
+
+} // namespace np1sec
+
+#endif
@@ -0,0 +1,129 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "trace.h"
+
+#include <cstdio>
+
+namespace np1sec
+{
+
+ChromeTraceWriter::ChromeTraceWriter(std::ostream& stream, bool host_time):
+	m_stream(stream),
+	m_host_time(host_time),
+	m_first(true)
+{
+	m_stream << "[";
+}
+
+ChromeTraceWriter::~ChromeTraceWriter()
+{
+	m_stream << "\n]\n";
+	m_stream.flush();
+}
+
+void ChromeTraceWriter::trace(const TraceEvent& event)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	size_t pid = process_id(event.room);
+
+	const char* phase;
+	switch (event.type) {
+		case TraceEvent::Type::Begin:
+			phase = "b";
+			break;
+		case TraceEvent::Type::End:
+			phase = "e";
+			break;
+		case TraceEvent::Type::Instant:
+			phase = event.id.empty() ? "i" : "n";
+			break;
+		case TraceEvent::Type::Complete:
+		default:
+			phase = "X";
+			break;
+	}
+
+	char timestamp[32];
+	if (m_host_time) {
+		snprintf(timestamp, sizeof(timestamp), "%llu", (unsigned long long) event.host_time * 1000);
+	} else {
+		snprintf(timestamp, sizeof(timestamp), "%.3f", event.time / 1000.0);
+	}
+
+	m_stream << (m_first ? "\n" : ",\n");
+	m_first = false;
+	m_stream << "{\"name\": ";
+	write_string(event.name);
+	m_stream << ", \"cat\": \"np1sec\", \"ph\": \"" << phase << "\", \"pid\": " << pid << ", \"tid\": 0, \"ts\": " << timestamp;
+	if (event.type == TraceEvent::Type::Complete) {
+		char duration[32];
+		snprintf(duration, sizeof(duration), "%.3f", event.duration / 1000.0);
+		m_stream << ", \"dur\": " << duration;
+	}
+	if (!event.id.empty()) {
+		m_stream << ", \"id2\": {\"local\": ";
+		write_string(event.id);
+		m_stream << "}";
+	} else if (event.type == TraceEvent::Type::Instant) {
+		m_stream << ", \"s\": \"p\"";
+	}
+	m_stream << ", \"args\": {\"participant\": ";
+	write_string(event.participant);
+	m_stream << ", \"detail\": ";
+	write_string(event.detail);
+	m_stream << "}}";
+}
+
+void ChromeTraceWriter::write_string(const std::string& string)
+{
+	m_stream << '"';
+	for (char c : string) {
+		if (c == '"' || c == '\\') {
+			m_stream << '\\' << c;
+		} else if ((unsigned char) c < 0x20) {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char) c);
+			m_stream << escape;
+		} else {
+			m_stream << c;
+		}
+	}
+	m_stream << '"';
+}
+
+size_t ChromeTraceWriter::process_id(const std::string& room)
+{
+	auto it = m_processes.find(room);
+	if (it != m_processes.end()) {
+		return it->second;
+	}
+
+	size_t pid = m_processes.size() + 1;
+	m_processes[room] = pid;
+
+	m_stream << (m_first ? "\n" : ",\n");
+	m_first = false;
+	m_stream << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid << ", \"args\": {\"name\": ";
+	write_string(room);
+	m_stream << "}}";
+	return pid;
+}
+
+} // namespace np1sec
@@ -0,0 +1,131 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SRC_TRACE_H_
+#define SRC_TRACE_H_
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace np1sec
+{
+
+/*
+ * A point in, or the start or end of, the lifecycle of a key exchange or
+ * session, as seen by one room.
+ *
+ * key_exchange spans run from the moment a room learns of a key exchange
+ * until it is dropped, whether it produced a session or not. In between,
+ * every contribution of a participant is an instant named after it
+ * (public_key, secret_share, key_hash, private_key), except the one that
+ * completes a phase: that is a complete event named after the finish_*
+ * step it triggered, attributed to the participant everyone was waiting
+ * for. session_activation spans run from the creation of a session until
+ * every participant activated it, with an activation instant per
+ * participant and a joined_chat instant when it is our first session.
+ * Ratchets show as send_ratchet and ratchet instants.
+ */
+struct TraceEvent
+{
+	enum class Type {
+		Begin,
+		End,
+		Instant,
+		/* An operation that took duration nanoseconds, starting at time and host_time. */
+		Complete,
+	};
+
+	Type type;
+	/* A string literal naming the event. */
+	const char* name;
+	/* Identifies the span the event belongs to: a key exchange or session, in hex. */
+	std::string id;
+	/* The user of the room reporting the event. */
+	std::string room;
+	/* The participant the event is about, if any. */
+	std::string participant;
+	std::string detail;
+	/* RoomInterface::current_time(), in milliseconds. */
+	uint64_t host_time;
+	/* RoomStatistics::now(), in nanoseconds. */
+	uint64_t time;
+	uint64_t duration;
+};
+
+/*
+ * When an operation reported as a TraceEvent::Type::Complete started, on
+ * both of the event's clocks.
+ */
+struct TraceTime
+{
+	uint64_t host_time = 0;
+	uint64_t time = 0;
+};
+
+class TraceSink
+{
+	public:
+	virtual ~TraceSink() {}
+
+	/*
+	 * Called synchronously from the room, on the thread that runs it.
+	 * Rooms of a RoomHost can share a sink from several workers.
+	 */
+	virtual void trace(const TraceEvent& event) = 0;
+};
+
+/**
+ * Writes trace events in the Chrome trace event format, which the
+ * chrome://tracing and Perfetto viewers load. Each room is shown as a
+ * process named after its user, and spans as async events whose ids are
+ * local to that process, so rooms sharing a key exchange keep apart.
+ *
+ * The JSON array is completed when the writer is destroyed.
+ */
+class ChromeTraceWriter : public TraceSink
+{
+	public:
+	/*
+	 * If \p host_time is set, events are placed on the host's clock,
+	 * as given by RoomInterface::current_time, rather than the
+	 * monotonic one. Simulated hosts want this. Durations are always
+	 * measured on the monotonic clock.
+	 */
+	explicit ChromeTraceWriter(std::ostream& stream, bool host_time = false);
+	~ChromeTraceWriter();
+
+	void trace(const TraceEvent& event) override;
+
+	protected:
+	void write_string(const std::string& string);
+	size_t process_id(const std::string& room);
+
+	protected:
+	std::mutex m_mutex;
+	std::ostream& m_stream;
+	bool m_host_time;
+	bool m_first;
+	std::map<std::string, size_t> m_processes;
+};
+
+} // namespace np1sec
+
+#endif
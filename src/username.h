@@ -0,0 +1,202 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SRC_USERNAME_H_
+#define SRC_USERNAME_H_
+
+#include <cassert>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace np1sec
+{
+
+class UsernameTable;
+
+/*
+ * A reference-counted handle to a username interned in a room's
+ * UsernameTable. The name is released from the table when its last handle
+ * goes away.
+ *
+ * Two handles from the same table are equal iff they name the same user,
+ * which is a pointer comparison. Handles are ordered by identity rather
+ * than alphabetically, so containers of handles must not be relied upon
+ * for a canonical order; convert to strings for anything that ends up on
+ * the wire. Handles from different rooms must not be mixed, and no handle
+ * may outlive its table.
+ */
+class Username
+{
+	public:
+	Username():
+		m_entry(nullptr)
+	{}
+
+	Username(const Username& other):
+		m_entry(other.m_entry)
+	{
+		if (m_entry) {
+			m_entry->references++;
+		}
+	}
+
+	Username(Username&& other):
+		m_entry(other.m_entry)
+	{
+		other.m_entry = nullptr;
+	}
+
+	Username& operator=(Username other)
+	{
+		std::swap(m_entry, other.m_entry);
+		return *this;
+	}
+
+	~Username()
+	{
+		release();
+	}
+
+	bool is_null() const
+	{
+		return m_entry == nullptr;
+	}
+
+	const std::string& str() const
+	{
+		assert(m_entry);
+		return *m_entry->name;
+	}
+
+	operator const std::string&() const
+	{
+		return str();
+	}
+
+	bool operator==(const Username& other) const
+	{
+		return m_entry == other.m_entry;
+	}
+
+	bool operator!=(const Username& other) const
+	{
+		return m_entry != other.m_entry;
+	}
+
+	bool operator<(const Username& other) const
+	{
+		return std::less<const Entry*>()(m_entry, other.m_entry);
+	}
+
+	size_t hash() const
+	{
+		return std::hash<const Entry*>()(m_entry);
+	}
+
+	protected:
+	friend class UsernameTable;
+
+	struct Entry
+	{
+		const std::string* name;
+		size_t references;
+		UsernameTable* table;
+	};
+
+	explicit Username(Entry* entry):
+		m_entry(entry)
+	{
+		m_entry->references++;
+	}
+
+	inline void release();
+
+	Entry* m_entry;
+};
+
+/*
+ * The set of usernames a room currently holds handles to. Memory grows with
+ * the number of distinct users referenced by live handles, not with the
+ * number of references to them, nor with every name that was ever seen.
+ */
+class UsernameTable
+{
+	public:
+	UsernameTable() = default;
+	UsernameTable(const UsernameTable&) = delete;
+	UsernameTable& operator=(const UsernameTable&) = delete;
+
+	~UsernameTable()
+	{
+		assert(m_usernames.empty());
+	}
+
+	Username intern(const std::string& username)
+	{
+		auto it = m_usernames.find(username);
+		if (it == m_usernames.end()) {
+			it = m_usernames.emplace(username, Username::Entry{nullptr, 0, this}).first;
+			it->second.name = &it->first;
+		}
+		return Username(&it->second);
+	}
+
+	size_t size() const
+	{
+		return m_usernames.size();
+	}
+
+	protected:
+	friend class Username;
+
+	void release(const std::string& username)
+	{
+		m_usernames.erase(m_usernames.find(username));
+	}
+
+	// unordered_map nodes never move, so the handles stay valid across rehashes.
+	std::unordered_map<std::string, Username::Entry> m_usernames;
+};
+
+void Username::release()
+{
+	if (m_entry && --m_entry->references == 0) {
+		m_entry->table->release(*m_entry->name);
+	}
+	m_entry = nullptr;
+}
+
+} // namespace np1sec
+
+namespace std
+{
+
+template<>
+struct hash<np1sec::Username>
+{
+	size_t operator()(const np1sec::Username& username) const
+	{
+		return username.hash();
+	}
+};
+
+} // namespace std
+
+#endif
@@ -0,0 +1,92 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Compares the throughput of the base64 codecs supported by this CPU on
+ * message-sized inputs. Run as: base64_benchmark [megabytes per input size]
+ */
+
+#include "src/base64.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace np1sec;
+
+static volatile size_t sink;
+
+static double megabytes_per_second(size_t bytes, std::chrono::steady_clock::duration elapsed)
+{
+	double seconds = std::chrono::duration<double>(elapsed).count();
+	return bytes / seconds / (1024 * 1024);
+}
+
+static void benchmark(Base64Codec codec, size_t size, size_t iterations)
+{
+	std::vector<unsigned char> data(size);
+	for (size_t i = 0; i < size; i++) {
+		data[i] = (unsigned char)(i * 151 + 7);
+	}
+	std::vector<char> encoded(((size + 2) / 3) * 4);
+	std::vector<unsigned char> decoded(size + 3);
+	
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		sink = base64_encode(encoded.data(), data.data(), size, codec);
+	}
+	std::chrono::steady_clock::duration encode_time = std::chrono::steady_clock::now() - start;
+	
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		size_t decoded_size;
+		if (!base64_decode(decoded.data(), encoded.data(), encoded.size(), &decoded_size, codec)) {
+			std::fprintf(stderr, "%s: decoding failed\n", base64_codec_name(codec));
+			std::exit(1);
+		}
+		sink = decoded_size;
+	}
+	std::chrono::steady_clock::duration decode_time = std::chrono::steady_clock::now() - start;
+	
+	std::printf("%-8s %8zu %12.1f %12.1f\n",
+		base64_codec_name(codec),
+		size,
+		megabytes_per_second(size * iterations, encode_time),
+		megabytes_per_second(encoded.size() * iterations, decode_time));
+}
+
+int main(int argc, char** argv)
+{
+	size_t bytes_per_size = 64 * 1024 * 1024;
+	if (argc > 1) {
+		bytes_per_size = std::strtoul(argv[1], nullptr, 10) * 1024 * 1024;
+	}
+	
+	std::printf("default codec: %s\n", base64_codec_name(base64_default_codec()));
+	std::printf("%-8s %8s %12s %12s\n", "codec", "bytes", "encode MB/s", "decode MB/s");
+	for (size_t size : {64, 256, 1024, 4096, 65536}) {
+		for (Base64Codec codec : {Base64Codec::Scalar, Base64Codec::Sse41, Base64Codec::Avx2}) {
+			if (base64_codec_supported(codec)) {
+				benchmark(codec, size, bytes_per_size / size);
+			}
+		}
+	}
+	
+	return 0;
+}
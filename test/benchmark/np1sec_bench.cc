@@ -0,0 +1,454 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Measures every crypto and codec primitive over a range of payload sizes,
+ * and prints the results as JSON on stdout, so that runs on different
+ * builds and crypto backends can be compared by script.
+ * Run as: np1sec_bench [milliseconds per benchmark] [name filter]
+ *
+ * Each benchmark doubles its iteration count until one run takes at least
+ * the given time. "bytes" is the size of the input of one operation, and
+ * is 0 for operations whose cost does not depend on a payload.
+ */
+
+#include "src/base64.h"
+#include "src/crypto.h"
+#include "src/message.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace np1sec;
+
+const size_t c_payload_sizes[] = {16, 256, 4096, 65536};
+const size_t c_participant_counts[] = {2, 16, 128};
+const size_t c_max_iterations = size_t(1) << 30;
+
+/*
+ * Keeps the compiler from discarding the result of a benchmarked call.
+ */
+template<class T>
+static void keep(const T& value)
+{
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+class Benchmark
+{
+	public:
+	Benchmark(std::chrono::steady_clock::duration min_time, const char* filter):
+		m_min_time(min_time),
+		m_filter(filter),
+		m_first(true)
+	{
+		std::printf("{\n");
+		std::printf("\t\"backend\": \"%s\",\n", crypto::backend_name());
+		std::printf("\t\"base64_codec\": \"%s\",\n", base64_codec_name(base64_default_codec()));
+		std::printf("\t\"results\": [");
+	}
+
+	~Benchmark()
+	{
+		std::printf("\n\t]\n}\n");
+	}
+
+	template<class Function>
+	void run(const std::string& name, size_t bytes, Function function)
+	{
+		if (m_filter && name.find(m_filter) == std::string::npos) {
+			return;
+		}
+
+		size_t iterations = 1;
+		std::chrono::steady_clock::duration elapsed;
+		while (true) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < iterations; i++) {
+				function();
+			}
+			elapsed = std::chrono::steady_clock::now() - start;
+			if (elapsed >= m_min_time || iterations >= c_max_iterations) {
+				break;
+			}
+			iterations *= 2;
+		}
+
+		double seconds = std::chrono::duration<double>(elapsed).count();
+		std::printf("%s\n\t\t{\"name\": \"%s\", \"bytes\": %zu, \"iterations\": %zu, \"ns_per_op\": %.1f",
+			m_first ? "" : ",",
+			name.c_str(),
+			bytes,
+			iterations,
+			seconds * 1e9 / iterations);
+		if (bytes > 0) {
+			std::printf(", \"mb_per_s\": %.2f", bytes * iterations / seconds / (1024 * 1024));
+		}
+		std::printf("}");
+		std::fflush(stdout);
+		m_first = false;
+	}
+
+	protected:
+	std::chrono::steady_clock::duration m_min_time;
+	const char* m_filter;
+	bool m_first;
+};
+
+static std::string payload(size_t size)
+{
+	std::string result(size, '\0');
+	for (size_t i = 0; i < size; i++) {
+		result[i] = char(i * 151 + 7);
+	}
+	return result;
+}
+
+static void benchmark_crypto(Benchmark& benchmark)
+{
+	PrivateKey long_term_key = PrivateKey::generate(false);
+	PrivateKey ephemeral_key = PrivateKey::generate(true);
+	PrivateKey peer_long_term_key = PrivateKey::generate(false);
+	PrivateKey peer_ephemeral_key = PrivateKey::generate(true);
+	PrivateScalar long_term_scalar(long_term_key);
+	PrivateScalar ephemeral_scalar(ephemeral_key);
+	SymmetricKey symmetric_key;
+	symmetric_key.key = crypto::nonce_hash();
+	SymmetricCipher cipher(symmetric_key);
+
+	for (size_t size : c_payload_sizes) {
+		std::string plaintext = payload(size);
+		benchmark.run("crypto::hash", size, [&] {
+			keep(crypto::hash(plaintext));
+		});
+		benchmark.run("crypto::encrypt", size, [&] {
+			keep(crypto::encrypt(plaintext, symmetric_key));
+		});
+		std::string ciphertext = crypto::encrypt(plaintext, symmetric_key);
+		benchmark.run("crypto::decrypt", ciphertext.size(), [&] {
+			keep(crypto::decrypt(ciphertext, symmetric_key));
+		});
+		benchmark.run("SymmetricCipher::encrypt", size, [&] {
+			keep(cipher.encrypt(plaintext));
+		});
+		benchmark.run("SymmetricCipher::decrypt", ciphertext.size(), [&] {
+			keep(cipher.decrypt(ciphertext));
+		});
+		// crypto::sign() refuses payloads above c_max_signed_payload_size.
+		Signature signature;
+		try {
+			signature = crypto::sign(plaintext, long_term_key);
+		} catch (CryptoException&) {
+			continue;
+		}
+		benchmark.run("crypto::sign", size, [&] {
+			keep(crypto::sign(plaintext, long_term_key));
+		});
+		benchmark.run("crypto::verify", size, [&] {
+			keep(crypto::verify(plaintext, signature, long_term_key.public_key()));
+		});
+	}
+
+	// A burst of conversation messages from a 16 participant conversation, verified together.
+	std::vector<PrivateKey> signers;
+	for (size_t i = 0; i < 16; i++) {
+		signers.push_back(PrivateKey::generate(true));
+	}
+	std::vector<crypto::SignedPayload> signatures(64);
+	for (size_t i = 0; i < signatures.size(); i++) {
+		signatures[i].payload = payload(256) + char(i);
+		signatures[i].signature = crypto::sign(signatures[i].payload, signers[i % signers.size()]);
+		signatures[i].key = signers[i % signers.size()].public_key();
+	}
+	benchmark.run("crypto::verify_batch(64)", 0, [&] {
+		keep(crypto::verify_batch(signatures));
+	});
+
+	benchmark.run("PrivateKey::generate", 0, [&] {
+		keep(PrivateKey::generate(true));
+	});
+	benchmark.run("PrivateScalar", 0, [&] {
+		keep(PrivateScalar(long_term_key));
+	});
+	benchmark.run("crypto::triple_diffie_hellman", 0, [&] {
+		keep(crypto::triple_diffie_hellman(
+			long_term_key,
+			ephemeral_key,
+			peer_long_term_key.public_key(),
+			peer_ephemeral_key.public_key()
+		));
+	});
+	benchmark.run("crypto::triple_diffie_hellman(PrivateScalar)", 0, [&] {
+		keep(crypto::triple_diffie_hellman(
+			long_term_scalar,
+			ephemeral_scalar,
+			peer_long_term_key.public_key(),
+			peer_ephemeral_key.public_key()
+		));
+	});
+}
+
+static void benchmark_base64(Benchmark& benchmark)
+{
+	for (size_t size : c_payload_sizes) {
+		std::string data = payload(size);
+		std::vector<char> encoded(((size + 2) / 3) * 4);
+		std::vector<unsigned char> decoded(size + 3);
+
+		benchmark.run("base64_encode", size, [&] {
+			keep(base64_encode(encoded.data(), reinterpret_cast<const unsigned char*>(data.data()), size));
+		});
+		benchmark.run("base64_decode", encoded.size(), [&] {
+			size_t decoded_size;
+			if (!base64_decode(decoded.data(), encoded.data(), encoded.size(), &decoded_size)) {
+				std::fprintf(stderr, "base64_decode failed\n");
+				std::exit(1);
+			}
+			keep(decoded_size);
+		});
+	}
+}
+
+static void benchmark_message(Benchmark& benchmark)
+{
+	for (size_t size : c_payload_sizes) {
+		Message message(Message::Type::Chat, payload(size));
+
+		benchmark.run("Message::encode", size, [&] {
+			keep(message.encode());
+		});
+		benchmark.run("Message::encode_binary", size, [&] {
+			keep(message.encode_binary());
+		});
+
+		// Message::decode accepts both framings; each is measured on its own.
+		std::string text = message.encode();
+		benchmark.run("Message::decode", text.size(), [&] {
+			keep(Message::decode(text));
+		});
+		std::string binary = message.encode_binary();
+		benchmark.run("Message::decode_binary", binary.size(), [&] {
+			keep(Message::decode(binary));
+		});
+	}
+}
+
+template<class M>
+static void benchmark_decode(Benchmark& benchmark, const std::string& name, const M& message)
+{
+	auto encoded = message.encode();
+	benchmark.run(name + "::decode", encoded.payload.size(), [&] {
+		keep(M::decode(encoded));
+	});
+}
+
+static ConversationStatusMessage conversation_status(size_t participant_count)
+{
+	ConversationStatusMessage status;
+	status.invitee_username = "invitee";
+	status.invitee_long_term_public_key = crypto::nonce<c_public_key_length>();
+	for (size_t i = 0; i < participant_count; i++) {
+		ConversationStatusMessage::Participant participant;
+		participant.username = "participant-" + std::to_string(i);
+		participant.long_term_public_key = crypto::nonce<c_public_key_length>();
+		participant.conversation_public_key = crypto::nonce<c_public_key_length>();
+		status.participants.push_back(participant);
+	}
+	for (size_t i = 0; i < participant_count / 4; i++) {
+		ConversationStatusMessage::UnconfirmedInvite invite;
+		invite.inviter = status.participants[i].username;
+		invite.username = "invitee-" + std::to_string(i);
+		invite.long_term_public_key = crypto::nonce<c_public_key_length>();
+		status.unconfirmed_invites.push_back(invite);
+	}
+	status.conversation_status_hash = crypto::nonce_hash();
+	status.latest_session_id = crypto::nonce_hash();
+	return status;
+}
+
+static void benchmark_message_types(Benchmark& benchmark)
+{
+	PrivateKey key = PrivateKey::generate(true);
+	SymmetricKey symmetric_key;
+	symmetric_key.key = crypto::nonce_hash();
+	SymmetricCipher cipher(symmetric_key);
+
+	QuitMessage quit;
+	quit.nonce = crypto::nonce_hash();
+	benchmark_decode(benchmark, "QuitMessage", quit);
+
+	HelloMessage hello;
+	hello.long_term_public_key = key.public_key();
+	hello.ephemeral_public_key = key.public_key();
+	hello.reply = true;
+	hello.reply_to_username = "username";
+	benchmark_decode(benchmark, "HelloMessage", hello);
+
+	RoomAuthenticationRequestMessage room_authentication_request;
+	room_authentication_request.username = "username";
+	room_authentication_request.nonce = crypto::nonce_hash();
+	benchmark_decode(benchmark, "RoomAuthenticationRequestMessage", room_authentication_request);
+
+	RoomAuthenticationMessage room_authentication;
+	room_authentication.username = "username";
+	room_authentication.authentication_confirmation = crypto::nonce_hash();
+	benchmark_decode(benchmark, "RoomAuthenticationMessage", room_authentication);
+
+	BatchMessage batch;
+	for (int i = 0; i < 4; i++) {
+		batch.messages.push_back(hello.encode());
+	}
+	benchmark_decode(benchmark, "BatchMessage", batch);
+
+	InviteMessage invite;
+	invite.username = "username";
+	invite.long_term_public_key = key.public_key();
+	benchmark_decode(benchmark, "InviteMessage", invite);
+
+	for (size_t participant_count : c_participant_counts) {
+		benchmark_decode(benchmark, "ConversationStatusMessage", conversation_status(participant_count));
+	}
+
+	ConversationConfirmationMessage conversation_confirmation;
+	conversation_confirmation.invitee_username = "username";
+	conversation_confirmation.invitee_long_term_public_key = key.public_key();
+	conversation_confirmation.status_message_hash = crypto::nonce_hash();
+	benchmark_decode(benchmark, "ConversationConfirmationMessage", conversation_confirmation);
+
+	InviteAcceptanceMessage invite_acceptance;
+	invite_acceptance.my_long_term_public_key = key.public_key();
+	invite_acceptance.inviter_username = "username";
+	invite_acceptance.inviter_long_term_public_key = key.public_key();
+	invite_acceptance.inviter_conversation_public_key = key.public_key();
+	benchmark_decode(benchmark, "InviteAcceptanceMessage", invite_acceptance);
+
+	AuthenticationRequestMessage authentication_request;
+	authentication_request.username = "username";
+	authentication_request.authentication_nonce = crypto::nonce_hash();
+	benchmark_decode(benchmark, "AuthenticationRequestMessage", authentication_request);
+
+	AuthenticationMessage authentication;
+	authentication.username = "username";
+	authentication.authentication_confirmation = crypto::nonce_hash();
+	benchmark_decode(benchmark, "AuthenticationMessage", authentication);
+
+	AuthenticateInviteMessage authenticate_invite;
+	authenticate_invite.username = "username";
+	authenticate_invite.long_term_public_key = key.public_key();
+	authenticate_invite.conversation_public_key = key.public_key();
+	benchmark_decode(benchmark, "AuthenticateInviteMessage", authenticate_invite);
+
+	CancelInviteMessage cancel_invite;
+	cancel_invite.username = "username";
+	cancel_invite.long_term_public_key = key.public_key();
+	benchmark_decode(benchmark, "CancelInviteMessage", cancel_invite);
+
+	benchmark_decode(benchmark, "JoinMessage", JoinMessage());
+	benchmark_decode(benchmark, "LeaveMessage", LeaveMessage());
+	benchmark_decode(benchmark, "ConsistencyStatusMessage", ConsistencyStatusMessage());
+
+	ConsistencyCheckMessage consistency_check;
+	consistency_check.conversation_status_hash = crypto::nonce_hash();
+	benchmark_decode(benchmark, "ConsistencyCheckMessage", consistency_check);
+
+	TimeoutMessage timeout;
+	timeout.victim = "username";
+	timeout.timeout = true;
+	benchmark_decode(benchmark, "TimeoutMessage", timeout);
+
+	VotekickMessage votekick;
+	votekick.victim = "username";
+	votekick.kick = true;
+	benchmark_decode(benchmark, "VotekickMessage", votekick);
+
+	KeyExchangePublicKeyMessage key_exchange_public_key;
+	key_exchange_public_key.key_id = crypto::nonce_hash();
+	key_exchange_public_key.public_key = key.public_key();
+	benchmark_decode(benchmark, "KeyExchangePublicKeyMessage", key_exchange_public_key);
+
+	KeyExchangeSecretShareMessage key_exchange_secret_share;
+	key_exchange_secret_share.key_id = crypto::nonce_hash();
+	key_exchange_secret_share.group_hash = crypto::nonce_hash();
+	key_exchange_secret_share.secret_share = crypto::nonce_hash();
+	benchmark_decode(benchmark, "KeyExchangeSecretShareMessage", key_exchange_secret_share);
+
+	KeyExchangeAcceptanceMessage key_exchange_acceptance;
+	key_exchange_acceptance.key_id = crypto::nonce_hash();
+	key_exchange_acceptance.key_hash = crypto::nonce_hash();
+	benchmark_decode(benchmark, "KeyExchangeAcceptanceMessage", key_exchange_acceptance);
+
+	KeyExchangeRevealMessage key_exchange_reveal;
+	key_exchange_reveal.key_id = crypto::nonce_hash();
+	key_exchange_reveal.private_key = key.serialize();
+	benchmark_decode(benchmark, "KeyExchangeRevealMessage", key_exchange_reveal);
+
+	KeyActivationMessage key_activation;
+	key_activation.key_id = crypto::nonce_hash();
+	benchmark_decode(benchmark, "KeyActivationMessage", key_activation);
+
+	KeyRatchetMessage key_ratchet;
+	key_ratchet.key_id = crypto::nonce_hash();
+	benchmark_decode(benchmark, "KeyRatchetMessage", key_ratchet);
+
+	for (size_t size : c_payload_sizes) {
+		ChatMessage chat = ChatMessage::encrypt(payload(size), crypto::nonce_hash(), cipher);
+		benchmark_decode(benchmark, "ChatMessage", chat);
+
+		UnsignedChatMessage unsigned_chat;
+		unsigned_chat.message_id = 1;
+		unsigned_chat.message = payload(size);
+		std::string plaintext_chat;
+		try {
+			plaintext_chat = PlaintextChatMessage::sign(unsigned_chat, key);
+		} catch (CryptoException&) {
+			continue;
+		}
+		benchmark.run("PlaintextChatMessage::decode", plaintext_chat.size(), [&] {
+			keep(PlaintextChatMessage::decode(plaintext_chat));
+		});
+
+		Message conversation_message = ConversationMessage::sign(chat.encode(), key);
+		benchmark.run("ConversationMessage::decode", conversation_message.payload.size(), [&] {
+			keep(ConversationMessage::decode(conversation_message));
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	long milliseconds = 200;
+	if (argc > 1) {
+		milliseconds = std::strtol(argv[1], nullptr, 10);
+	}
+	const char* filter = nullptr;
+	if (argc > 2) {
+		filter = argv[2];
+	}
+
+	Benchmark benchmark(std::chrono::milliseconds(milliseconds), filter);
+	benchmark_crypto(benchmark);
+	benchmark_base64(benchmark);
+	benchmark_message(benchmark);
+	benchmark_message_types(benchmark);
+
+	return 0;
+}
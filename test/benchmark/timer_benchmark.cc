@@ -0,0 +1,160 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Compares the cost of arming, cancelling and firing timers in the
+ * TimerWheel against the asio steady_timer based Timers of the echo
+ * chamber. Intervals are spread over the first minute, like the event and
+ * status timers of a conversation. Run as: timer_benchmark [timers]
+ */
+
+#include "src/timerwheel.h"
+
+#include <boost/asio/io_service.hpp>
+#include <map>
+#include <memory>
+#include "test/echo_chamber/timer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace np1sec;
+
+const uint32_t c_max_interval = 60000;
+
+class CountingCallback : public TimerCallback
+{
+	public:
+	CountingCallback():
+		count(0)
+	{}
+
+	void execute()
+	{
+		count++;
+	}
+
+	size_t count;
+};
+
+static double nanoseconds_per_timer(std::chrono::steady_clock::duration elapsed, size_t timers)
+{
+	return std::chrono::duration<double, std::nano>(elapsed).count() / timers;
+}
+
+static std::vector<uint32_t> intervals(size_t timers)
+{
+	std::vector<uint32_t> result(timers);
+	uint32_t state = 12345;
+	for (size_t i = 0; i < timers; i++) {
+		state = state * 1103515245 + 12345;
+		result[i] = 1 + (state >> 8) % c_max_interval;
+	}
+	return result;
+}
+
+static void benchmark_wheel(const std::vector<uint32_t>& intervals)
+{
+	TimerWheel wheel;
+	CountingCallback callback;
+	std::vector<TimerToken*> tokens(intervals.size());
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < intervals.size(); i++) {
+		tokens[i] = wheel.set_timer(intervals[i], &callback);
+	}
+	std::chrono::steady_clock::duration arm_time = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < intervals.size(); i++) {
+		tokens[i]->unset();
+	}
+	std::chrono::steady_clock::duration cancel_time = std::chrono::steady_clock::now() - start;
+
+	for (size_t i = 0; i < intervals.size(); i++) {
+		wheel.set_timer(intervals[i], &callback);
+	}
+	start = std::chrono::steady_clock::now();
+	wheel.advance(c_max_interval);
+	std::chrono::steady_clock::duration fire_time = std::chrono::steady_clock::now() - start;
+
+	if (callback.count != intervals.size()) {
+		std::fprintf(stderr, "wheel: %zu of %zu timers fired\n", callback.count, intervals.size());
+		std::exit(1);
+	}
+
+	std::printf("%-8s %10zu %12.1f %12.1f %12.1f\n",
+		"wheel",
+		intervals.size(),
+		nanoseconds_per_timer(arm_time, intervals.size()),
+		nanoseconds_per_timer(cancel_time, intervals.size()),
+		nanoseconds_per_timer(fire_time, intervals.size()));
+}
+
+/*
+ * Firing asio timers means waiting for the real clock, so only arming and
+ * cancelling are measured. Cancelled timers complete their waits when the
+ * io_service next runs; that is included in the cancellation cost.
+ */
+static void benchmark_asio(const std::vector<uint32_t>& intervals)
+{
+	boost::asio::io_service io_service;
+	Timers timers;
+	CountingCallback callback;
+	std::vector<TimerToken*> tokens(intervals.size());
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < intervals.size(); i++) {
+		tokens[i] = timers.create(io_service, intervals[i], &callback);
+	}
+	std::chrono::steady_clock::duration arm_time = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < intervals.size(); i++) {
+		tokens[i]->unset();
+	}
+	io_service.run();
+	std::chrono::steady_clock::duration cancel_time = std::chrono::steady_clock::now() - start;
+
+	std::printf("%-8s %10zu %12.1f %12.1f %12s\n",
+		"asio",
+		intervals.size(),
+		nanoseconds_per_timer(arm_time, intervals.size()),
+		nanoseconds_per_timer(cancel_time, intervals.size()),
+		"-");
+}
+
+int main(int argc, char** argv)
+{
+	size_t timers = 100000;
+	if (argc > 1) {
+		timers = std::strtoul(argv[1], nullptr, 10);
+	}
+	if (timers == 0) {
+		std::fprintf(stderr, "usage: %s [timers]\n", argv[0]);
+		return 1;
+	}
+
+	std::printf("%-8s %10s %12s %12s %12s\n", "host", "timers", "arm ns", "cancel ns", "fire ns");
+	std::vector<uint32_t> timer_intervals = intervals(timers);
+	benchmark_wheel(timer_intervals);
+	benchmark_asio(timer_intervals);
+	return 0;
+}
@@ -25,6 +25,23 @@
 #include "conv.h"
 #include "client.h"
 
+/*
+ * How rooms created from now on use the echo server. The defaults are the
+ * library's, which XMPP hosts run with: text framing and no batching. The
+ * echo server forwards messages byte for byte, so tests can switch to the
+ * binary and batched paths too.
+ */
+struct TransportOptions {
+    bool binary_transport = false;
+    bool batch_messages = false;
+    bool chunk_messages = false;
+
+    static TransportOptions& current() {
+        static TransportOptions options;
+        return options;
+    }
+};
+
 struct RoomImpl : public np1sec::RoomInterface {
     using tcp = boost::asio::ip::tcp;
     using error_code = boost::system::error_code;
@@ -42,6 +59,9 @@ struct RoomImpl : public np1sec::RoomInterface {
     Pipe<std::string, np1sec::PublicKey> _user_joined_pipe;
     Pipe<> _disconnect_pipe;
     bool _enable_message_logging = false;
+    bool _binary_transport = TransportOptions::current().binary_transport;
+    bool _batch_messages = TransportOptions::current().batch_messages;
+    bool _chunk_messages = TransportOptions::current().chunk_messages;
 
 	/* Called before the message is processed. If the function returns false,
 	 * the message won't be processed. It is used for debugging and testing. */
@@ -107,6 +127,21 @@ struct RoomImpl : public np1sec::RoomInterface {
         _client->send_message(_name, msg);
     }
 
+    bool binary_transport() const override
+    {
+        return _binary_transport;
+    }
+
+    bool batch_messages() const override
+    {
+        return _batch_messages;
+    }
+
+    bool chunk_messages() const override
+    {
+        return _chunk_messages;
+    }
+
     np1sec::TimerToken* set_timer(uint32_t ms, np1sec::TimerCallback* cb) override
     {
         return _timers.create(get_io_service(), ms, cb);
@@ -19,10 +19,26 @@
 #define BOOST_TEST_MODULE EchoChamber
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <iomanip>
 #include <iostream>
 #include <chrono>
+#include <gcrypt.h>
 #include "echo_server.h"
 #include "room.h"
+#include "roomhost.h"
+#include "base64.h"
+#include "participanttable.h"
+#include "statistics.h"
+#include "timer.h"
+#include "timerwheel.h"
+#include "trace.h"
+#include "username.h"
+#include "test/simulation/network.h"
 
 using error_code = boost::system::error_code;
 using std::move;
@@ -43,6 +59,36 @@ using Clock = std::chrono::steady_clock;
 
 template<class... T> static void ignore_unused(const T&...) {}
 
+/*
+ * Runs a test case over the binary framing with batching, rather than the
+ * library defaults.
+ */
+struct BinaryBatchedTransport {
+    TransportOptions saved = TransportOptions::current();
+
+    BinaryBatchedTransport() {
+        TransportOptions::current().binary_transport = true;
+        TransportOptions::current().batch_messages = true;
+    }
+
+    ~BinaryBatchedTransport() {
+        TransportOptions::current() = saved;
+    }
+};
+
+/* Has rooms created during its lifetime send large chat messages in chunks. */
+struct ChunkedMessages {
+    TransportOptions saved = TransportOptions::current();
+
+    ChunkedMessages() {
+        TransportOptions::current().chunk_messages = true;
+    }
+
+    ~ChunkedMessages() {
+        TransportOptions::current() = saved;
+    }
+};
+
 template<class T>
 shared_ptr<T> move_to_shared(T& arg) {
     return std::make_shared<T>(std::move(arg));
@@ -363,6 +409,16 @@ BOOST_AUTO_TEST_CASE(invite_concurrent_size_3_delay_0ms)
     test_create_session(3, ConcurrentInviteStrategy{0ms}, 10s);
 }
 
+BOOST_FIXTURE_TEST_CASE(invite_consecutive_size_4_binary_batched, BinaryBatchedTransport)
+{
+    test_create_session(4, ConsecutiveInviteStrategy{0s});
+}
+
+BOOST_FIXTURE_TEST_CASE(invite_concurrent_size_4_delay_100ms_binary_batched, BinaryBatchedTransport)
+{
+    test_create_session(4, ConcurrentInviteStrategy{100ms}, 30s);
+}
+
 //------------------------------------------------------------------------------
 /* Create a session of `user_count` users, then, after everyone joined chats
  * of everyone else, introduce a new client "new_guy" and expect that once
@@ -504,7 +560,7 @@ template<class H> void test_with_session_each_user(size_t user_count, H&& h) {
 }
 
 //------------------------------------------------------------------------------
-BOOST_AUTO_TEST_CASE(test_consecutive_message_exchange)
+void run_consecutive_message_exchange()
 {
     const size_t user_count = 10;
     const size_t message_count = 30;
@@ -541,6 +597,113 @@ BOOST_AUTO_TEST_CASE(test_consecutive_message_exchange)
         });
     });
 }
+
+BOOST_AUTO_TEST_CASE(test_consecutive_message_exchange)
+{
+    run_consecutive_message_exchange();
+}
+
+BOOST_FIXTURE_TEST_CASE(test_consecutive_message_exchange_binary_batched, BinaryBatchedTransport)
+{
+    run_consecutive_message_exchange();
+}
+
+//------------------------------------------------------------------------------
+void run_chunked_message_exchange()
+{
+    const size_t user_count = 4;
+
+    ChunkedMessages chunked_messages;
+
+    /*
+     * Less than one 2048 byte chunk, exactly three chunks, and several
+     * chunks with a short last one.
+     */
+    auto message_of = [] (const std::string& name) {
+        const size_t sizes[] = { 1000, 3 * 2048, 16000, 50000 };
+        std::string message(sizes[name.back() - '0'], '\0');
+        for (size_t i = 0; i < message.size(); i++) {
+            message[i] = char(i * 31 + name.back());
+        }
+        return message;
+    };
+
+    test_with_session_each_user(user_count, [=] (User& user, auto finish) {
+        user.conv.send_chat(message_of(user.name()));
+
+        async_loop([=, &user] (unsigned int i, auto cont) {
+            if (i == user_count) {
+                return finish();
+            }
+
+            user.conv.receive_chat([=] (const std::string& source, const std::string& msg) {
+                BOOST_CHECK(msg == message_of(source));
+                return cont();
+            });
+        });
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_chunked_message_exchange)
+{
+    run_chunked_message_exchange();
+}
+
+BOOST_FIXTURE_TEST_CASE(test_chunked_message_exchange_binary_batched, BinaryBatchedTransport)
+{
+    run_chunked_message_exchange();
+}
+
+//------------------------------------------------------------------------------
+BOOST_FIXTURE_TEST_CASE(test_oversized_chunked_message, ChunkedMessages)
+{
+    const size_t user_count = 2;
+
+    // Receivers drop chunked messages over 16 MiB, then carry on.
+    const std::string oversized(16 * 1024 * 1024 + 1, 'x');
+    const std::string next = "next";
+
+    test_with_session_each_user(user_count, [=] (User& user, auto finish) {
+        if (user.name() == "user0") {
+            user.conv.send_chat(oversized);
+            user.conv.send_chat(next);
+        }
+
+        user.conv.receive_chat([=] (const std::string& source, const std::string& msg) {
+            BOOST_CHECK_EQUAL(source, "user0");
+            BOOST_CHECK(msg == next);
+            finish();
+        });
+    });
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_unchunked_large_message)
+{
+    const size_t user_count = 2;
+
+    // Without chunking, a message too large to sign whole is chunked all the same.
+    const std::string large(70000, 'x');
+    const std::string next = "next";
+
+    test_with_session_each_user(user_count, [=] (User& user, auto finish) {
+        if (user.name() == "user0") {
+            user.conv.send_chat(large);
+            user.conv.send_chat(next);
+        }
+
+        user.conv.receive_chat([=, &user] (const std::string& source, const std::string& msg) {
+            BOOST_CHECK_EQUAL(source, "user0");
+            BOOST_CHECK(msg == large);
+            user.conv.receive_chat([=] (const std::string& source, const std::string& msg) {
+                BOOST_CHECK_EQUAL(source, "user0");
+                BOOST_CHECK(msg == next);
+                finish();
+            });
+        });
+    });
+}
+
 //------------------------------------------------------------------------------
 
 struct RandomDuration {
@@ -617,6 +780,8 @@ BOOST_AUTO_TEST_CASE(test_ddos_hello)
         rs.emplace_back(ios, str("alice", i));
     }
 
+    auto start = Clock::now();
+
     EchoServer server(ios);
 
     auto server_ep = server.local_endpoint();
@@ -651,6 +816,9 @@ BOOST_AUTO_TEST_CASE(test_ddos_hello)
         }
         server.stop();
         stop_mallory = true;
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+        BOOST_TEST_MESSAGE("all " << N << " users joined in " << elapsed.count() << "ms");
     });
 
     for (size_t i = 0; i < rs.size(); ++i) {
@@ -676,7 +844,7 @@ BOOST_AUTO_TEST_CASE(test_ddos_hello)
 }
 
 //------------------------------------------------------------------------------
-BOOST_AUTO_TEST_CASE(test_ratcheting)
+void run_ratcheting()
 {
     const size_t user_count = 3;
     const size_t message_count = 100;
@@ -756,6 +924,82 @@ BOOST_AUTO_TEST_CASE(test_ratcheting)
     });
 }
 
+BOOST_AUTO_TEST_CASE(test_ratcheting)
+{
+    run_ratcheting();
+}
+
+BOOST_FIXTURE_TEST_CASE(test_ratcheting_binary_batched, BinaryBatchedTransport)
+{
+    run_ratcheting();
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_conversation_status_encoding)
+{
+    /*
+     * The conversation status is hashed incrementally from cached sections;
+     * check it against a full re-encode before every message that gets hashed.
+     */
+    const size_t user_count = 4;
+    const size_t message_count = 20;
+
+    auto check_status = [](User& user) {
+        auto& conv = *user.conv.get_np1sec_conv();
+
+        np1sec::PublicKey zero;
+        memset(zero.buffer, 0, sizeof(zero.buffer));
+
+        BOOST_REQUIRE_EQUAL(
+            conv.conversation_status(std::string(), zero).payload,
+            conv.encode_conversation_status(std::string(), zero).payload);
+        BOOST_REQUIRE_EQUAL(
+            conv.conversation_status(user.name(), user.room.get_np1sec_room()->public_key()).payload,
+            conv.encode_conversation_status(user.name(), user.room.get_np1sec_room()->public_key()).payload);
+    };
+
+    test_with_session_each_user(user_count, [&] (User& user, auto finish) {
+        auto next_msg_id = make_shared<size_t>(0);
+
+        auto one_loop_finished = on_nth_invocation(2, finish);
+
+        user.room.set_inbound_message_filter(
+            [=, &user] (const std::string&, const np1sec::Message&) {
+                check_status(user);
+                return true;
+            });
+
+        if (user.name() == "user0") {
+            auto& ec = user.conv.get_np1sec_conv()->m_encrypted_chat;
+            ec.send_ratchet(ec.latest_session_id());
+        }
+
+        async_loop([=, &user] (unsigned int i, auto cont) {
+            if (i == message_count) {
+                return one_loop_finished();
+            }
+
+            user.conv.send_chat(str("Message #", (*next_msg_id)++));
+
+            wait(10ms, user.room.get_io_service(), [=] {
+                cont();
+            });
+        });
+
+        async_loop([=, &user] (unsigned int i, auto cont) {
+            if (i == user_count * message_count) {
+                user.room.set_inbound_message_filter(nullptr);
+                check_status(user);
+                return one_loop_finished();
+            }
+
+            user.conv.receive_chat([=] (const std::string&, const std::string&) {
+                return cont();
+            });
+        });
+    });
+}
+
 //------------------------------------------------------------------------------
 void test_message_dropping(np1sec::Message::Type message_type_to_drop)
 {
@@ -874,3 +1118,1117 @@ BOOST_AUTO_TEST_CASE(test_drop_message_KeyActivation)
 }
 
 //------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_verify_batch)
+{
+    using np1sec::crypto::SignedPayload;
+
+    std::vector<np1sec::PrivateKey> keys;
+    for (size_t i = 0; i < 3; i++) {
+        keys.push_back(np1sec::PrivateKey::generate(true));
+    }
+
+    // More than one batch equation's worth, and a partial one.
+    std::vector<SignedPayload> batch;
+    for (size_t i = 0; i < 100; i++) {
+        const auto& key = keys[i % keys.size()];
+
+        SignedPayload item;
+        item.payload = str("Message #", i);
+        item.signature = np1sec::crypto::sign(item.payload, key);
+        item.key = key.public_key();
+        batch.push_back(item);
+    }
+
+    auto result = np1sec::crypto::verify_batch(batch);
+    BOOST_REQUIRE_EQUAL(result.size(), batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+        BOOST_CHECK(result[i]);
+    }
+
+    batch[3].payload += "!";
+    batch[6].signature.buffer[0] ^= 1;
+    batch[9].key = keys[1].public_key();
+    // s is not below the group order
+    batch[70].signature.buffer[63] |= 0xf0;
+
+    result = np1sec::crypto::verify_batch(batch);
+    BOOST_REQUIRE_EQUAL(result.size(), batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+        bool expected = i != 3 && i != 6 && i != 9 && i != 70;
+        BOOST_CHECK_EQUAL(result[i], expected);
+        BOOST_CHECK_EQUAL(result[i], np1sec::crypto::verify(batch[i].payload, batch[i].signature, batch[i].key));
+    }
+}
+
+//------------------------------------------------------------------------------
+static gcry_mpi_t load_little_endian(const uint8_t* bytes, size_t size)
+{
+    std::vector<uint8_t> big_endian(bytes, bytes + size);
+    std::reverse(big_endian.begin(), big_endian.end());
+    gcry_mpi_t result;
+    gcry_mpi_scan(&result, GCRYMPI_FMT_USG, big_endian.data(), size, nullptr);
+    return result;
+}
+
+static void store_little_endian(uint8_t bytes[32], gcry_mpi_t value)
+{
+    uint8_t big_endian[32];
+    size_t written;
+    gcry_mpi_print(GCRYMPI_FMT_USG, big_endian, sizeof(big_endian), &written, value);
+    memset(bytes, 0, 32);
+    for (size_t i = 0; i < written; i++) {
+        bytes[i] = big_endian[written - 1 - i];
+    }
+}
+
+/*
+ * The standard encoding of [scalar]B. With torsion, the point of order
+ * two is added: (x, y) + (0, -1) = (-x, -y).
+ */
+static void encode_multiple(uint8_t encoded[32], gcry_mpi_t scalar, gcry_ctx_t curve, bool torsion)
+{
+    gcry_mpi_point_t base = gcry_mpi_ec_get_point("g", curve, 1);
+    gcry_mpi_point_t product = gcry_mpi_point_new(0);
+    gcry_mpi_ec_mul(product, scalar, base, curve);
+    gcry_mpi_t x = gcry_mpi_new(0), y = gcry_mpi_new(0);
+    gcry_mpi_ec_get_affine(x, y, product, curve);
+    if (torsion) {
+        gcry_mpi_t p = gcry_mpi_ec_get_mpi("p", curve, 1);
+        gcry_mpi_sub(x, p, x);
+        gcry_mpi_sub(y, p, y);
+        gcry_mpi_release(p);
+    }
+    store_little_endian(encoded, y);
+    encoded[31] |= gcry_mpi_test_bit(x, 0) << 7;
+
+    gcry_mpi_release(x);
+    gcry_mpi_release(y);
+    gcry_mpi_point_release(product);
+    gcry_mpi_point_release(base);
+}
+
+/*
+ * An ed25519 signature of payload by the secret scalar a, or by the
+ * identity point when a is null. With torsion, R is [r]B plus the point
+ * of order two, so only the cofactored equation holds.
+ */
+static np1sec::crypto::SignedPayload sign_with_scalar(const std::string& payload, const uint8_t* a, bool torsion)
+{
+    gcry_ctx_t curve;
+    gcry_mpi_ec_new(&curve, nullptr, "Ed25519");
+    gcry_mpi_t order = gcry_mpi_ec_get_mpi("n", curve, 1);
+
+    np1sec::crypto::SignedPayload result;
+    result.payload = payload;
+    gcry_mpi_t scalar = a ? load_little_endian(a, 32) : gcry_mpi_set_ui(nullptr, 0);
+    encode_multiple(result.key.buffer, scalar, curve, false);
+
+    uint8_t r[32];
+    np1sec::crypto::create_nonce(r, sizeof(r));
+    gcry_mpi_t s = load_little_endian(r, 32);
+    encode_multiple(result.signature.buffer, s, curve, torsion);
+
+    std::string challenge_input((const char*)result.signature.buffer, 32);
+    challenge_input.append((const char*)result.key.buffer, 32);
+    challenge_input += payload;
+    uint8_t challenge_bytes[64];
+    gcry_md_hash_buffer(GCRY_MD_SHA512, challenge_bytes, challenge_input.data(), challenge_input.size());
+
+    // s = r + challenge a
+    gcry_mpi_t challenge = load_little_endian(challenge_bytes, 64);
+    gcry_mpi_mul(challenge, challenge, scalar);
+    gcry_mpi_add(s, s, challenge);
+    gcry_mpi_mod(s, s, order);
+    store_little_endian(result.signature.buffer + 32, s);
+
+    gcry_mpi_release(challenge);
+    gcry_mpi_release(s);
+    gcry_mpi_release(scalar);
+    gcry_mpi_release(order);
+    gcry_ctx_release(curve);
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(test_torsion_signatures)
+{
+    namespace crypto = np1sec::crypto;
+    using crypto::SignedPayload;
+
+    auto key = np1sec::PrivateKey::generate(true);
+    SignedPayload honest;
+    honest.payload = "Honest";
+    honest.signature = crypto::sign(honest.payload, key);
+    honest.key = key.public_key();
+
+    uint8_t a[32];
+    crypto::create_nonce(a, sizeof(a));
+    SignedPayload plain = sign_with_scalar("Plain", a, false);
+    SignedPayload tweaked = sign_with_scalar("Tweaked", a, true);
+    // Valid for any scalar with the identity as key; refused for its small order.
+    SignedPayload identity = sign_with_scalar("Identity", nullptr, false);
+
+    // Accepted or refused alike alone, in a batch of one, and next to other signatures.
+    std::vector<SignedPayload> signatures = {plain, tweaked, identity};
+    std::vector<bool> expected = {true, true, false};
+    for (size_t i = 0; i < signatures.size(); i++) {
+        const SignedPayload& item = signatures[i];
+        BOOST_CHECK_EQUAL(crypto::verify(item.payload, item.signature, item.key), expected[i]);
+        BOOST_CHECK_EQUAL(crypto::verify_batch({item})[0], expected[i]);
+        BOOST_CHECK_EQUAL(crypto::verify_batch({item, honest})[0], expected[i]);
+        BOOST_CHECK_EQUAL(crypto::verify_batch({honest, item, honest})[1], expected[i]);
+    }
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_large_payload_signatures)
+{
+    namespace crypto = np1sec::crypto;
+    using crypto::SignedPayload;
+
+    auto key = np1sec::PrivateKey::generate(true);
+    std::string payload(crypto::c_max_signed_payload_size + 1, 'x');
+    BOOST_CHECK_THROW(crypto::sign(payload, key), np1sec::CryptoException);
+
+    SignedPayload honest;
+    honest.payload = "Honest";
+    honest.signature = crypto::sign(honest.payload, key);
+    honest.key = key.public_key();
+
+    // A peer picks the payload size; a valid signature over too much is refused everywhere.
+    uint8_t a[32];
+    crypto::create_nonce(a, sizeof(a));
+    a[31] = 0;
+    SignedPayload large = sign_with_scalar(std::string(70000, 'x'), a, false);
+    BOOST_CHECK(!crypto::verify(large.payload, large.signature, large.key));
+    BOOST_CHECK(!crypto::verify_batch({large})[0]);
+    auto result = crypto::verify_batch({large, honest});
+    BOOST_CHECK(!result[0]);
+    BOOST_CHECK(result[1]);
+
+    np1sec::Signature forged;
+    memset(forged.buffer, 0, sizeof(forged.buffer));
+    BOOST_CHECK(!crypto::verify(large.payload, forged, key.public_key()));
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_public_key_cache)
+{
+    namespace crypto = np1sec::crypto;
+
+    auto key = np1sec::PrivateKey::generate(true);
+    std::string payload = "payload";
+    auto signature = crypto::sign(payload, key);
+
+    auto before = crypto::public_key_cache_statistics();
+
+    for (size_t i = 0; i < 3; i++) {
+        BOOST_CHECK(crypto::verify(payload, signature, key.public_key()));
+    }
+
+    auto after = crypto::public_key_cache_statistics();
+    BOOST_CHECK_EQUAL(after.misses, before.misses + 1);
+    BOOST_CHECK_EQUAL(after.hits, before.hits + 2);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_crypto_backend_conformance)
+{
+    namespace crypto = np1sec::crypto;
+
+    auto from_hex = [](const std::string& hex) {
+        std::string result;
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            result += char(std::stoi(hex.substr(i, 2), nullptr, 16));
+        }
+        return result;
+    };
+    auto key_from_seed = [&](const std::string& hex) {
+        np1sec::SerializedPrivateKey seed;
+        std::string bytes = from_hex(hex);
+        memcpy(seed.buffer, bytes.data(), sizeof(seed.buffer));
+        return np1sec::PrivateKey::unserialize(seed);
+    };
+    auto hex = [](const unsigned char* buffer, size_t size) {
+        std::stringstream ss;
+        for (size_t i = 0; i < size; i++) {
+            ss << std::hex << std::setw(2) << std::setfill('0') << int(buffer[i]);
+        }
+        return ss.str();
+    };
+
+    BOOST_TEST_MESSAGE("crypto backend: " << crypto::backend_name());
+
+    // RFC 8032, section 7.1, test 1
+    auto key = key_from_seed("9d61b19deffd5a60ba844af492ec2cc44449c5697b326919703bac031cae7f60");
+    BOOST_CHECK_EQUAL(hex(key.public_key().buffer, 32), "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a");
+    BOOST_CHECK_EQUAL(hex(key.serialize().buffer, 32), "9d61b19deffd5a60ba844af492ec2cc44449c5697b326919703bac031cae7f60");
+
+    auto signature = crypto::sign("", key);
+    BOOST_CHECK_EQUAL(hex(signature.buffer, 64),
+        "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e065224901555fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b");
+    BOOST_CHECK(crypto::verify("", signature, key.public_key()));
+    signature.buffer[63] ^= 1;
+    BOOST_CHECK(!crypto::verify("", signature, key.public_key()));
+
+    // The triple Diffie-Hellman token must agree between both ends and between backends.
+    auto alice_long_term = key_from_seed("0101010101010101010101010101010101010101010101010101010101010101");
+    auto alice_ephemeral = key_from_seed("0202020202020202020202020202020202020202020202020202020202020202");
+    auto bob_long_term = key_from_seed("0303030303030303030303030303030303030303030303030303030303030303");
+    auto bob_ephemeral = key_from_seed("0404040404040404040404040404040404040404040404040404040404040404");
+
+    auto alice_token = crypto::triple_diffie_hellman(alice_long_term, alice_ephemeral, bob_long_term.public_key(), bob_ephemeral.public_key());
+    auto bob_token = crypto::triple_diffie_hellman(bob_long_term, bob_ephemeral, alice_long_term.public_key(), alice_ephemeral.public_key());
+    BOOST_CHECK(alice_token == bob_token);
+    BOOST_CHECK_EQUAL(hex(alice_token.buffer, sizeof(alice_token.buffer)), "a611994456a97c44d77efd5104bd3a62808bf05ac2b14025b9aa9d87ebac8114");
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_conversation_status_decode)
+{
+    using np1sec::ConversationStatusMessage;
+
+    ConversationStatusMessage status;
+    status.invitee_username = "invitee";
+    status.invitee_long_term_public_key = np1sec::crypto::nonce<np1sec::c_public_key_length>();
+    status.conversation_status_hash = np1sec::crypto::nonce_hash();
+    status.latest_session_id = np1sec::crypto::nonce_hash();
+
+    for (size_t i = 0; i < 100; i++) {
+        ConversationStatusMessage::Participant participant;
+        participant.username = str("user", i);
+        participant.long_term_public_key = np1sec::crypto::nonce<np1sec::c_public_key_length>();
+        participant.conversation_public_key = np1sec::crypto::nonce<np1sec::c_public_key_length>();
+        if (i % 3 == 0) participant.timeout_peers.insert("user1");
+        status.participants.push_back(participant);
+
+        ConversationStatusMessage::UnconfirmedInvite invite;
+        invite.inviter = participant.username;
+        invite.username = str("invitee", i);
+        invite.long_term_public_key = np1sec::crypto::nonce<np1sec::c_public_key_length>();
+        status.unconfirmed_invites.push_back(invite);
+    }
+
+    auto encoded = status.encode();
+    auto decoded = ConversationStatusMessage::decode(encoded);
+
+    BOOST_CHECK_EQUAL(decoded.invitee_username, status.invitee_username);
+    BOOST_CHECK(decoded.conversation_status_hash == status.conversation_status_hash);
+    BOOST_CHECK(decoded.latest_session_id == status.latest_session_id);
+    BOOST_REQUIRE_EQUAL(decoded.participants.size(), status.participants.size());
+    BOOST_REQUIRE_EQUAL(decoded.unconfirmed_invites.size(), status.unconfirmed_invites.size());
+    for (size_t i = 0; i < status.participants.size(); i++) {
+        BOOST_CHECK_EQUAL(decoded.participants[i].username, status.participants[i].username);
+        BOOST_CHECK(decoded.participants[i].conversation_public_key == status.participants[i].conversation_public_key);
+        BOOST_CHECK(decoded.participants[i].timeout_peers == status.participants[i].timeout_peers);
+        BOOST_CHECK_EQUAL(decoded.unconfirmed_invites[i].username, status.unconfirmed_invites[i].username);
+    }
+    BOOST_CHECK(decoded.encode().payload == encoded.payload);
+
+    auto truncated = encoded;
+    truncated.payload.resize(truncated.payload.size() - 1);
+    BOOST_CHECK_THROW(ConversationStatusMessage::decode(truncated), np1sec::MessageFormatException);
+}
+
+//------------------------------------------------------------------------------
+/*
+ * user2 has two invitations pending while user3, a member of both
+ * conversations, leaves the channel and user0 chats. When the status
+ * messages arrive, each new conversation must be replayed the backlog
+ * that concerns it, once and in order. The status hash chains every
+ * message a member processed, so it then matches the inviter's.
+ */
+BOOST_AUTO_TEST_CASE(test_invitation_backlog_replay)
+{
+    using simulation::User;
+    using np1sec::Conversation;
+
+    simulation::Configuration configuration;
+    configuration.default_link.latency = 10;
+    simulation::Network network(configuration);
+
+    std::vector<User*> users;
+    for (size_t i = 0; i < 4; i++) {
+        User* user = network.add_user(str("user", i));
+        users.push_back(user);
+        network.post([user] { user->connect(); });
+    }
+    BOOST_REQUIRE(network.run_until([&] {
+        for (User* user : users) {
+            if (user->room().users().size() != users.size()) {
+                return false;
+            }
+        }
+        return true;
+    }, 60000));
+
+    auto in_chats = [] (User* user, size_t conversations) {
+        if (user->conversations().size() != conversations) {
+            return false;
+        }
+        for (Conversation* conversation : user->conversations()) {
+            if (!conversation->in_chat() || conversation->participants().size() != 2) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    User* invitee = users[2];
+    User* leaving = users[3];
+    std::string leaving_name = leaving->username();
+    np1sec::PublicKey leaving_key = leaving->room().public_key();
+    for (User* host : { users[0], users[1] }) {
+        host->on_created_conversation = [&network, leaving_name, leaving_key] (Conversation* conversation) {
+            network.post([=] { conversation->invite(leaving_name, leaving_key); });
+        };
+        network.post([host] { host->room().create_conversation(); });
+    }
+    leaving->on_invited = [&network] (Conversation* conversation, const std::string&) {
+        network.post([conversation] { conversation->join(); });
+    };
+    BOOST_REQUIRE(network.run_until([&] { return in_chats(leaving, 2); }, 60000));
+
+    /*
+     * The invitations reach user2 10ms from now and the status messages
+     * 20ms from now; the chat message and the departure in between.
+     */
+    Conversation* hosted[] = { users[0]->conversations()[0], users[1]->conversations()[0] };
+    for (Conversation* conversation : hosted) {
+        network.post([=] { conversation->invite(invitee->username(), invitee->room().public_key()); });
+    }
+    network.schedule(3, [&] { hosted[0]->send_chat("backlog"); });
+    network.schedule(5, [&] { network.remove_user(leaving); });
+    network.run_for(25);
+
+    auto check_replay = [&] {
+        const auto& conversations = invitee->room().m_conversations.m_conversations;
+        BOOST_REQUIRE_EQUAL(conversations.size(), 2);
+        for (const auto& i : conversations) {
+            Conversation* conversation = i.first;
+            Conversation* inviter = conversation->participants().count(users[0]->username()) ? hosted[0] : hosted[1];
+            BOOST_CHECK(!conversation->participants().count(leaving_name));
+            BOOST_CHECK(conversation->m_conversation_status_hash == inviter->m_conversation_status_hash);
+        }
+        BOOST_CHECK(invitee->room().m_conversations.m_event_queue.empty());
+        BOOST_CHECK(invitee->room().m_conversations.m_event_index.empty());
+    };
+    check_replay();
+
+    invitee->on_invited = [&network] (Conversation* conversation, const std::string&) {
+        network.post([conversation] { conversation->join(); });
+    };
+    BOOST_REQUIRE(network.run_until([&] { return in_chats(invitee, 2); }, 60000));
+    network.run_for(1);
+    check_replay();
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_participant_table)
+{
+    np1sec::ParticipantTable<int> table;
+    table["carol"] = 3;
+    table["alice"] = 1;
+    table["dave"] = 4;
+    BOOST_CHECK_EQUAL(table.size(), 3);
+    BOOST_CHECK_EQUAL(table.count("bob"), 0);
+    BOOST_CHECK(table.find("bob") == table.end());
+    BOOST_CHECK_THROW(table.at("bob"), std::out_of_range);
+
+    // Sorted by name, like the std::map it replaces.
+    std::string order;
+    for (const auto& i : table) {
+        order += i.first + ",";
+    }
+    BOOST_CHECK_EQUAL(order, "alice,carol,dave,");
+
+    /*
+     * Inserting shifts the entries after it: the position, and so any
+     * reference, of "carol" now belongs to another entry.
+     */
+    BOOST_CHECK_EQUAL(table.find("carol") - table.begin(), 1);
+    BOOST_CHECK_EQUAL(table["bob"], 0);
+    BOOST_CHECK_EQUAL(table.find("carol") - table.begin(), 2);
+    BOOST_CHECK_EQUAL(table.begin()[1].first, "bob");
+    BOOST_CHECK_EQUAL(table.at("carol"), 3);
+
+    // Erasing shifts them back.
+    auto next = table.erase(table.find("alice"));
+    BOOST_CHECK_EQUAL(next->first, "bob");
+    BOOST_CHECK_EQUAL(table.erase("alice"), 0);
+    BOOST_CHECK_EQUAL(table.erase("bob"), 1);
+    BOOST_CHECK_EQUAL(table.find("carol") - table.begin(), 0);
+    BOOST_CHECK_EQUAL(table.at("carol"), 3);
+    BOOST_CHECK_EQUAL(table.at("dave"), 4);
+    BOOST_CHECK_EQUAL(table.size(), 2);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_username_table)
+{
+    using np1sec::Username;
+
+    np1sec::UsernameTable table;
+    {
+        Username alice = table.intern("alice");
+        Username bob = table.intern("bob");
+        BOOST_CHECK(alice == table.intern("alice"));
+        BOOST_CHECK(alice != bob);
+        BOOST_CHECK_EQUAL(alice.str(), "alice");
+        BOOST_CHECK_EQUAL(table.size(), 2);
+
+        // Copies and moves share one entry, which goes with the last handle.
+        Username copy = alice;
+        Username moved = std::move(copy);
+        BOOST_CHECK(copy.is_null());
+        BOOST_CHECK(moved == alice);
+        alice = Username();
+        BOOST_CHECK_EQUAL(table.size(), 2);
+        const Username& same = moved;
+        moved = same;
+        BOOST_CHECK_EQUAL(moved.str(), "alice");
+        moved = bob;
+        BOOST_CHECK_EQUAL(table.size(), 1);
+        BOOST_CHECK(moved == bob);
+
+        Username again = table.intern("alice");
+        BOOST_CHECK_EQUAL(again.str(), "alice");
+        BOOST_CHECK_EQUAL(table.size(), 2);
+        std::unordered_set<Username> handles = { again, bob, moved };
+        BOOST_CHECK_EQUAL(handles.size(), 2);
+    }
+    // The table must be empty when destroyed, which ~UsernameTable asserts.
+    BOOST_CHECK_EQUAL(table.size(), 0);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_message_encoding)
+{
+    using np1sec::Message;
+
+    for (size_t size = 0; size < 20; size++) {
+        Message message(Message::Type::Chat, std::string(size, 'x'));
+        for (size_t i = 0; i < size; i++) {
+            message.payload[i] = char(i * 37);
+        }
+
+        std::string encoded = message.encode();
+
+        std::string buffer = char(message.type) + message.payload;
+        std::vector<char> base64(((buffer.size() + 2) / 3) * 4);
+        size_t base64_size = np1sec::base64_encode(base64.data(),
+                reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size());
+        BOOST_CHECK_EQUAL(encoded, ":o3np1sec0:" + std::string(base64.data(), base64_size));
+
+        Message decoded = Message::decode(encoded);
+        BOOST_CHECK(decoded.type == message.type);
+        BOOST_CHECK(decoded.payload == message.payload);
+
+        std::string binary = message.encode_binary();
+        BOOST_CHECK_EQUAL(binary.size(), 10 + 1 + size);
+        decoded = Message::decode(binary);
+        BOOST_CHECK(decoded.type == message.type);
+        BOOST_CHECK(decoded.payload == message.payload);
+    }
+
+    np1sec::BatchMessage batch;
+    batch.messages.emplace_back(Message::Type::Chat, "first");
+    batch.messages.emplace_back(Message::Type::Quit, std::string(300, 'q'));
+    batch.messages.emplace_back(Message::Type::Hello, "");
+    np1sec::BatchMessage decoded_batch = np1sec::BatchMessage::decode(Message::decode(batch.encode().encode()));
+    BOOST_REQUIRE_EQUAL(decoded_batch.messages.size(), 3);
+    for (size_t i = 0; i < 3; i++) {
+        BOOST_CHECK(decoded_batch.messages[i].type == batch.messages[i].type);
+        BOOST_CHECK(decoded_batch.messages[i].payload == batch.messages[i].payload);
+    }
+    BOOST_CHECK_THROW(np1sec::BatchMessage::decode(Message(Message::Type::Batch, std::string("\x05\x00", 2))), np1sec::MessageFormatException);
+    BOOST_CHECK_THROW(np1sec::BatchMessage::decode(Message(Message::Type::Batch, std::string("\x43\x05xx", 4))), np1sec::MessageFormatException);
+
+    BOOST_CHECK_THROW(Message::decode(std::string("\0o3np1sec0", 10)), np1sec::MessageFormatException);
+    BOOST_CHECK_THROW(Message::decode(std::string("\0o3np1sec1C", 11)), np1sec::MessageFormatException);
+
+    BOOST_CHECK_THROW(Message::decode(":o3np1sec0:"), np1sec::MessageFormatException);
+    BOOST_CHECK_THROW(Message::decode(":o3np1sec1:AAAA"), np1sec::MessageFormatException);
+    BOOST_CHECK_THROW(Message::decode(":o3np"), np1sec::MessageFormatException);
+    BOOST_CHECK_THROW(Message::decode(":o3np1sec0:QwA"), np1sec::MessageFormatException);
+    BOOST_CHECK_THROW(Message::decode(":o3np1sec0:Qw A"), np1sec::MessageFormatException);
+}
+
+//------------------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_base64_codecs)
+{
+    using np1sec::Base64Codec;
+
+    std::vector<unsigned char> data(200);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (unsigned char) (i * 151 + 7);
+    }
+
+    for (auto codec : {Base64Codec::Scalar, Base64Codec::Sse41, Base64Codec::Avx2}) {
+        if (!np1sec::base64_codec_supported(codec)) {
+            continue;
+        }
+        BOOST_TEST_MESSAGE("base64 codec " << np1sec::base64_codec_name(codec));
+
+        for (size_t size = 0; size <= data.size(); size++) {
+            std::vector<char> expected(((size + 2) / 3) * 4);
+            np1sec::base64_encode(expected.data(), data.data(), size, Base64Codec::Scalar);
+
+            std::vector<char> encoded(expected.size());
+            size_t encoded_size = np1sec::base64_encode(encoded.data(), data.data(), size, codec);
+            BOOST_REQUIRE_EQUAL(encoded_size, encoded.size());
+            BOOST_REQUIRE(encoded == expected);
+
+            std::vector<unsigned char> decoded((encoded.size() / 4) * 3);
+            size_t decoded_size;
+            BOOST_REQUIRE(np1sec::base64_decode(decoded.data(), encoded.data(), encoded.size(), &decoded_size, codec));
+            BOOST_REQUIRE_EQUAL(decoded_size, size);
+            BOOST_REQUIRE(std::equal(data.begin(), data.begin() + size, decoded.begin()));
+
+            /*
+             * Corrupting any single character must be caught, whether it
+             * lands in a vectorized block or in the scalar tail.
+             */
+            for (size_t i = 0; i < encoded.size(); i++) {
+                std::vector<char> corrupt = encoded;
+                corrupt[i] = (i % 2) ? '\xc3' : '-';
+                BOOST_CHECK(!np1sec::base64_decode(decoded.data(), corrupt.data(), corrupt.size(), &decoded_size, codec));
+            }
+        }
+
+        std::vector<unsigned char> output(16);
+        size_t size;
+        auto decode = [&](const std::string& input) {
+            return np1sec::base64_decode(output.data(), input.data(), input.size(), &size, codec);
+        };
+        BOOST_CHECK(decode("QUJD") && size == 3);
+        BOOST_CHECK(decode("QUI=") && size == 2);
+        BOOST_CHECK(decode("QQ==") && size == 1);
+        BOOST_CHECK(!decode("QUJ"));
+        BOOST_CHECK(!decode("QQ=A"));
+        BOOST_CHECK(!decode("QR=="));
+        BOOST_CHECK(!decode("QUJ="));
+        BOOST_CHECK(!decode("QQ==QUJD"));
+        BOOST_CHECK(!decode("QU\nJD"));
+    }
+}
+
+//------------------------------------------------------------------------------
+struct ExecutorRoomInterface : public np1sec::RoomInterface {
+    size_t concurrency = 0;
+    std::atomic<size_t> jobs_executed{0};
+    std::vector<std::thread> threads;
+
+    size_t executor_concurrency() override { return concurrency; }
+
+    void execute(std::function<void()> job) override {
+        threads.emplace_back([this, job] { job(); jobs_executed++; });
+    }
+
+    void send_message(const std::string&) override {}
+    np1sec::TimerToken* set_timer(uint32_t, np1sec::TimerCallback*) override { return nullptr; }
+    void connected() override {}
+    void disconnected() override {}
+    void user_joined(const std::string&, const PublicKey&) override {}
+    void user_left(const std::string&, const PublicKey&) override {}
+    np1sec::ConversationInterface* created_conversation(np1sec::Conversation*) override { return nullptr; }
+    np1sec::ConversationInterface* invited_to_conversation(np1sec::Conversation*, const std::string&) override { return nullptr; }
+
+    ~ExecutorRoomInterface() {
+        for (auto& thread : threads) thread.join();
+    }
+};
+
+/*
+ * Runs a key exchange between user_count users in which "user1" sends the
+ * others a bogus key hash, and returns the malicious users found by user0.
+ */
+static std::set<std::string> reveal_key_exchange(size_t user_count, size_t concurrency, size_t* jobs_executed)
+{
+    using np1sec::KeyExchange;
+
+    std::vector<std::unique_ptr<ExecutorRoomInterface>> interfaces;
+    std::vector<std::unique_ptr<np1sec::Room>> rooms;
+    std::map<std::string, PublicKey> participants;
+    for (size_t i = 0; i < user_count; i++) {
+        interfaces.push_back(std::make_unique<ExecutorRoomInterface>());
+        interfaces.back()->concurrency = concurrency;
+        rooms.push_back(std::make_unique<np1sec::Room>(
+            interfaces.back().get(), str("user", i), np1sec::PrivateKey::generate(true)));
+        participants[rooms.back()->username()] = rooms.back()->public_key();
+    }
+
+    np1sec::Hash key_id = np1sec::crypto::nonce_hash();
+    std::vector<std::unique_ptr<KeyExchange>> exchanges;
+    for (auto& room : rooms) {
+        exchanges.push_back(std::make_unique<KeyExchange>(key_id, participants, room.get()));
+    }
+
+    for (auto& exchange : exchanges) {
+        for (size_t i = 0; i < user_count; i++) {
+            exchange->set_public_key(rooms[i]->username(), exchanges[i]->public_key());
+        }
+    }
+    for (auto& exchange : exchanges) {
+        BOOST_REQUIRE(exchange->state() == KeyExchange::State::SecretShare);
+        for (size_t i = 0; i < user_count; i++) {
+            exchange->set_secret_share(rooms[i]->username(), exchanges[i]->secret_share());
+        }
+    }
+    for (size_t j = 0; j < user_count; j++) {
+        for (size_t i = 0; i < user_count; i++) {
+            np1sec::Hash key_hash = exchanges[i]->key_hash();
+            if (i == 1 && j != 1) {
+                key_hash = np1sec::crypto::nonce_hash();
+            }
+            exchanges[j]->set_key_hash(rooms[i]->username(), key_hash);
+        }
+    }
+    BOOST_REQUIRE(exchanges[0]->state() == KeyExchange::State::Reveal);
+    for (size_t i = 0; i < user_count; i++) {
+        exchanges[0]->set_private_key(rooms[i]->username(), exchanges[i]->serialized_private_key());
+    }
+    BOOST_REQUIRE(exchanges[0]->state() == KeyExchange::State::RevealFinished);
+
+    std::set<std::string> malicious_users = exchanges[0]->malicious_users();
+    exchanges.clear();
+    rooms.clear();
+    *jobs_executed = 0;
+    for (auto& interface : interfaces) {
+        for (auto& thread : interface->threads) thread.join();
+        interface->threads.clear();
+        *jobs_executed += interface->jobs_executed;
+    }
+    return malicious_users;
+}
+
+BOOST_AUTO_TEST_CASE(test_key_exchange_executor)
+{
+    const size_t user_count = 6;
+
+    size_t jobs_executed;
+    auto serial = reveal_key_exchange(user_count, 0, &jobs_executed);
+    BOOST_CHECK_EQUAL(jobs_executed, 0);
+    BOOST_CHECK(serial == std::set<std::string>{"user1"});
+
+    auto parallel = reveal_key_exchange(user_count, 3, &jobs_executed);
+    BOOST_CHECK(jobs_executed > 0);
+    BOOST_CHECK(parallel == serial);
+}
+
+//------------------------------------------------------------------------------
+struct WheelRoomInterface : public ExecutorRoomInterface {
+    np1sec::TimerWheel wheel;
+
+    WheelRoomInterface(uint32_t resolution) : wheel(resolution, 1000000) {}
+
+    size_t timers_set = 0;
+
+    np1sec::TimerToken* set_timer(uint32_t interval, np1sec::TimerCallback* callback) override {
+        timers_set++;
+        return wheel.set_timer(interval, callback);
+    }
+
+    uint64_t current_time() override { return wheel.now(); }
+};
+
+BOOST_AUTO_TEST_CASE(test_timer_wheel)
+{
+    using np1sec::Timer;
+
+    WheelRoomInterface interface(10);
+    std::string fired;
+
+    // 1000ms is past the first level of the wheel, so it has to cascade down.
+    Timer late(&interface, 1000, [&] { fired += "late,"; });
+    Timer first(&interface, 25, [&] { fired += "first,"; });
+    Timer cancelled(&interface, 25, [&] { fired += "cancelled,"; });
+    Timer second(&interface, 25, [&] { fired += "second,"; });
+    Timer immediate(&interface, 0, [&] { fired += "immediate,"; });
+    Timer rearmed;
+    cancelled.stop();
+    BOOST_CHECK_EQUAL(interface.wheel.size(), 4);
+    BOOST_CHECK_EQUAL(interface.wheel.next_expiry(), 1000010);
+
+    interface.wheel.poll(1000009);
+    BOOST_CHECK_EQUAL(fired, "");
+    interface.wheel.poll(1000010);
+    BOOST_CHECK_EQUAL(fired, "immediate,");
+    BOOST_CHECK(!immediate.active());
+
+    // A timer may be set from inside a callback of the same step.
+    first = Timer(&interface, 20, [&] {
+        fired += "first,";
+        BOOST_CHECK_EQUAL(interface.wheel.now(), 1000030);
+        rearmed = Timer(&interface, 0, [&] { fired += "rearmed,"; });
+    });
+    interface.wheel.advance(25);
+    BOOST_CHECK_EQUAL(fired, "immediate,second,first,");
+    BOOST_CHECK(rearmed.active());
+    interface.wheel.advance(5);
+    BOOST_CHECK_EQUAL(fired, "immediate,second,first,rearmed,");
+
+    // Sleeping until next_expiry() reaches the late timer in a few wakeups, none too late.
+    int wakeups = 0;
+    while (late.active()) {
+        uint64_t expiry = interface.wheel.next_expiry();
+        BOOST_REQUIRE(expiry > interface.wheel.now() && expiry <= 1001000);
+        interface.wheel.poll(expiry);
+        wakeups++;
+    }
+    BOOST_CHECK_EQUAL(interface.wheel.now(), 1001000);
+    BOOST_CHECK(wakeups <= 2);
+    BOOST_CHECK_EQUAL(fired, "immediate,second,first,rearmed,late,");
+    BOOST_CHECK_EQUAL(interface.wheel.size(), 0);
+    BOOST_CHECK_EQUAL(interface.wheel.next_expiry(), UINT64_MAX);
+
+    // Cancelled tokens are recycled.
+    for (int i = 0; i < 1000; i++) {
+        Timer timer(&interface, 10 * i, [&] { fired += "leaked,"; });
+    }
+    BOOST_CHECK_EQUAL(interface.wheel.size(), 0);
+    interface.wheel.advance(20000);
+    BOOST_CHECK_EQUAL(fired, "immediate,second,first,rearmed,late,");
+
+    // Five hours is beyond the top level of a 1ms wheel.
+    WheelRoomInterface fine(1);
+    uint32_t five_hours = 5 * 3600 * 1000;
+    bool far_fired = false;
+    Timer far(&fine, five_hours, [&] { far_fired = true; });
+    BOOST_CHECK(fine.wheel.next_expiry() <= fine.wheel.now() + five_hours);
+    fine.wheel.advance(five_hours - 1);
+    BOOST_CHECK(!far_fired);
+    fine.wheel.advance(1);
+    BOOST_CHECK(far_fired);
+}
+
+BOOST_AUTO_TEST_CASE(test_deadline_queue)
+{
+    using np1sec::Deadline;
+
+    WheelRoomInterface interface(1);
+    np1sec::DeadlineQueue queue(&interface, 10);
+    std::vector<int> fired;
+
+    std::vector<Deadline> deadlines;
+    for (int i = 0; i < 100; i++) {
+        deadlines.emplace_back(&queue, 60000, [&fired, i] { fired.push_back(i); });
+        interface.wheel.advance(1);
+    }
+    BOOST_CHECK_EQUAL(interface.timers_set, 1);
+    for (int i = 0; i < 100; i += 2) {
+        deadlines[i].stop();
+    }
+
+    // An earlier deadline moves the host timer.
+    Deadline early(&queue, 100, [&] { fired.push_back(-1); });
+    BOOST_CHECK_EQUAL(interface.timers_set, 2);
+    interface.wheel.advance(100);
+    BOOST_CHECK(fired == std::vector<int>{-1});
+
+    // Deadlines that are due together fire in the order they were set.
+    interface.wheel.advance(60000);
+    BOOST_CHECK_EQUAL(fired.size(), 51);
+    BOOST_CHECK(std::is_sorted(fired.begin(), fired.end()));
+    BOOST_CHECK_EQUAL(fired.back(), 99);
+    BOOST_CHECK_EQUAL(queue.size(), 0);
+    BOOST_CHECK_EQUAL(interface.wheel.size(), 0);
+    // One host timer per 10ms period the deadlines were spread over.
+    BOOST_CHECK(interface.timers_set <= 13);
+
+    deadlines.clear();
+}
+
+BOOST_AUTO_TEST_CASE(test_room_statistics)
+{
+    np1sec::LatencyHistogram histogram;
+    BOOST_CHECK_EQUAL(histogram.percentile(0.5), 0);
+    for (uint64_t i = 1; i <= 1000; i++) {
+        histogram.add(i * 1000);
+    }
+    histogram.add(0);
+    BOOST_CHECK_EQUAL(histogram.count(), 1001);
+    BOOST_CHECK_EQUAL(histogram.total(), 500500000);
+    BOOST_CHECK_EQUAL(histogram.max(), 1000000);
+    BOOST_CHECK_EQUAL(histogram.bucket(0), 1);
+    // Within a factor of two above the true value.
+    BOOST_CHECK(histogram.percentile(0.5) >= 500000 && histogram.percentile(0.5) < 1000000);
+    BOOST_CHECK_EQUAL(histogram.percentile(1), 1000000);
+
+    // Every known type has a slot of its own; other type bytes share the last.
+    using np1sec::Message;
+    using np1sec::RoomStatistics;
+    std::set<size_t> slots;
+    for (unsigned int byte = 0; byte < 256; byte++) {
+        size_t slot = RoomStatistics::message_type_index(Message::Type(byte));
+        BOOST_REQUIRE(slot < RoomStatistics::c_message_types);
+        if (slot != RoomStatistics::c_unknown_message_type) {
+            BOOST_CHECK(slots.insert(slot).second);
+        }
+    }
+    BOOST_CHECK_EQUAL(slots.size(), RoomStatistics::c_message_types - 1);
+    BOOST_CHECK_EQUAL(RoomStatistics::message_type_index(Message::Type(0x00)), RoomStatistics::c_unknown_message_type);
+    BOOST_CHECK_EQUAL(RoomStatistics::message_type_index(Message::Type(0xff)), RoomStatistics::c_unknown_message_type);
+    BOOST_CHECK(RoomStatistics::message_type_index(Message::Type::ChatChunk) != RoomStatistics::c_unknown_message_type);
+
+    WheelRoomInterface interface(1);
+    np1sec::TimerStatistics timers;
+    np1sec::DeadlineQueue queue(&interface, 10, &timers);
+    int fired = 0;
+    np1sec::Deadline first(&queue, 100, [&] { fired++; });
+    np1sec::Deadline second(&queue, 200, [&] { fired++; });
+    np1sec::Deadline cancelled(&queue, 300, [&] { fired++; });
+    cancelled.stop();
+    interface.wheel.advance(1000);
+    BOOST_CHECK_EQUAL(fired, 2);
+    BOOST_CHECK_EQUAL(timers.deadlines_set, 3);
+    BOOST_CHECK_EQUAL(timers.deadlines_expired, 2);
+    BOOST_CHECK_EQUAL(timers.host_timers_armed, 2);
+    BOOST_CHECK_EQUAL(timers.host_timers_fired, 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_session_statistics)
+{
+    using np1sec::Message;
+    const size_t user_count = 3;
+
+    test_with_session(user_count, [=] (EchoServer&, std::vector<User>& users, auto finish) {
+        for (auto& user : users) {
+            const np1sec::RoomStatistics& statistics = user.room.get_np1sec_room()->statistics();
+
+            BOOST_CHECK(statistics.transport_messages_in > 0);
+            BOOST_CHECK(statistics.transport_bytes_in > statistics.transport_messages_in);
+            BOOST_CHECK(statistics.transport_messages_out > 0);
+            BOOST_CHECK(statistics.transport_bytes_out > statistics.transport_messages_out);
+            BOOST_CHECK(statistics.decode_time.count() > 0);
+            BOOST_CHECK(statistics.verify_time.count() > 0);
+
+            // Our own messages are echoed back to us.
+            const auto& hello = statistics.message_type(Message::Type::Hello);
+            BOOST_CHECK(hello.messages_out > 0);
+            BOOST_CHECK(hello.messages_in >= hello.messages_out);
+            BOOST_CHECK(hello.payload_bytes_in > 0);
+            BOOST_CHECK_EQUAL(hello.handler_time.count(), hello.messages_in);
+
+            // Everyone took part in the key exchange of the final session.
+            const auto& public_key = statistics.message_type(Message::Type::KeyExchangePublicKey);
+            BOOST_CHECK(public_key.messages_out > 0);
+            BOOST_CHECK(public_key.payload_bytes_out > 0);
+            BOOST_CHECK(public_key.messages_in >= user_count);
+            BOOST_CHECK_EQUAL(public_key.handler_time.count(), public_key.messages_in);
+
+            BOOST_CHECK(statistics.key_exchanges_started > 0);
+            BOOST_CHECK(statistics.key_exchanges_completed > 0);
+            BOOST_CHECK(statistics.activation_time.count() > 0);
+        }
+
+        // Reports are driven by RoomInterface::set_timer.
+        auto reported = std::make_shared<bool>(false);
+        users[0].room.get_np1sec_room()->set_statistics_callback([=] (const np1sec::RoomStatistics& statistics) {
+            if (*reported) {
+                return;
+            }
+            *reported = true;
+            BOOST_CHECK(statistics.key_exchanges_completed > 0);
+            finish();
+        }, 10);
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_chrome_trace_writer)
+{
+    std::ostringstream output;
+    {
+        np1sec::ChromeTraceWriter writer(output, true);
+
+        np1sec::TraceEvent event;
+        event.type = np1sec::TraceEvent::Type::Begin;
+        event.name = "key_exchange";
+        event.id = "00ff";
+        event.room = "alice";
+        event.detail = "2 participants";
+        event.host_time = 5;
+        event.time = 0;
+        event.duration = 0;
+        writer.trace(event);
+
+        event.type = np1sec::TraceEvent::Type::Complete;
+        event.name = "finish_public_key";
+        event.room = "bob \"b\"";
+        event.participant = "alice";
+        event.duration = 1500;
+        writer.trace(event);
+
+        event.type = np1sec::TraceEvent::Type::End;
+        event.name = "key_exchange";
+        event.duration = 0;
+        writer.trace(event);
+    }
+
+    std::string trace = output.str();
+    BOOST_CHECK_EQUAL(trace.front(), '[');
+    BOOST_CHECK_EQUAL(trace.substr(trace.size() - 3), "\n]\n");
+    BOOST_CHECK(trace.find("{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"alice\"}}") != std::string::npos);
+    BOOST_CHECK(trace.find("\"name\": \"bob \\\"b\\\"\"") != std::string::npos);
+    BOOST_CHECK(trace.find("\"ph\": \"X\", \"pid\": 2, \"tid\": 0, \"ts\": 5000, \"dur\": 1.500") != std::string::npos);
+
+    /*
+     * Both rooms report the same key exchange; process-local ids keep the
+     * end in room 2 from closing the span begun in room 1.
+     */
+    BOOST_CHECK(trace.find("\"ph\": \"b\", \"pid\": 1, \"tid\": 0, \"ts\": 5000, \"id2\": {\"local\": \"00ff\"}") != std::string::npos);
+    BOOST_CHECK(trace.find("\"ph\": \"e\", \"pid\": 2, \"tid\": 0, \"ts\": 5000, \"id2\": {\"local\": \"00ff\"}") != std::string::npos);
+    BOOST_CHECK(trace.find("\"id\":") == std::string::npos);
+}
+
+struct RecordingTraceSink : public np1sec::TraceSink {
+    std::vector<np1sec::TraceEvent> events;
+    std::function<void(const np1sec::TraceEvent&)> on_event;
+
+    void trace(const np1sec::TraceEvent& event) override {
+        events.push_back(event);
+        if (on_event) on_event(event);
+    }
+
+    size_t count(np1sec::TraceEvent::Type type, const std::string& name) const {
+        return std::count_if(events.begin(), events.end(), [&] (const np1sec::TraceEvent& event) {
+            return event.type == type && event.name == name;
+        });
+    }
+};
+
+BOOST_AUTO_TEST_CASE(test_session_trace)
+{
+    using Type = np1sec::TraceEvent::Type;
+    const size_t user_count = 3;
+
+    RecordingTraceSink sink;
+    std::set<std::string> activated;
+
+    test_with_session(user_count, [&] (EchoServer&, std::vector<User>& users, auto finish) {
+        for (auto& user : users) {
+            user.room.get_np1sec_room()->set_trace_sink(&sink);
+        }
+
+        // Every room activates the session the ratchet sets up.
+        sink.on_event = [&, finish] (const np1sec::TraceEvent& event) {
+            if (event.type == Type::End && event.name == std::string("session_activation")) {
+                if (activated.insert(event.room).second && activated.size() == user_count) {
+                    finish();
+                }
+            }
+        };
+
+        auto& ec = users[0].conv.get_np1sec_conv()->m_encrypted_chat;
+        ec.send_ratchet(ec.latest_session_id());
+    });
+
+    BOOST_CHECK_EQUAL(sink.count(Type::Instant, "send_ratchet"), 1);
+    BOOST_CHECK_EQUAL(sink.count(Type::Instant, "ratchet"), user_count);
+
+    BOOST_CHECK_EQUAL(sink.count(Type::Begin, "key_exchange"), user_count);
+    BOOST_CHECK_EQUAL(sink.count(Type::End, "key_exchange"), user_count);
+    BOOST_CHECK_EQUAL(sink.count(Type::Instant, "public_key"), user_count * (user_count - 1));
+    BOOST_CHECK_EQUAL(sink.count(Type::Complete, "finish_public_key"), user_count);
+    BOOST_CHECK_EQUAL(sink.count(Type::Complete, "finish_secret_share"), user_count);
+    BOOST_CHECK_EQUAL(sink.count(Type::Complete, "finish_acceptance"), user_count);
+
+    BOOST_CHECK_EQUAL(sink.count(Type::Begin, "session_activation"), user_count);
+    BOOST_CHECK_EQUAL(sink.count(Type::End, "session_activation"), user_count);
+    BOOST_CHECK_EQUAL(sink.count(Type::Instant, "activation"), user_count * user_count);
+
+    // One key exchange, seen by every room.
+    std::set<std::string> ids;
+    std::set<std::string> rooms;
+    for (const auto& event : sink.events) {
+        if (event.name == std::string("key_exchange")) {
+            ids.insert(event.id);
+        }
+        rooms.insert(event.room);
+    }
+    BOOST_CHECK_EQUAL(ids.size(), 1);
+    BOOST_CHECK_EQUAL(rooms.size(), user_count);
+}
+
+//------------------------------------------------------------------------------
+struct HostedUser : public np1sec::HostedRoomInterface {
+    std::function<void(const std::string&)> broadcast;
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    std::set<std::string> joined;
+
+    void record_thread() {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.insert(std::this_thread::get_id());
+    }
+
+    void send_message(const std::string& message) override { record_thread(); broadcast(message); }
+    void connected() override { record_thread(); }
+    void disconnected() override { record_thread(); }
+    void user_joined(const std::string& username, const PublicKey&) override {
+        record_thread();
+        std::lock_guard<std::mutex> lock(mutex);
+        joined.insert(username);
+    }
+    void user_left(const std::string&, const PublicKey&) override { record_thread(); }
+    np1sec::ConversationInterface* created_conversation(np1sec::Conversation*) override { return nullptr; }
+    np1sec::ConversationInterface* invited_to_conversation(np1sec::Conversation*, const std::string&) override { return nullptr; }
+};
+
+BOOST_AUTO_TEST_CASE(test_room_host)
+{
+    const size_t user_count = 4;
+
+    std::vector<std::unique_ptr<HostedUser>> users;
+    std::vector<np1sec::HostedRoom*> rooms;
+    // The channel delivers every message to all rooms in one global order.
+    std::mutex channel;
+    np1sec::RoomHost host(2);
+    BOOST_CHECK_EQUAL(host.worker_count(), 2);
+
+    for (size_t i = 0; i < user_count; i++) {
+        std::string username = str("user", i);
+        users.push_back(std::make_unique<HostedUser>());
+        users.back()->broadcast = [&rooms, &channel, username] (const std::string& message) {
+            std::lock_guard<std::mutex> lock(channel);
+            for (np1sec::HostedRoom* room : rooms) {
+                room->message_received(username, message);
+            }
+        };
+        np1sec::HostedRoom* room = host.create_room(users.back().get(), username, np1sec::PrivateKey::generate(true));
+        BOOST_CHECK_EQUAL(room->worker(), i % 2);
+        // Joins the channel with its connect queued ahead of any message from it.
+        std::lock_guard<std::mutex> lock(channel);
+        room->connect();
+        rooms.push_back(room);
+    }
+
+    auto all_joined = [&] {
+        for (auto& user : users) {
+            std::lock_guard<std::mutex> lock(user->mutex);
+            if (user->joined.size() < user_count - 1) return false;
+        }
+        return true;
+    };
+    auto start = Clock::now();
+    while (!all_joined() && Clock::now() - start < 30s) {
+        std::this_thread::sleep_for(10ms);
+    }
+    BOOST_REQUIRE(all_joined());
+
+    // Every room calls back from its own worker only, and rooms 0 and 1 have different ones.
+    for (auto& user : users) {
+        std::lock_guard<std::mutex> lock(user->mutex);
+        BOOST_CHECK_EQUAL(user->threads.size(), 1);
+        BOOST_CHECK(user->threads.count(std::this_thread::get_id()) == 0);
+    }
+    BOOST_CHECK(users[0]->threads == users[2]->threads);
+    BOOST_CHECK(users[0]->threads != users[1]->threads);
+
+    {
+        std::lock_guard<std::mutex> lock(channel);
+        host.destroy_room(rooms.back());
+        rooms.pop_back();
+    }
+}
@@ -0,0 +1,503 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "network.h"
+
+#include <algorithm>
+#include <cassert>
+#include <ctime>
+
+namespace simulation
+{
+
+uint64_t cpu_time()
+{
+	timespec time;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+	return uint64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+uint64_t wall_time()
+{
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return uint64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+Statistics Statistics::operator-(const Statistics& other) const
+{
+	Statistics result = *this;
+	result.messages_sent -= other.messages_sent;
+	result.bytes_sent -= other.bytes_sent;
+	result.messages_delivered -= other.messages_delivered;
+	result.messages_lost -= other.messages_lost;
+	for (const auto& i : other.messages_by_type) {
+		MessageStatistics& type = result.messages_by_type[i.first];
+		type.sent -= i.second.sent;
+		type.bytes -= i.second.bytes;
+		type.cpu_time -= i.second.cpu_time;
+		type.wall_time -= i.second.wall_time;
+		if (type.sent == 0) {
+			result.messages_by_type.erase(i.first);
+		}
+	}
+	result.cpu_time -= other.cpu_time;
+	result.wall_time -= other.wall_time;
+	return result;
+}
+
+
+
+void UserConversation::user_left(const std::string& username)
+{
+	if (m_user->on_user_left) {
+		m_user->on_user_left(m_conversation, username);
+	}
+}
+
+void UserConversation::user_joined_chat(const std::string& username)
+{
+	if (m_user->on_user_joined_chat) {
+		m_user->on_user_joined_chat(m_conversation, username);
+	}
+}
+
+void UserConversation::message_received(const std::string& sender, const std::string& message)
+{
+	if (m_user->on_message) {
+		m_user->on_message(m_conversation, sender, message);
+	}
+}
+
+void UserConversation::joined_chat()
+{
+	if (m_user->on_joined_chat) {
+		m_user->on_joined_chat(m_conversation);
+	}
+}
+
+void UserConversation::left()
+{
+	// Destroys this.
+	m_user->m_conversations.erase(m_conversation);
+}
+
+
+
+User::User(Network* network, size_t index, const std::string& username, const np1sec::PrivateKey& private_key):
+	m_network(network),
+	m_index(index),
+	m_username(username),
+	m_in_channel(false),
+	m_last_delivery(0),
+	m_room(this, username, private_key)
+{
+	m_room.debug_disable_fsck(!network->m_configuration.fsck);
+}
+
+void User::connect()
+{
+	m_in_channel = true;
+	m_room.connect();
+}
+
+std::vector<np1sec::Conversation*> User::conversations() const
+{
+	std::vector<np1sec::Conversation*> result;
+	for (const auto& i : m_conversations) {
+		result.push_back(i.first);
+	}
+	return result;
+}
+
+void User::send_message(const std::string& message)
+{
+	m_network->broadcast(this, message);
+}
+
+bool User::binary_transport() const
+{
+	return m_network->m_configuration.binary_transport;
+}
+
+bool User::batch_messages() const
+{
+	return m_network->m_configuration.batch_messages;
+}
+
+bool User::chunk_messages() const
+{
+	return m_network->m_configuration.chunk_messages;
+}
+
+np1sec::TimerToken* User::set_timer(uint32_t interval, np1sec::TimerCallback* callback)
+{
+	return m_network->set_timer(interval, callback);
+}
+
+uint64_t User::current_time()
+{
+	return m_network->now();
+}
+
+void User::connected()
+{
+	if (on_connected) {
+		on_connected();
+	}
+}
+
+void User::disconnected()
+{
+	m_in_channel = false;
+}
+
+void User::user_joined(const std::string& username, const np1sec::PublicKey& public_key)
+{
+	if (on_user_joined) {
+		on_user_joined(username, public_key);
+	}
+}
+
+np1sec::ConversationInterface* User::created_conversation(np1sec::Conversation* conversation)
+{
+	UserConversation* result = new UserConversation(this, conversation);
+	m_conversations[conversation].reset(result);
+	if (on_created_conversation) {
+		on_created_conversation(conversation);
+	}
+	return result;
+}
+
+np1sec::ConversationInterface* User::invited_to_conversation(np1sec::Conversation* conversation, const std::string& username)
+{
+	UserConversation* result = new UserConversation(this, conversation);
+	m_conversations[conversation].reset(result);
+	if (on_invited) {
+		on_invited(conversation, username);
+	}
+	return result;
+}
+
+
+
+class Network::Timer : public np1sec::TimerToken
+{
+	public:
+	explicit Timer(np1sec::TimerCallback* callback_):
+		callback(callback_)
+	{}
+
+	void unset() override
+	{
+		// The event stays queued, and frees the token when its time comes.
+		callback = nullptr;
+	}
+
+	np1sec::TimerCallback* callback;
+};
+
+Network::Network(const Configuration& configuration):
+	m_configuration(configuration),
+	m_now(0),
+	m_next_sequence(0),
+	m_random_state(configuration.seed),
+	m_cpu_overhead(0),
+	m_wall_overhead(0)
+{}
+
+Network::~Network()
+{
+	/*
+	 * Rooms cancel their timers when destroyed, so they go before the
+	 * events. Anything they send on the way is dropped.
+	 */
+	for (auto& user : m_users) {
+		if (user) {
+			user->m_in_channel = false;
+		}
+	}
+	m_users.clear();
+}
+
+void Network::set_link(const std::string& sender, const std::string& receiver, const LinkProperties& properties)
+{
+	m_links[std::make_pair(sender, receiver)] = properties;
+}
+
+const LinkProperties& Network::link(const std::string& sender, const std::string& receiver) const
+{
+	auto it = m_links.find(std::make_pair(sender, receiver));
+	if (it == m_links.end()) {
+		return m_configuration.default_link;
+	}
+	return it->second;
+}
+
+User* Network::add_user(const std::string& username)
+{
+	assert(!user(username));
+
+	np1sec::SerializedPrivateKey seed;
+	for (size_t i = 0; i < sizeof(seed.buffer); i += 8) {
+		uint64_t value = random();
+		for (size_t j = 0; j < 8; j++) {
+			seed.buffer[i + j] = uint8_t(value >> (8 * j));
+		}
+	}
+
+	m_users.emplace_back(new User(this, m_users.size(), username, np1sec::PrivateKey::unserialize(seed)));
+	return m_users.back().get();
+}
+
+void Network::remove_user(User* user)
+{
+	size_t index = user->m_index;
+	assert(m_users[index].get() == user);
+
+	std::string username = user->username();
+	bool was_in_channel = user->m_in_channel;
+	user->m_in_channel = false;
+	m_users[index].reset();
+
+	if (!was_in_channel) {
+		return;
+	}
+	for (auto& receiver : m_users) {
+		if (!receiver || !receiver->m_in_channel) {
+			continue;
+		}
+		User* receiver_pointer = receiver.get();
+		size_t receiver_index = receiver->m_index;
+		schedule_delivery(receiver_pointer, link(username, receiver->username()).latency, [this, receiver_pointer, receiver_index, username] {
+			if (m_users[receiver_index].get() == receiver_pointer && receiver_pointer->m_in_channel) {
+				receiver_pointer->m_room.user_left(username);
+			}
+		});
+	}
+}
+
+User* Network::user(const std::string& username) const
+{
+	for (const auto& user : m_users) {
+		if (user && user->username() == username) {
+			return user.get();
+		}
+	}
+	return nullptr;
+}
+
+std::vector<User*> Network::users() const
+{
+	std::vector<User*> result;
+	for (const auto& user : m_users) {
+		if (user) {
+			result.push_back(user.get());
+		}
+	}
+	return result;
+}
+
+void Network::post(std::function<void()> action)
+{
+	schedule(0, std::move(action));
+}
+
+void Network::schedule(uint64_t delay, std::function<void()> action)
+{
+	Event event;
+	event.time = m_now + delay;
+	event.sequence = m_next_sequence++;
+	event.action = std::move(action);
+	m_events.push(std::move(event));
+}
+
+bool Network::step()
+{
+	if (m_events.empty()) {
+		return false;
+	}
+
+	Event event = m_events.top();
+	m_events.pop();
+	assert(event.time >= m_now);
+	m_now = event.time;
+
+	m_cpu_overhead = 0;
+	m_wall_overhead = 0;
+	uint64_t cpu_start = cpu_time();
+	uint64_t wall_start = wall_time();
+	event.action();
+	uint64_t cpu_elapsed = cpu_time() - cpu_start;
+	uint64_t wall_elapsed = wall_time() - wall_start;
+	m_statistics.cpu_time += cpu_elapsed > m_cpu_overhead ? cpu_elapsed - m_cpu_overhead : 0;
+	m_statistics.wall_time += wall_elapsed > m_wall_overhead ? wall_elapsed - m_wall_overhead : 0;
+
+	return true;
+}
+
+bool Network::run_until(std::function<bool()> condition, uint64_t timeout)
+{
+	uint64_t deadline = m_now + timeout;
+	while (!condition()) {
+		if (m_events.empty() || m_events.top().time > deadline) {
+			m_now = deadline;
+			return false;
+		}
+		step();
+	}
+	return true;
+}
+
+void Network::run_for(uint64_t duration)
+{
+	uint64_t deadline = m_now + duration;
+	while (!m_events.empty() && m_events.top().time <= deadline) {
+		step();
+	}
+	m_now = deadline;
+}
+
+uint64_t Network::random()
+{
+	// splitmix64, which is the same on every platform, unlike the standard distributions.
+	uint64_t z = (m_random_state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+void Network::broadcast(User* sender, const std::string& message)
+{
+	if (!sender->m_in_channel) {
+		return;
+	}
+
+	uint64_t cpu_start = cpu_time();
+	uint64_t wall_start = wall_time();
+
+	std::shared_ptr<Broadcast> broadcast = std::make_shared<Broadcast>();
+	broadcast->message = message;
+	count_message(broadcast.get());
+
+	std::string sender_username = sender->username();
+	for (auto& receiver : m_users) {
+		if (!receiver || !receiver->m_in_channel) {
+			continue;
+		}
+
+		const LinkProperties& properties = link(sender_username, receiver->username());
+		if (properties.loss > 0 && (random() >> 11) * (1.0 / (uint64_t(1) << 53)) < properties.loss) {
+			m_statistics.messages_lost++;
+			continue;
+		}
+		uint64_t delay = properties.latency;
+		if (properties.jitter > 0) {
+			delay += random() % (uint64_t(properties.jitter) + 1);
+		}
+
+		User* receiver_pointer = receiver.get();
+		size_t receiver_index = receiver->m_index;
+		schedule_delivery(receiver_pointer, delay, [this, receiver_pointer, receiver_index, sender_username, broadcast] {
+			if (m_users[receiver_index].get() == receiver_pointer && receiver_pointer->m_in_channel) {
+				deliver(receiver_pointer, sender_username, *broadcast);
+			}
+		});
+	}
+
+	m_cpu_overhead += cpu_time() - cpu_start;
+	m_wall_overhead += wall_time() - wall_start;
+}
+
+void Network::deliver(User* receiver, const std::string& sender, const Broadcast& broadcast)
+{
+	m_statistics.messages_delivered++;
+
+	/*
+	 * Anything the receiver sends in response is part of handling the
+	 * message, but the network's share of that is not.
+	 */
+	uint64_t cpu_overhead = m_cpu_overhead;
+	uint64_t wall_overhead = m_wall_overhead;
+	uint64_t cpu_start = cpu_time();
+	uint64_t wall_start = wall_time();
+	receiver->m_room.message_received(sender, broadcast.message);
+	uint64_t cpu_elapsed = cpu_time() - cpu_start - (m_cpu_overhead - cpu_overhead);
+	uint64_t wall_elapsed = wall_time() - wall_start - (m_wall_overhead - wall_overhead);
+
+	if (broadcast.types.empty()) {
+		return;
+	}
+	for (np1sec::Message::Type type : broadcast.types) {
+		MessageStatistics& statistics = m_statistics.messages_by_type[type];
+		statistics.cpu_time += cpu_elapsed / broadcast.types.size();
+		statistics.wall_time += wall_elapsed / broadcast.types.size();
+	}
+}
+
+void Network::schedule_delivery(User* receiver, uint64_t delay, std::function<void()> action)
+{
+	// Events due at the same time run in the order they were scheduled.
+	uint64_t time = std::max(m_now + delay, receiver->m_last_delivery);
+	receiver->m_last_delivery = time;
+	schedule(time - m_now, std::move(action));
+}
+
+np1sec::TimerToken* Network::set_timer(uint32_t interval, np1sec::TimerCallback* callback)
+{
+	std::shared_ptr<Timer> timer = std::make_shared<Timer>(callback);
+	schedule(interval, [timer] {
+		if (timer->callback) {
+			timer->callback->execute();
+		}
+	});
+	return timer.get();
+}
+
+void Network::count_message(Broadcast* broadcast)
+{
+	m_statistics.messages_sent++;
+	m_statistics.bytes_sent += broadcast->message.size();
+
+	np1sec::Message message;
+	try {
+		message = np1sec::Message::decode(broadcast->message);
+	} catch (np1sec::MessageFormatException) {
+		return;
+	}
+
+	if (message.type != np1sec::Message::Type::Batch) {
+		MessageStatistics& statistics = m_statistics.messages_by_type[message.type];
+		statistics.sent++;
+		statistics.bytes += broadcast->message.size();
+		broadcast->types.push_back(message.type);
+		return;
+	}
+	try {
+		np1sec::BatchMessage batch = np1sec::BatchMessage::decode(message);
+		for (const np1sec::Message& inner : batch.messages) {
+			MessageStatistics& statistics = m_statistics.messages_by_type[inner.type];
+			statistics.sent++;
+			statistics.bytes += inner.payload.size();
+			broadcast->types.push_back(inner.type);
+		}
+	} catch (np1sec::MessageFormatException) {
+	}
+}
+
+} // namespace simulation
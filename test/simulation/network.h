@@ -0,0 +1,363 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef TEST_SIMULATION_NETWORK_H_
+#define TEST_SIMULATION_NETWORK_H_
+
+#include "src/interface.h"
+#include "src/message.h"
+#include "src/room.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace simulation
+{
+
+/**
+ * The delivery properties of the channel from one user to another.
+ */
+struct LinkProperties
+{
+	/* Delay of every message, in milliseconds. */
+	uint32_t latency = 0;
+	/*
+	 * A random extra delay of up to this many milliseconds, drawn for
+	 * each message. A delayed message holds up the ones sent after it
+	 * to the same receiver; it never lets them overtake it.
+	 */
+	uint32_t jitter = 0;
+	/* Probability that a message is never delivered. */
+	double loss = 0;
+};
+
+struct Configuration
+{
+	/* Seed of every random choice the network makes, and of the users' long-term keys. */
+	uint64_t seed = 1;
+	bool binary_transport = true;
+	bool batch_messages = true;
+	bool chunk_messages = true;
+	/* Run the conversation consistency checks, which are enabled by default in builds with assertions. */
+	bool fsck = true;
+	LinkProperties default_link;
+};
+
+struct MessageStatistics
+{
+	uint64_t sent = 0;
+	uint64_t bytes = 0;
+	/*
+	 * Time spent processing deliveries of these messages, in nanoseconds.
+	 * A batch is charged to the messages in it in equal parts.
+	 */
+	uint64_t cpu_time = 0;
+	uint64_t wall_time = 0;
+};
+
+struct Statistics
+{
+	/* Calls to RoomInterface::send_message, and their total size. */
+	uint64_t messages_sent = 0;
+	uint64_t bytes_sent = 0;
+	/* Copies of those messages delivered to, or lost before reaching, each user in the channel. */
+	uint64_t messages_delivered = 0;
+	uint64_t messages_lost = 0;
+	/*
+	 * Protocol messages sent, with batches counted as the messages they
+	 * contain. The bytes of a message in a batch are those of its payload.
+	 */
+	std::map<np1sec::Message::Type, MessageStatistics> messages_by_type;
+	/* Time spent in the library, in nanoseconds, including timers and scenario actions. */
+	uint64_t cpu_time = 0;
+	uint64_t wall_time = 0;
+
+	Statistics operator-(const Statistics& other) const;
+};
+
+class Network;
+class User;
+
+/**
+ * A conversation of a simulated user, forwarding its events to the hooks of the user.
+ */
+class UserConversation : public np1sec::ConversationInterface
+{
+	public:
+	UserConversation(User* user, np1sec::Conversation* conversation):
+		m_user(user),
+		m_conversation(conversation)
+	{}
+
+	np1sec::Conversation* conversation() const
+	{
+		return m_conversation;
+	}
+
+	void user_invited(const std::string&, const std::string&) override {}
+	void invitation_cancelled(const std::string&, const std::string&) override {}
+	void user_authenticated(const std::string&, const np1sec::PublicKey&) override {}
+	void user_authentication_failed(const std::string&) override {}
+	void user_joined(const std::string&) override {}
+	void user_left(const std::string& username) override;
+	void votekick_registered(const std::string&, const std::string&, bool) override {}
+	void user_joined_chat(const std::string& username) override;
+	void message_received(const std::string& sender, const std::string& message) override;
+	void joined() override {}
+	void joined_chat() override;
+	void left() override;
+
+	protected:
+	User* m_user;
+	np1sec::Conversation* m_conversation;
+};
+
+/**
+ * A user of the simulated channel, running one np1sec::Room.
+ *
+ * Scenarios drive a user through the hooks below, which are called from
+ * the room's interface callbacks, and through room().
+ */
+class User : public np1sec::RoomInterface
+{
+	public:
+	User(Network* network, size_t index, const std::string& username, const np1sec::PrivateKey& private_key);
+
+	const std::string& username() const
+	{
+		return m_username;
+	}
+
+	np1sec::Room& room()
+	{
+		return m_room;
+	}
+
+	/**
+	 * Enter the channel and connect the room.
+	 */
+	void connect();
+
+	/**
+	 * The conversations of this user that have not been left.
+	 */
+	std::vector<np1sec::Conversation*> conversations() const;
+
+	std::function<void()> on_connected;
+	std::function<void(const std::string& username, const np1sec::PublicKey& public_key)> on_user_joined;
+	std::function<void(np1sec::Conversation* conversation)> on_created_conversation;
+	std::function<void(np1sec::Conversation* conversation, const std::string& inviter)> on_invited;
+	std::function<void(np1sec::Conversation* conversation)> on_joined_chat;
+	std::function<void(np1sec::Conversation* conversation, const std::string& username)> on_user_joined_chat;
+	std::function<void(np1sec::Conversation* conversation, const std::string& username)> on_user_left;
+	std::function<void(np1sec::Conversation* conversation, const std::string& sender, const std::string& message)> on_message;
+
+	/*
+	 * RoomInterface
+	 */
+	void send_message(const std::string& message) override;
+	bool binary_transport() const override;
+	bool batch_messages() const override;
+	bool chunk_messages() const override;
+	np1sec::TimerToken* set_timer(uint32_t interval, np1sec::TimerCallback* callback) override;
+	uint64_t current_time() override;
+	void connected() override;
+	void disconnected() override;
+	void user_joined(const std::string& username, const np1sec::PublicKey& public_key) override;
+	void user_left(const std::string&, const np1sec::PublicKey&) override {}
+	np1sec::ConversationInterface* created_conversation(np1sec::Conversation* conversation) override;
+	np1sec::ConversationInterface* invited_to_conversation(np1sec::Conversation* conversation, const std::string& username) override;
+
+	protected:
+	friend class Network;
+	friend class UserConversation;
+
+	Network* m_network;
+	size_t m_index;
+	std::string m_username;
+	bool m_in_channel;
+	/* When the last message the network queued for this user is delivered. */
+	uint64_t m_last_delivery;
+	std::map<np1sec::Conversation*, std::unique_ptr<UserConversation>> m_conversations;
+	np1sec::Room m_room;
+};
+
+/**
+ * An in-process, single-threaded simulation of the broadcast channel
+ * np1sec runs on, with a virtual clock.
+ *
+ * Every message a user sends is delivered to every user in the channel,
+ * including the sender, after the latency of the link between them.
+ *
+ * The channel is ordered, like the chat server of a real room: every user
+ * receives the messages and departures of the channel in the order they
+ * happened, although each after its own delay. This is what np1sec relies
+ * on. The protocol tolerates messages that arrive late, and at different
+ * times for different users, but a user that sees two messages in a
+ * different order than the others disagrees with them about the state of
+ * the room, and disconnects as soon as it notices.
+ *
+ * Timers run on the same clock, and the network jumps from one event to
+ * the next, so minutes of protocol timeouts pass in no time. Events due
+ * at the same moment run in the order they were scheduled, and all
+ * random choices come from the seed, so a run can be repeated exactly up
+ * to the keys the library generates for itself.
+ */
+class Network
+{
+	public:
+	explicit Network(const Configuration& configuration = Configuration());
+	~Network();
+
+	Network(const Network&) = delete;
+	Network& operator=(const Network&) = delete;
+
+	/* The virtual time, in milliseconds. */
+	uint64_t now() const
+	{
+		return m_now;
+	}
+
+	void set_link(const std::string& sender, const std::string& receiver, const LinkProperties& properties);
+	const LinkProperties& link(const std::string& sender, const std::string& receiver) const;
+
+	/**
+	 * Create a user with a long-term key derived from the seed. The
+	 * user does not enter the channel until User::connect.
+	 */
+	User* add_user(const std::string& username);
+
+	/**
+	 * Take \p user out of the channel and destroy it. The other users
+	 * learn that it left after the latency of their links from it.
+	 * Must not be called from a callback of \p user; post() it instead.
+	 */
+	void remove_user(User* user);
+
+	User* user(const std::string& username) const;
+	std::vector<User*> users() const;
+
+	/**
+	 * Run \p action as an event at the current time, after the events
+	 * already due. Use this for anything a scenario does to a room, so
+	 * that it is timed and ordered like the rest of the simulation.
+	 */
+	void post(std::function<void()> action);
+
+	/**
+	 * Run \p action as an event \p delay milliseconds from now.
+	 */
+	void schedule(uint64_t delay, std::function<void()> action);
+
+	/**
+	 * Process the next event, advancing the clock to it. Returns false
+	 * if there is none.
+	 */
+	bool step();
+
+	/**
+	 * Process events until \p condition holds, or until the clock would
+	 * pass now() + \p timeout. Returns whether \p condition holds.
+	 */
+	bool run_until(std::function<bool()> condition, uint64_t timeout);
+
+	/**
+	 * Process every event in the next \p duration milliseconds.
+	 */
+	void run_for(uint64_t duration);
+
+	const Statistics& statistics() const
+	{
+		return m_statistics;
+	}
+
+	/* A uniformly distributed random number from the seed. */
+	uint64_t random();
+
+	protected:
+	friend class User;
+
+	class Timer;
+
+	struct Broadcast
+	{
+		std::string message;
+		/*
+		 * The type of each protocol message in the broadcast, one entry
+		 * per message: a batch of two Authentication messages lists
+		 * Authentication twice.
+		 */
+		std::vector<np1sec::Message::Type> types;
+	};
+
+	struct Event
+	{
+		uint64_t time;
+		uint64_t sequence;
+		std::function<void()> action;
+
+		bool operator<(const Event& other) const
+		{
+			// std::priority_queue puts the greatest first.
+			if (time != other.time) {
+				return time > other.time;
+			}
+			return sequence > other.sequence;
+		}
+	};
+
+	void broadcast(User* sender, const std::string& message);
+	np1sec::TimerToken* set_timer(uint32_t interval, np1sec::TimerCallback* callback);
+	/* Counts the broadcast, and each protocol message in it, into the statistics. */
+	void count_message(Broadcast* broadcast);
+	void deliver(User* receiver, const std::string& sender, const Broadcast& broadcast);
+	/* Schedules \p action for \p receiver after \p delay, but not before anything queued for it earlier. */
+	void schedule_delivery(User* receiver, uint64_t delay, std::function<void()> action);
+
+	protected:
+	Configuration m_configuration;
+	uint64_t m_now;
+	uint64_t m_next_sequence;
+	uint64_t m_random_state;
+	std::priority_queue<Event> m_events;
+	std::map<std::pair<std::string, std::string>, LinkProperties> m_links;
+	/* Indexed by User::m_index; removed users leave a null entry, so that indices are never reused. */
+	std::vector<std::unique_ptr<User>> m_users;
+	Statistics m_statistics;
+	/* Time spent by the network itself inside the current event, to be excluded from the statistics. */
+	uint64_t m_cpu_overhead;
+	uint64_t m_wall_overhead;
+};
+
+/**
+ * The process CPU time, in nanoseconds.
+ */
+uint64_t cpu_time();
+
+/**
+ * A monotonic wall clock, in nanoseconds.
+ */
+uint64_t wall_time();
+
+} // namespace simulation
+
+#endif
@@ -0,0 +1,297 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Measures the time it takes N users to establish a conversation, for a
+ * sweep of N and both invite strategies of the echo_chamber tests, and
+ * prints the results as JSON on stdout:
+ *
+ *   room_scaling [users=2,4,8,...] [strategy=consecutive,concurrent]
+ *                [budget=S] [delay=MS] [latency=MS] [seed=S] [fsck=0|1]
+ *
+ * All users connect at once. user0 then creates a conversation and
+ * invites the others: one at a time, each after the previous one joined
+ * the chat (consecutive), or each as soon as it is seen in the channel,
+ * delay milliseconds apart (concurrent). Invitees join when invited.
+ *
+ * Phases overlap, so their costs are those of the messages belonging to
+ * them, as charged by the simulated network. The time to establish and
+ * the join times of the invitees are in virtual milliseconds, which only
+ * depend on the link latency and the number of round trips. Once one run
+ * of a strategy takes more than budget seconds, the larger sizes are
+ * skipped for that strategy.
+ */
+
+#include "network.h"
+#include "src/crypto.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace simulation;
+
+namespace {
+
+/* Virtual time a run may take before it is given up. */
+const uint64_t c_run_timeout = 60 * 60 * 1000;
+
+const char* const c_phases[] = {"hello", "authentication", "invite", "join", "key_exchange", "activation", "other"};
+
+const char* phase_of(np1sec::Message::Type type)
+{
+	typedef np1sec::Message::Type Type;
+	switch (type) {
+		case Type::Hello:
+			return "hello";
+		case Type::RoomAuthenticationRequest:
+		case Type::RoomAuthentication:
+		case Type::AuthenticationRequest:
+		case Type::Authentication:
+		case Type::AuthenticateInvite:
+			return "authentication";
+		case Type::Invite:
+		case Type::ConversationStatus:
+		case Type::ConversationConfirmation:
+		case Type::InviteAcceptance:
+		case Type::CancelInvite:
+			return "invite";
+		case Type::Join:
+		case Type::ConsistencyStatus:
+		case Type::ConsistencyCheck:
+			return "join";
+		case Type::KeyExchangePublicKey:
+		case Type::KeyExchangeSecretShare:
+		case Type::KeyExchangeAcceptance:
+		case Type::KeyExchangeReveal:
+			return "key_exchange";
+		case Type::KeyActivation:
+			return "activation";
+		default:
+			return "other";
+	}
+}
+
+struct Run
+{
+	bool completed = false;
+	/* Virtual time from the first connection until everyone is in the chat. */
+	uint64_t virtual_time = 0;
+	/* Virtual time at which each invitee joined the chat, as seen by user0. */
+	std::vector<uint64_t> join_times;
+	Statistics statistics;
+	uint64_t wall_time = 0;
+};
+
+Run run(size_t user_count, bool concurrent, uint64_t delay, const Configuration& configuration)
+{
+	Network network(configuration);
+	std::vector<User*> users;
+	for (size_t i = 0; i < user_count; i++) {
+		users.push_back(network.add_user("user" + std::to_string(i)));
+	}
+	User* creator = users[0];
+
+	for (User* user : users) {
+		user->on_invited = [&network, user](np1sec::Conversation* conversation, const std::string&) {
+			network.post([conversation] { conversation->join(); });
+		};
+	}
+
+	Run result;
+	np1sec::Conversation* conversation = nullptr;
+	std::vector<std::pair<std::string, np1sec::PublicKey>> pending;
+	size_t invited = 0;
+
+	auto invite_pending = [&] {
+		while (conversation && !pending.empty() && (concurrent || invited == result.join_times.size())) {
+			std::string username = pending.front().first;
+			np1sec::PublicKey public_key = pending.front().second;
+			pending.erase(pending.begin());
+			network.schedule(concurrent ? invited * delay : 0, [&conversation, username, public_key] {
+				conversation->invite(username, public_key);
+			});
+			invited++;
+		}
+	};
+
+	creator->on_connected = [&] {
+		network.post([creator] { creator->room().create_conversation(); });
+	};
+	creator->on_created_conversation = [&](np1sec::Conversation* created) {
+		conversation = created;
+		invite_pending();
+	};
+	creator->on_user_joined = [&](const std::string& username, const np1sec::PublicKey& public_key) {
+		if (username != creator->username()) {
+			pending.push_back(std::make_pair(username, public_key));
+			invite_pending();
+		}
+	};
+	creator->on_user_joined_chat = [&](np1sec::Conversation*, const std::string&) {
+		result.join_times.push_back(network.now());
+		invite_pending();
+	};
+
+	for (User* user : users) {
+		network.post([user] { user->connect(); });
+	}
+
+	uint64_t wall_start = wall_time();
+	result.completed = network.run_until([&] {
+		if (result.join_times.size() != user_count - 1) {
+			return false;
+		}
+		for (User* user : users) {
+			std::vector<np1sec::Conversation*> conversations = user->conversations();
+			if (conversations.size() != 1 || !conversations[0]->in_chat() || conversations[0]->participants().size() != user_count) {
+				return false;
+			}
+		}
+		return true;
+	}, c_run_timeout);
+	result.wall_time = wall_time() - wall_start;
+	result.virtual_time = network.now();
+	result.statistics = network.statistics();
+	return result;
+}
+
+void print_run(bool first, const char* strategy, size_t user_count, const Run& run)
+{
+	const Statistics& statistics = run.statistics;
+	std::printf("%s\n\t\t{\"strategy\": \"%s\", \"users\": %zu, \"completed\": %s", first ? "" : ",", strategy, user_count, run.completed ? "true" : "false");
+	std::printf(", \"virtual_ms\": %llu, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"messages\": %llu, \"bytes\": %llu",
+		(unsigned long long) run.virtual_time, run.wall_time / 1e6, statistics.cpu_time / 1e6,
+		(unsigned long long) statistics.messages_sent, (unsigned long long) statistics.bytes_sent);
+
+	std::printf(",\n\t\t\t\"join_ms\": [");
+	for (size_t i = 0; i < run.join_times.size(); i++) {
+		std::printf("%s%llu", i ? ", " : "", (unsigned long long) run.join_times[i]);
+	}
+	std::printf("],\n\t\t\t\"phases\": {");
+
+	for (size_t i = 0; i < sizeof(c_phases) / sizeof(c_phases[0]); i++) {
+		MessageStatistics phase;
+		for (const auto& j : statistics.messages_by_type) {
+			if (strcmp(phase_of(j.first), c_phases[i]) == 0) {
+				phase.sent += j.second.sent;
+				phase.bytes += j.second.bytes;
+				phase.cpu_time += j.second.cpu_time;
+				phase.wall_time += j.second.wall_time;
+			}
+		}
+		std::printf("%s\n\t\t\t\t\"%s\": {\"messages\": %llu, \"bytes\": %llu, \"cpu_ms\": %.3f, \"wall_ms\": %.3f}",
+			i ? "," : "", c_phases[i], (unsigned long long) phase.sent, (unsigned long long) phase.bytes,
+			phase.cpu_time / 1e6, phase.wall_time / 1e6);
+	}
+	std::printf("\n\t\t\t}\n\t\t}");
+	std::fflush(stdout);
+}
+
+std::vector<std::string> split(const std::string& list)
+{
+	std::vector<std::string> result;
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t end = list.find(',', start);
+		if (end == std::string::npos) {
+			end = list.size();
+		}
+		if (end > start) {
+			result.push_back(list.substr(start, end - start));
+		}
+		start = end + 1;
+	}
+	return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	std::vector<size_t> sizes = {2, 4, 8, 16, 32, 64, 100, 128};
+	std::vector<std::string> strategies = {"consecutive", "concurrent"};
+	double budget = 600;
+	uint64_t delay = 0;
+	Configuration configuration;
+	configuration.default_link.latency = 50;
+	configuration.fsck = false;
+
+	for (int i = 1; i < argc; i++) {
+		const char* separator = strchr(argv[i], '=');
+		if (!separator) {
+			std::fprintf(stderr, "usage: %s [users=2,4,8,...] [strategy=consecutive,concurrent] [budget=S] [delay=MS] [latency=MS] [seed=S] [fsck=0|1]\n", argv[0]);
+			return 2;
+		}
+		std::string name(argv[i], separator - argv[i]);
+		const char* value = separator + 1;
+		if (name == "users") {
+			sizes.clear();
+			for (const std::string& size : split(value)) {
+				sizes.push_back(strtoul(size.c_str(), nullptr, 10));
+			}
+		} else if (name == "strategy") {
+			strategies = split(value);
+		} else if (name == "budget") {
+			budget = strtod(value, nullptr);
+		} else if (name == "delay") {
+			delay = strtoull(value, nullptr, 10);
+		} else if (name == "latency") {
+			configuration.default_link.latency = strtoul(value, nullptr, 10);
+		} else if (name == "seed") {
+			configuration.seed = strtoull(value, nullptr, 10);
+		} else if (name == "fsck") {
+			configuration.fsck = strtoul(value, nullptr, 10) != 0;
+		} else {
+			std::fprintf(stderr, "unknown parameter: %s\n", name.c_str());
+			return 2;
+		}
+	}
+	for (size_t size : sizes) {
+		if (size < 2) {
+			std::fprintf(stderr, "need at least two users\n");
+			return 2;
+		}
+	}
+	for (const std::string& strategy : strategies) {
+		if (strategy != "consecutive" && strategy != "concurrent") {
+			std::fprintf(stderr, "unknown strategy: %s\n", strategy.c_str());
+			return 2;
+		}
+	}
+
+	std::printf("{\n");
+	std::printf("\t\"backend\": \"%s\",\n", np1sec::crypto::backend_name());
+	std::printf("\t\"latency_ms\": %u,\n", configuration.default_link.latency);
+	std::printf("\t\"results\": [");
+	bool first = true;
+	for (const std::string& strategy : strategies) {
+		for (size_t size : sizes) {
+			Run result = run(size, strategy == "concurrent", delay, configuration);
+			print_run(first, strategy.c_str(), size, result);
+			first = false;
+			if (result.wall_time / 1e9 > budget || !result.completed) {
+				break;
+			}
+		}
+	}
+	std::printf("\n\t]\n}\n");
+	return 0;
+}
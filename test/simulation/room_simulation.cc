@@ -0,0 +1,361 @@
+/**
+ * (n+1)Sec Multiparty Off-the-Record Messaging library
+ * Copyright (C) 2016, eQualit.ie
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 3 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Runs a scenario on the simulated network and prints what each phase of
+ * it cost as JSON:
+ *
+ *   room_simulation [scenario=create|churn|ratchet] [users=N] [seed=S]
+ *                   [latency=MS] [jitter=MS] [loss=P] [rounds=R] [minutes=M]
+ *                   [trace=FILE]
+ *
+ * create:  N users connect, and one of them invites everyone else into a
+ *          conversation, who join as soon as they are invited.
+ * churn:   create, then for R rounds a random participant leaves the
+ *          channel and a new user joins the conversation.
+ * ratchet: create, then every participant chats for M virtual minutes,
+ *          which spans several automatic key ratchets.
+ *
+ * Exits with status 1 if a phase does not complete within its virtual
+ * deadline. With trace set, the key exchange and session events of every
+ * room are written to FILE in the Chrome trace format, on the virtual
+ * clock.
+ */
+
+#include "network.h"
+#include "src/debug.h"
+#include "src/trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+
+using namespace simulation;
+
+namespace {
+
+/* Virtual time a phase may take before the scenario gives up on it. */
+const uint64_t c_phase_timeout = 10 * 60 * 1000;
+
+class Scenario
+{
+	public:
+	explicit Scenario(const Configuration& configuration):
+		m_network(configuration),
+		m_completed(true),
+		m_next_user(0),
+		m_trace_sink(nullptr)
+	{}
+	
+	/* Set before adding users. */
+	void set_trace_sink(np1sec::TraceSink* sink)
+	{
+		m_trace_sink = sink;
+	}
+
+	Network& network()
+	{
+		return m_network;
+	}
+
+	bool completed() const
+	{
+		return m_completed;
+	}
+
+	User* add_user()
+	{
+		User* user = m_network.add_user("user" + std::to_string(m_next_user++));
+		user->room().set_trace_sink(m_trace_sink);
+		user->on_invited = [this, user](np1sec::Conversation* conversation, const std::string&) {
+			m_network.post([user, conversation] {
+				for (np1sec::Conversation* c : user->conversations()) {
+					if (c == conversation) {
+						conversation->join();
+					}
+				}
+			});
+		};
+		return user;
+	}
+
+	/*
+	 * Connect \p users and wait until every user in the channel knows
+	 * every other.
+	 */
+	void connect(const std::vector<User*>& users)
+	{
+		for (User* user : users) {
+			m_network.post([user] { user->connect(); });
+		}
+		finish("connect", [this] {
+			std::vector<User*> users = m_network.users();
+			for (User* user : users) {
+				if (user->room().users().size() != users.size()) {
+					return false;
+				}
+			}
+			return true;
+		});
+	}
+
+	/*
+	 * Have \p creator create a conversation and invite everyone else in
+	 * the channel, and wait until all of them are in its chat.
+	 */
+	void create(User* creator)
+	{
+		creator->on_created_conversation = [this, creator](np1sec::Conversation* conversation) {
+			m_network.post([this, creator, conversation] {
+				for (const auto& i : creator->room().users()) {
+					if (i.first != creator->username()) {
+						conversation->invite(i.first, i.second);
+					}
+				}
+			});
+		};
+		m_network.post([creator] { creator->room().create_conversation(); });
+		finish("create", [this] { return everyone_in_chat(); });
+	}
+
+	/*
+	 * Replace a random participant other than \p host by a new user, whom
+	 * \p host invites.
+	 */
+	void churn(User* host)
+	{
+		std::vector<User*> users = m_network.users();
+		User* leaving;
+		do {
+			leaving = users[m_network.random() % users.size()];
+		} while (leaving == host);
+		m_network.post([this, leaving] { m_network.remove_user(leaving); });
+
+		User* joining = add_user();
+		host->on_user_joined = [this, host, joining](const std::string& username, const np1sec::PublicKey& public_key) {
+			if (username != joining->username()) {
+				return;
+			}
+			m_network.post([host, username, public_key] {
+				for (np1sec::Conversation* conversation : host->conversations()) {
+					conversation->invite(username, public_key);
+				}
+			});
+		};
+		m_network.post([joining] { joining->connect(); });
+		finish("churn", [this] { return everyone_in_chat(); });
+	}
+
+	/*
+	 * Have every participant send a chat message every \p interval
+	 * milliseconds for \p duration milliseconds, and wait for the last of
+	 * them to arrive everywhere.
+	 */
+	void chat(uint64_t duration, uint64_t interval)
+	{
+		std::vector<User*> users = m_network.users();
+		uint64_t expected = 0;
+		for (uint64_t time = 0; time < duration; time += interval) {
+			for (User* user : users) {
+				m_network.schedule(time, [user] {
+					for (np1sec::Conversation* conversation : user->conversations()) {
+						conversation->send_chat("hello");
+					}
+				});
+			}
+			expected += users.size() * users.size();
+		}
+		m_received = 0;
+		for (User* user : users) {
+			user->on_message = [this](np1sec::Conversation*, const std::string&, const std::string&) {
+				m_received++;
+			};
+		}
+		finish("chat", [this, expected] { return m_received >= expected; }, duration + c_phase_timeout);
+	}
+
+	void print(const std::string& scenario, size_t users, uint64_t seed, std::ostream& os) const
+	{
+		os << "{\n";
+		os << "  \"scenario\": \"" << scenario << "\",\n";
+		os << "  \"users\": " << users << ",\n";
+		os << "  \"seed\": " << seed << ",\n";
+		os << "  \"completed\": " << (m_completed ? "true" : "false") << ",\n";
+		os << "  \"phases\": [";
+		for (size_t i = 0; i < m_phases.size(); i++) {
+			const Phase& phase = m_phases[i];
+			os << (i ? ",\n" : "\n");
+			os << "    {\"name\": \"" << phase.name << "\""
+				<< ", \"completed\": " << (phase.completed ? "true" : "false")
+				<< ", \"virtual_ms\": " << phase.virtual_time
+				<< ", \"wall_ms\": " << phase.wall_time / 1e6
+				<< ", \"cpu_ms\": " << phase.statistics.cpu_time / 1e6
+				<< ", \"messages\": " << phase.statistics.messages_sent
+				<< ", \"bytes\": " << phase.statistics.bytes_sent
+				<< ", \"deliveries\": " << phase.statistics.messages_delivered
+				<< ", \"losses\": " << phase.statistics.messages_lost
+				<< ", \"by_type\": {";
+			bool first = true;
+			for (const auto& j : phase.statistics.messages_by_type) {
+				os << (first ? "" : ", ") << "\"" << j.first << "\": " << j.second.sent;
+				first = false;
+			}
+			os << "}}";
+		}
+		os << "\n  ]\n";
+		os << "}\n";
+	}
+
+	protected:
+	struct Phase
+	{
+		std::string name;
+		bool completed;
+		uint64_t virtual_time;
+		uint64_t wall_time;
+		Statistics statistics;
+	};
+
+	bool everyone_in_chat() const
+	{
+		std::vector<User*> users = m_network.users();
+		for (User* user : users) {
+			std::vector<np1sec::Conversation*> conversations = user->conversations();
+			if (conversations.size() != 1 || !conversations[0]->in_chat() || conversations[0]->participants().size() != users.size()) {
+				return false;
+			}
+			std::set<std::string> participants = conversations[0]->participants();
+			for (User* other : users) {
+				if (!participants.count(other->username()) || !conversations[0]->participant_in_chat(other->username())) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	void finish(const std::string& name, std::function<bool()> condition, uint64_t timeout = c_phase_timeout)
+	{
+		Phase phase;
+		phase.name = name;
+		Statistics before = m_network.statistics();
+		uint64_t virtual_start = m_network.now();
+		auto wall_start = std::chrono::steady_clock::now();
+
+		phase.completed = m_completed && m_network.run_until(condition, timeout);
+
+		phase.wall_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wall_start).count();
+		phase.virtual_time = m_network.now() - virtual_start;
+		phase.statistics = m_network.statistics() - before;
+		m_completed = phase.completed;
+		m_phases.push_back(phase);
+	}
+
+	protected:
+	Network m_network;
+	bool m_completed;
+	size_t m_next_user;
+	np1sec::TraceSink* m_trace_sink;
+	uint64_t m_received;
+	std::vector<Phase> m_phases;
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	std::string scenario_name = "create";
+	std::string trace_file;
+	size_t users = 8;
+	size_t rounds = 5;
+	uint64_t minutes = 5;
+	Configuration configuration;
+	configuration.default_link.latency = 50;
+
+	for (int i = 1; i < argc; i++) {
+		const char* separator = strchr(argv[i], '=');
+		if (!separator) {
+			fprintf(stderr, "usage: %s [scenario=create|churn|ratchet] [users=N] [seed=S] [latency=MS] [jitter=MS] [loss=P] [rounds=R] [minutes=M] [trace=FILE]\n", argv[0]);
+			return 2;
+		}
+		std::string name(argv[i], separator - argv[i]);
+		const char* value = separator + 1;
+		if (name == "scenario") {
+			scenario_name = value;
+		} else if (name == "users") {
+			users = strtoul(value, nullptr, 10);
+		} else if (name == "seed") {
+			configuration.seed = strtoull(value, nullptr, 10);
+		} else if (name == "latency") {
+			configuration.default_link.latency = strtoul(value, nullptr, 10);
+		} else if (name == "jitter") {
+			configuration.default_link.jitter = strtoul(value, nullptr, 10);
+		} else if (name == "loss") {
+			configuration.default_link.loss = strtod(value, nullptr);
+		} else if (name == "rounds") {
+			rounds = strtoul(value, nullptr, 10);
+		} else if (name == "minutes") {
+			minutes = strtoull(value, nullptr, 10);
+		} else if (name == "trace") {
+			trace_file = value;
+		} else {
+			fprintf(stderr, "unknown parameter: %s\n", name.c_str());
+			return 2;
+		}
+	}
+	if (users < 2 || (scenario_name != "create" && scenario_name != "churn" && scenario_name != "ratchet")) {
+		fprintf(stderr, "need a known scenario and at least two users\n");
+		return 2;
+	}
+
+	std::ofstream trace_stream;
+	std::unique_ptr<np1sec::ChromeTraceWriter> trace_writer;
+	if (!trace_file.empty()) {
+		trace_stream.open(trace_file);
+		if (!trace_stream) {
+			fprintf(stderr, "cannot write %s\n", trace_file.c_str());
+			return 2;
+		}
+		trace_writer.reset(new np1sec::ChromeTraceWriter(trace_stream, true));
+	}
+	
+	Scenario scenario(configuration);
+	scenario.set_trace_sink(trace_writer.get());
+	std::vector<User*> initial;
+	for (size_t i = 0; i < users; i++) {
+		initial.push_back(scenario.add_user());
+	}
+	scenario.connect(initial);
+	scenario.create(initial[0]);
+
+	if (scenario_name == "churn") {
+		for (size_t i = 0; i < rounds; i++) {
+			scenario.churn(initial[0]);
+		}
+	} else if (scenario_name == "ratchet") {
+		scenario.chat(minutes * 60 * 1000, 10 * 1000);
+	}
+
+	scenario.print(scenario_name, users, configuration.seed, std::cout);
+	return scenario.completed() ? 0 : 1;
+}